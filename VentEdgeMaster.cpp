@@ -16,9 +16,11 @@ i = Ændre i auto-read intervallet (5-300 sekunder)
 */
 
 #include <ModbusMaster.h>
+#include "modbus_read_planner.h"
 
 // Function Prototype
 void printMenu();
+void setupReadPlan();
 
 // ================ MODBUS COMMUNICATION CONFIGURATION ================
 #define RX_PIN 36           // UART2 RX pin
@@ -27,10 +29,13 @@ void printMenu();
 #define MAX485_RE_NEG 14    // RS485 Receiver Enable pin (active low)
 #define BAUD_RATE 9600      // Communication speed
 #define MODBUS_SLAVE_ID 1   // Slave device address
+#define READ_GAP_TOLERANCE 8 // Max unused registers bridged inside one block read
 
 // ================ DATA BUFFERS ================
 uint16_t holdingRegs[2];
-uint16_t inputRegs[20];
+uint16_t inputRegs[READ_PLAN_MAX_REGS];   // Block read buffer, filled through sensorPlan
+
+ReadPlan sensorPlan;
 
 ModbusMaster modbus;
 
@@ -122,7 +127,9 @@ void setup() {
   modbus.preTransmission(preTransmission);
   modbus.postTransmission(postTransmission);
 
-  Serial.println("Modbus RTU Initialized Successfully\n");
+  Serial.println("Modbus RTU Initialized Successfully");
+  setupReadPlan();
+  Serial.println();
   printMenu();
 }
 
@@ -163,19 +170,65 @@ void writeFanMode(uint16_t mode) {
   }
 }
 
+// =============== READ PLAN ===============
+// Merges all register tables into as few block reads as possible
+void setupReadPlan() {
+  uint16_t addrs[2 + NUM_TEMPS + NUM_PRESSURES + NUM_FLOWS + NUM_RUNTIMES];
+  uint8_t n = 0;
+
+  addrs[n++] = 1;   // Heat Exchanger Efficiency
+  addrs[n++] = 2;   // Run Mode
+  for (int i = 0; i < NUM_TEMPS; i++)     addrs[n++] = tempRegisters[i].address;
+  for (int i = 0; i < NUM_PRESSURES; i++) addrs[n++] = pressureRegisters[i].address;
+  for (int i = 0; i < NUM_FLOWS; i++)     addrs[n++] = flowRegisters[i].address;
+  for (int i = 0; i < NUM_RUNTIMES; i++)  addrs[n++] = runtimeRegisters[i].address;
+
+  if (buildReadPlan(sensorPlan, addrs, n, inputRegs, READ_PLAN_MAX_REGS, READ_GAP_TOLERANCE) == 0) {
+    Serial.println("ERROR: Register map does not fit the read plan");
+    return;
+  }
+
+  Serial.printf("Read plan: %u registers in %u block reads\n", n, sensorPlan.numSpans);
+  for (uint8_t s = 0; s < sensorPlan.numSpans; s++) {
+    Serial.printf("  Block %u: Reg %u-%u (%u regs)\n", s,
+                  sensorPlan.spans[s].start,
+                  sensorPlan.spans[s].start + sensorPlan.spans[s].count - 1,
+                  sensorPlan.spans[s].count);
+  }
+}
+
+// Reads every block in the plan into inputRegs. Returns number of good blocks.
+int readPlannedBlocks() {
+  int okBlocks = 0;
+
+  for (uint8_t s = 0; s < sensorPlan.numSpans; s++) {
+    const ReadSpan& span = sensorPlan.spans[s];
+    uint8_t result = modbus.readInputRegisters(span.start, span.count);
+    sensorPlan.spanResult[s] = result;
+
+    if (result == modbus.ku8MBSuccess) {
+      for (uint16_t i = 0; i < span.count; i++) {
+        sensorPlan.values[span.offset + i] = modbus.getResponseBuffer(i);
+      }
+      okBlocks++;
+    }
+    delay(50);
+  }
+  return okBlocks;
+}
+
 // =============== READ EFFICIENCY ===============
 bool readEfficiency() {
-  uint8_t result = modbus.readInputRegisters(1, 1);
+  uint16_t rawValue;
   
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
+  if (planLookup(sensorPlan, 1, &rawValue)) {
     float efficiency = rawValue / 10.0f;
     Serial.printf("  %-25s [Reg   1]: %5u (%.1f %%)\n",
                   "Heat Exchanger Efficiency", rawValue, efficiency);
     return true;
   } else {
     Serial.printf("  %-25s [Reg   1]: ERROR (code %u)\n",
-                  "Heat Exchanger Efficiency", result);
+                  "Heat Exchanger Efficiency", planResult(sensorPlan, 1));
     return false;
   }
 }
@@ -183,10 +236,9 @@ bool readEfficiency() {
 
 // =============== READ RUN MODE ===============
 bool readRunMode() {
-  uint8_t result = modbus.readInputRegisters(2, 1);
+  uint16_t rawValue;
   
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
+  if (planLookup(sensorPlan, 2, &rawValue)) {
     
     const char* modeText;
     switch(rawValue) {
@@ -210,74 +262,70 @@ bool readRunMode() {
     return true;
   } else {
     Serial.printf("  %-25s [Reg   2]: ERROR (code %u)\n",
-                  "Run Mode", result);
+                  "Run Mode", planResult(sensorPlan, 2));
     return false;
   }
 }
 
 // =============== READ SINGLE TEMPERATURE ===============
 bool readSingleTemp(uint16_t regAddress, const char* name) {
-  uint8_t result = modbus.readInputRegisters(regAddress, 1);
+  uint16_t rawValue;
   
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
+  if (planLookup(sensorPlan, regAddress, &rawValue)) {
     float temperature = rawValue / 10.0f;
     Serial.printf("  %-25s [Reg %3u]: %5u (%.1f °C)\n",
                   name, regAddress, rawValue, temperature);
     return true;
   } else {
     Serial.printf("  %-25s [Reg %3u]: ERROR (code %u)\n",
-                  name, regAddress, result);
+                  name, regAddress, planResult(sensorPlan, regAddress));
     return false;
   }
 }
 
 // =============== READ SINGLE PRESSURE ===============
 bool readSinglePressure(uint16_t regAddress, const char* name) {
-  uint8_t result = modbus.readInputRegisters(regAddress, 1);
+  uint16_t rawValue;
   
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
+  if (planLookup(sensorPlan, regAddress, &rawValue)) {
     float pressure = rawValue / 10.0f;
     Serial.printf("  %-25s [Reg %3u]: %5u (%.1f Pa)\n",
                   name, regAddress, rawValue, pressure);
     return true;
   } else {
     Serial.printf("  %-25s [Reg %3u]: ERROR (code %u)\n",
-                  name, regAddress, result);
+                  name, regAddress, planResult(sensorPlan, regAddress));
     return false;
   }
 }
 
 // =============== READ SINGLE FLOW ===============
 bool readSingleFlow(uint16_t regAddress, const char* name) {
-  uint8_t result = modbus.readInputRegisters(regAddress, 1);
+  uint16_t rawValue;
   
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
+  if (planLookup(sensorPlan, regAddress, &rawValue)) {
     float flow = rawValue / 10.0f;
     Serial.printf("  %-25s [Reg %3u]: %5u (%.1f m³/h)\n",
                   name, regAddress, rawValue, flow);
     return true;
   } else {
     Serial.printf("  %-25s [Reg %3u]: ERROR (code %u)\n",
-                  name, regAddress, result);
+                  name, regAddress, planResult(sensorPlan, regAddress));
     return false;
   }
 }
 
 // =============== READ SINGLE RUNTIME ===============
 bool readSingleRuntime(uint16_t regAddress, const char* name) {
-  uint8_t result = modbus.readInputRegisters(regAddress, 1);
+  uint16_t raw;
 
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t raw = modbus.getResponseBuffer(0);
+  if (planLookup(sensorPlan, regAddress, &raw)) {
     Serial.printf("  %-25s [Reg %3u]: %5u (minutes)\n",
                   name, regAddress, raw);
     return true;
   } else {
     Serial.printf("  %-25s [Reg %3u]: ERROR (code %u)\n",
-                  name, regAddress, result);
+                  name, regAddress, planResult(sensorPlan, regAddress));
     return false;
   }
 }
@@ -316,12 +364,13 @@ void readAllSensors() {
   Serial.println("║          READING ALL SENSORS                   ║");
   Serial.println("╚════════════════════════════════════════════════╝\n");
   
+  int okBlocks = readPlannedBlocks();
+  Serial.printf("Block reads: %d/%u OK\n\n", okBlocks, sensorPlan.numSpans);
+  
   // System Status
   Serial.println("--- System Status ---");
   if (readEfficiency()) totalSuccess++;
-  delay(50);
   if (readRunMode()) totalSuccess++;
-  delay(50);
   
   // Temperatures (værdi i C)
   Serial.println("\n--- Temperatures ---");
@@ -329,7 +378,6 @@ void readAllSensors() {
     if (readSingleTemp(tempRegisters[i].address, tempRegisters[i].name)) {
       totalSuccess++;
     }
-    delay(50);
   }
   
   // Pressures (værdi i Pa)
@@ -338,7 +386,6 @@ void readAllSensors() {
     if (readSinglePressure(pressureRegisters[i].address, pressureRegisters[i].name)) {
       totalSuccess++;
     }
-    delay(50);
   }
   
   // Air Flows (værdi i m3/h)
@@ -347,7 +394,6 @@ void readAllSensors() {
     if (readSingleFlow(flowRegisters[i].address, flowRegisters[i].name)) {
       totalSuccess++;
     }
-    delay(50);
   }
   
     // Runtime (værdi i minutter)
@@ -356,7 +402,6 @@ void readAllSensors() {
     if (readSingleRuntime(runtimeRegisters[i].address, runtimeRegisters[i].name)){
       totalSuccess++;
     }
-    delay(50);
   } 
 
 
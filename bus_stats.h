@@ -0,0 +1,77 @@
+/*
+Instrumentering af Modbus bussen pr. slave.
+
+Tællere for requests, timeouts, CRC fejl, exceptions og gentagelser, samt
+histogrammer for request->response latency, sweep-varighed og tiden fra en
+kommando modtages til slaven har kvitteret for skrivningen. At registrere
+en måling er en lineær søgning i en lille fast tabel og en increment - ingen
+floats, ingen heap. Percentiler regnes først ud når de skal publiceres.
+
+Tællerne tæller op fra boot (Grafana laver selv rate()), histogrammerne
+nulstilles hver gang de er publiceret, så percentilerne viser den seneste
+periode.
+*/
+
+#ifndef BUS_STATS_H
+#define BUS_STATS_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Upper bound (ms) of each bucket; the last bucket takes everything above
+static const uint16_t HIST_EDGES_MS[] = {
+  5, 10, 20, 30, 50, 75, 100, 150, 200, 300, 500, 750, 1000, 1500, 2000, 3000, 5000, 10000
+};
+#define HIST_BUCKETS (sizeof(HIST_EDGES_MS) / sizeof(HIST_EDGES_MS[0]) + 1)
+
+// ================ HISTOGRAM ================
+struct Histogram {
+  uint16_t counts[HIST_BUCKETS];
+  uint32_t maxMs;
+
+  void add(uint32_t ms) {
+    uint8_t b = 0;
+    while (b < HIST_BUCKETS - 1 && ms > HIST_EDGES_MS[b]) b++;
+    if (counts[b] < 0xFFFF) counts[b]++;
+    if (ms > maxMs) maxMs = ms;
+  }
+
+  uint32_t total() const {
+    uint32_t n = 0;
+    for (uint8_t b = 0; b < HIST_BUCKETS; b++) n += counts[b];
+    return n;
+  }
+
+  // Upper bound of the bucket holding the pct-th percentile, capped at the
+  // largest value seen. 0 when the histogram is empty.
+  uint32_t percentile(uint8_t pct) const {
+    uint32_t n = total();
+    if (n == 0) return 0;
+    uint32_t rank = (n * pct + 99) / 100;
+    uint32_t seen = 0;
+    for (uint8_t b = 0; b < HIST_BUCKETS - 1; b++) {
+      seen += counts[b];
+      if (seen >= rank) return HIST_EDGES_MS[b] < maxMs ? HIST_EDGES_MS[b] : maxMs;
+    }
+    return maxMs;
+  }
+
+  void reset() { memset(this, 0, sizeof(*this)); }
+};
+
+// ================ PER-SLAVE STATS ================
+struct BusStats {
+  uint32_t requests;
+  uint32_t timeouts;
+  uint32_t crcErrors;
+  uint32_t exceptions;          // Modbus exception responses (codes 1-4)
+  uint32_t otherErrors;         // Wrong slave, function or length
+  uint32_t retries;             // Requests right after a failed one to the same slave
+  bool lastFailed;
+
+  Histogram latency;            // Request to response, answered requests only
+  Histogram sweep;              // Start to end of a sweep (not sample-only sweeps)
+  Histogram command;            // Command received to write acknowledged by the slave
+};
+
+#endif
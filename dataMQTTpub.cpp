@@ -1,10 +1,85 @@
 /*
-v6 af ModbusMaster programmet til DV10 Ventilationsanlæg
+v7 af Modbus programmet til DV10 Ventilationsanlæg
 NU MED SPARKPLUG B MQTT SUPPORT!
 
 Programmet rapportere 'RunMode', 'Heat Exchange Efficiency', 'Runtime', temperatur, tryk, 
 flow og sender alt data via MQTT i Sparkplug B format.
 
+Modbus læsningen kører non-blocking (modbus_rtu_master.h), så MQTT og
+kommandoer bliver serviceret mens en sweep er i gang.
+
+Er MQTT nede, gemmes samples i en store-and-forward buffer (store_forward.h)
+og sendes bagefter som historiske DDATA. WiFi og MQTT genforbindes i
+baggrunden (serviceConnection) med eksponentiel backoff og jitter, så
+Modbus polling fortsætter under udfald.
+
+Flere DV10 anlæg kan dele samme RS485 bus (DV10_SLAVES). Hvert anlæg har
+sin egen SensorData og sit eget Sparkplug device (DBIRTH/DDATA). Bus-
+scheduleren skiftes mellem anlæggene én request ad gangen, og et anlæg der
+ikke svarer sættes offline og prøves kun af og til, så dets timeouts ikke
+forsinker de andre.
+
+Registrene har hver sin poll-klasse (fast/normal/slow) med egen periode og
+prioritet. De registre der er "due" pakkes i fælles blok-læsninger, så f.eks.
+tilluft temperatur og tryk læses hvert 2. sekund, mens driftstimerne kun
+koster bus-tid én gang i minuttet.
+Tryk og flow samples hvert sekund (poll-klassen "sample"), men publiceres
+kun som min/max/middel/antal for vinduet sammen med normal-intervallets
+DDATA, så korte spidser ses uden at hvert sample sendes over MQTT.
+
+Perioderne er steady-state raterne. Mens et anlæg starter eller stopper
+(RunMode 1-4, 10, 11), eller en værdi flytter sig mere end et par deadbands
+pr. periode, polles dets fast/normal/sample klasser op til 4 gange så tit,
+så langt den målte bus-load holder sig inden for budgettet (BUS_BUDGET_PCT).
+Sker der ikke mere, halveres raten igen hvert 20. sekund. Transienter får
+fuld opløsning uden at bussen betaler for det hele døgnet.
+
+Poll-motoren og publish skriver ikke tekst til Serial, men binære records i
+en trace-log (trace_log.h). De bliver kun til tekst når man beder om det
+(t) eller har slået verbose til (v), og kun når UART'en har plads.
+
+Bussen måles pr. anlæg (bus_stats.h): latency- og sweep-histogrammer samt
+timeout/CRC/exception tællere. De sendes hvert minut som NDATA node metrics
+("Modbus/<anlæg>/...") så dårlige kabler og overbelastede busser kan ses i
+Grafana.
+
+Hvert register har sin egen circuit breaker: et register der bliver ved med
+at fejle (f.eks. 292/293 på et anlæg uden ekstra flow) tages ud af sweeps
+og prøves kun alene, med eksponentiel back-off. Imens sendes metric'en med
+Quality = bad. Response timeout læres pr. register ud fra de målte svartider,
+så et dårligt register ikke koster sekunder i hver cyklus.
+
+Fan mode kan skrives fra en host applikation med DCMD "FanMode" på anlæggets
+device (eller fra konsollen). Kommandoen går foran poll-motoren: den skrives
+i næste ledige bus-slot, læses tilbage og den bekræftede værdi sendes som
+DDATA, typisk under 100 ms fra kommando til skrivning.
+
+Modbus og netværk kører som to FreeRTOS tasks på hver sin kerne: bus-
+motoren (sweeps og kommandoer) på kerne 1, WiFi, MQTT og konsollen på kerne
+0 sammen med WiFi stakken. Når en sweep er færdig, lægges anlæggets data i
+et seqlock snapshot (seqlock.h), som netværks-tasken kopierer og publicerer
+fra. Publish ser derfor aldrig en halv sweep, og et hængende connect() eller
+en langsom broker flytter ikke bus-timingen.
+
+Alle registre en sweep læser (også hullerne i en blok-læsning) gemmes rå med
+tidsstempel i et register-image pr. anlæg. Det serveres af en Modbus TCP
+server på port 502 (modbus_tcp_server.h), unit id = anlæggets Modbus adresse,
+så et CTS/BMS anlæg kan læse alle DV10'erne uden at belaste RS485 bussen:
+en læsning er et opslag i hukommelsen. Skrivning af fan mode (holding 367)
+går gennem kommando-køen ligesom DCMD, og svaret sendes når værdien er læst
+tilbage fra anlægget.
+
+RS485 opsætningen (baud, paritet, pausen mellem requests og den største
+blok-læsning) starter på de konservative defaults (9600 8N1, 50 ms). Med
+'c' prøver commissioning anlæggene af: hurtigste baud/paritet de svarer på
+uden fejl, korteste pause og største blok de tager imod. Resultatet gemmes i
+NVS (Preferences) og bruges fra næste boot, så hvert site kører så hurtigt
+som dets kabler tillader.
+
+Alle registre er beskrevet i én tabel (pointTable): adresse, skalering,
+enhed, Sparkplug type, felt i SensorData og poll-klasse. Læsning, dekodning,
+DBIRTH/DDATA og backlog bygger alle på den, så et nyt register er én ny linje.
+
 Kommandoer:
 0 = Sluk ventilation
 1 = Manuel reduceret hastighed
@@ -13,19 +88,54 @@ Kommandoer:
 r = Læs alle sensorer
 m = Vis menu
 a = Slå auto-read TIL/FRA
-i = Ændre i auto-read intervallet (5-300 sekunder)
+i = Ændre i auto-read intervallet (5-300 sekunder, poll-klassen "normal")
+f = Skift payload format (Sparkplug B protobuf / JSON)
+e = Slå report-by-exception TIL/FRA (kun ændrede metrics i DDATA)
+b = Slå DDATA batching TIL/FRA (flere sweeps pr. DDATA, tidsstempel pr. metric)
+u = Vælg anlæg for kommandoerne 0-3 og r (alle / ét ad gangen)
+v = Slå verbose trace TIL/FRA (ellers vises kun advarsler og fejl)
+t = Vis trace-loggen (de sidste 512 hændelser)
+s = Vis bus-statistik (latency, timeouts, CRC fejl ... pr. anlæg, registre der fejler)
+c = Commissioning af RS485 linket (find og gem hurtigste stabile opsætning)
 */
 
-#include <ModbusMaster.h>
 #include <WiFi.h>
 #include <PubSubClient.h>
 #include <ArduinoJson.h>
+#include <Preferences.h>
+#include "modbus_read_planner.h"
+#include "modbus_rtu_master.h"
+#include "modbus_tcp_server.h"
+#include "sparkplug_b.h"
+#include "bus_stats.h"
+#include "store_forward.h"
+#include "trace_log.h"
+#include "seqlock.h"
+#include <atomic>
+#include <new>
 
 // Function Prototypes
+struct Slave;
 void printMenu();
 void setupWiFi();
-void reconnectMQTT();
-void publishSparkplugData();
+void serviceConnection();
+void publishSparkplugData(Slave& s, bool withWindow);
+void flushBatch(Slave& s);
+void setupReadPlan();
+void setupSlaves();
+void noteResult(Slave& s, uint8_t result);
+bool queueCommand(Slave& s, uint16_t reg, uint16_t value, bool write);
+void publishFanMode(Slave& s);
+void publishSnapshot(Slave& s, uint8_t sweepClasses, bool fanModeRead);
+uint8_t tcpRead(uint8_t unit, uint8_t fc, uint16_t addr, uint16_t count, uint16_t* dst);
+uint8_t tcpWrite(uint8_t client, uint8_t unit, uint16_t addr, uint16_t count, const uint16_t* values);
+bool loadLinkConfig();
+const char* linkFormatName(uint32_t format);
+void acquisitionTask(void*);
+void networkTask(void*);
+void accountBusTime();
+void startSweeps(int8_t target);
+void buildTopics();
 
 // ================ WIFI & MQTT CONFIGURATION ================
 const char* ssid = "DIT_WIFI_NAVN";
@@ -38,44 +148,401 @@ const char* mqtt_password = "";      // Tom hvis ingen authentication
 // Sparkplug B Topic struktur
 const char* group_id = "Ventilation";
 const char* edge_node_id = "DV10_ESP32";
-const char* device_id = "Sensor_Unit";
 
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
 
+// ================ RECONNECT CONFIGURATION ================
+#define WIFI_REASSOC_TIMEOUT_MS   15000  // Restart WiFi.begin() if association takes longer
+#define MQTT_BACKOFF_MIN_MS       1000   // First retry delay after a failed connect
+#define MQTT_BACKOFF_MAX_MS       60000  // Backoff stops doubling here
+#define MQTT_FIRST_ATTEMPT_SPREAD 3000   // Random wait before the first attempt after a drop
+#define MQTT_ATTEMPT_WINDOW_MS    60000  // Attempt-rate limit: max attempts per window
+#define MQTT_MAX_ATTEMPTS         8
+#define MQTT_SOCKET_TIMEOUT_S     2      // Bounds how long one connect() can block
+
+bool wifiAssociating = false;          // WiFi.begin() in progress
+unsigned long wifiAssocStart = 0;
+bool mqttWasConnected = false;
+unsigned long mqttBackoff = MQTT_BACKOFF_MIN_MS;
+unsigned long mqttNextAttempt = 0;     // millis() of the next connect attempt
+unsigned long mqttWindowStart = 0;
+uint8_t mqttWindowAttempts = 0;
+
+// ================ SPARKPLUG TOPICS ================
+// Built once in setup(), so publishing never touches the heap
+#define TOPIC_LEN 96
+
+char topicNBirth[TOPIC_LEN];
+char topicNDeath[TOPIC_LEN];
+char topicNCmd[TOPIC_LEN];
+char topicNData[TOPIC_LEN];
+char mqttClientId[24];              // Device topics are per slave, see Slave
+
+// ================ HEAP ALLOCATION COUNTER ================
+// Every C++ allocation goes through here. publishSparkplugData() logs how many
+// happened during the cycle - it should always be 0. Atomic: both cores allocate.
+std::atomic<uint32_t> heapAllocCount{0};
+
+void* operator new(size_t size) {
+  heapAllocCount.fetch_add(1, std::memory_order_relaxed);
+  void* p = malloc(size);
+  if (!p) abort();
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  heapAllocCount.fetch_add(1, std::memory_order_relaxed);
+  return malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+
+// ================ TRACE LOG ================
+// The poll engine and the publish path log binary records (trace_log.h)
+// instead of formatting text. serviceTrace() renders them while the UART has
+// room: everything in verbose mode, otherwise only warnings and errors.
+// Both tasks log, so a record is written and copied under a spinlock - a
+// dozen stores, never long enough to matter on the other core.
+#define CONSOLE_TX_BUFFER 1024   // Lines queue here instead of blocking the loop
+#define TRACE_LINE_MAX    120    // Room needed in the TX buffer to render one record
+
+enum TraceEvent : uint8_t {
+  EV_REG_OK,          // reg, value = raw
+  EV_REG_ERROR,       // reg, result (the block is logged as the warning)
+  EV_BLOCK,           // reg = first register, value = count, result
+  EV_SWEEP_START,     // value = poll classes (mask)
+  EV_SWEEP_BUSY,      // Sweep asked for while one is running
+  EV_SWEEP_DONE,      // value = successful reads, reg = duration (ms), result = registers asked for
+  EV_CMD_QUEUED,      // reg, value
+  EV_CMD_WRITE,       // reg, value, result
+  EV_CMD_DONE,        // reg = command to write ack (ms), value = read back, result
+  EV_CMD_MISMATCH,    // reg, value = value written (read back differs)
+  EV_CMD_REJECTED,    // reg, value (out of range or queue full)
+  EV_SLAVE_OFFLINE,   // value = timeouts in a row
+  EV_SLAVE_BACK,
+  EV_DDATA,           // reg = metrics, value = bytes, result = heap allocs
+  EV_DDATA_SKIP,      // Nothing outside its deadband
+  EV_DDATA_INVALID,   // Sweep without any good read
+  EV_PUBLISH_FAIL,
+  EV_BATCH,           // reg = sweeps, value = bytes
+  EV_STORE,           // value = backlog size
+  EV_REPLAY,          // reg = samples, value = bytes
+  EV_NDATA,           // reg = metrics, value = bytes
+  EV_REG_OPEN,        // reg, value = seconds to the next probe, result
+  EV_REG_CLOSED,      // reg
+  EV_BLOCK_SPLIT,     // reg = first register of the block, value = register it is split before
+  EV_LINK_START,      // Commissioning started, polling stops; result = slaves answering on the old setting
+  EV_LINK_PROBE,      // reg = baud / 100, value = format, result = slaves answering (0 = none or errors)
+  EV_LINK_GAP,        // reg = turnaround (ms), result = 1 if it passed
+  EV_LINK_BLOCK,      // reg = registers per read, result = 1 if it passed
+  EV_LINK_DONE,       // reg = baud / 100, value = turnaround (ms), result = format
+  EV_LINK_FAILED,     // No setting worked, the previous one is kept
+  EV_POLL_BOOST,      // value = period divisor, reg = register that moved (0xFFFF = run mode)
+  EV_POLL_DECAY,      // value = period divisor, result = bus load (%)
+};
+
+TraceLog traceLog;
+bool traceVerbose = false;             // Render every record, not only warnings
+uint32_t traceShown = 0;               // Next record serviceTrace() looks at
+portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+
+void trace(uint8_t level, uint8_t event, uint8_t slave,
+           uint16_t reg = 0, uint16_t value = 0, uint8_t result = 0) {
+  uint32_t now = millis();
+  portENTER_CRITICAL(&traceMux);
+  traceLog.add(now, level, event, slave, reg, value, result);
+  portEXIT_CRITICAL(&traceMux);
+}
+
+// Copy of record 'n', taken under the lock so the other core cannot be
+// halfway through writing it. False if the ring has overwritten it.
+bool traceCopy(uint32_t n, TraceRecord& out) {
+  portENTER_CRITICAL(&traceMux);
+  bool kept = (n >= traceLog.oldest() && n < traceLog.total());
+  if (kept) out = traceLog.get(n);
+  portEXIT_CRITICAL(&traceMux);
+  return kept;
+}
+
+uint32_t traceOldest() {
+  portENTER_CRITICAL(&traceMux);
+  uint32_t n = traceLog.oldest();
+  portEXIT_CRITICAL(&traceMux);
+  return n;
+}
+
+uint32_t traceTotal() {
+  portENTER_CRITICAL(&traceMux);
+  uint32_t n = traceLog.total();
+  portEXIT_CRITICAL(&traceMux);
+  return n;
+}
+
 // ================ MODBUS COMMUNICATION CONFIGURATION ================
 #define RX_PIN 36           // UART2 RX pin
 #define TX_PIN 4            // UART2 TX pin
 #define MAX485_DE 5         // RS485 Driver Enable pin
 #define MAX485_RE_NEG 14    // RS485 Receiver Enable pin (active low)
-#define BAUD_RATE 9600      // Communication speed
-#define MODBUS_SLAVE_ID 1   // Slave device address
+#define BAUD_RATE 9600      // Communication speed until commissioning has found a faster one
+#define READ_GAP_TOLERANCE 8 // Max unused registers bridged inside one block read
+#define MODBUS_TIMEOUT_MS 2000   // Response timeout until a register's response time is known
+#define MODBUS_MIN_TIMEOUT_MS 200 // Floor of the learned timeouts
+#define MODBUS_TURNAROUND_MS 50  // Bus idle time between two transactions (default, see RS485 LINK)
+
+// ================ RS485 LINK ================
+// What the bus runs at. The defaults above until commissioning (console 'c')
+// has probed the slaves and stored the fastest stable setting in NVS; from
+// then on the stored one, also after a reboot. Owned by the poll engine.
+#define LINK_PREFS_NAMESPACE   "rs485"
+#define COMMISSION_TIMEOUT_MS  300    // Response timeout while probing
+#define COMMISSION_REQUESTS    40     // Reads a setting must pass without a single error
+#define COMMISSION_BLOCK_READS 3      // Reads per slave of each block size
+
+struct LinkConfig {
+  uint32_t baud;
+  uint32_t format;            // SERIAL_8N1, SERIAL_8E1, ...
+  uint16_t turnaroundMs;      // Bus idle time between two transactions (at least t3.5)
+  uint16_t maxBlockRegs;      // Largest block read the slaves accept
+};
+
+LinkConfig rs485Link = {BAUD_RATE, SERIAL_8N1, MODBUS_TURNAROUND_MS, READ_PLAN_MAX_REGS};
+
+// Tried fastest first, so the first setting that passes is the one kept
+const uint32_t LINK_BAUDS[] = {115200, 57600, 38400, 19200, 9600};
+const uint32_t LINK_FORMATS[] = {SERIAL_8N1, SERIAL_8E1, SERIAL_8O1, SERIAL_8N2};
+const char* const LINK_FORMAT_NAMES[] = {"8N1", "8E1", "8O1", "8N2"};
+const uint16_t LINK_GAPS_MS[] = {50, 20, 10, 5, 2, 0};     // 0 = t3.5 only
+const int NUM_LINK_BAUDS = sizeof(LINK_BAUDS) / sizeof(LINK_BAUDS[0]);
+const int NUM_LINK_FORMATS = sizeof(LINK_FORMATS) / sizeof(LINK_FORMATS[0]);
+const int NUM_LINK_GAPS = sizeof(LINK_GAPS_MS) / sizeof(LINK_GAPS_MS[0]);
+
+std::atomic<bool> commissionRequested{false};   // Console 'c', taken by the poll engine
+
+// ================ DV10 SLAVES ON THE BUS ================
+// One entry per air-handling unit: Modbus address and Sparkplug device ID.
+// Can be set from the build, e.g. -DDV10_SLAVES='{1,"AHU_1"},{2,"AHU_2"}'
+#ifndef DV10_SLAVES
+#define DV10_SLAVES {1, "Sensor_Unit"}
+#endif
+
+#define SLAVE_OFFLINE_AFTER     3      // Timeouts in a row before a slave is offline
+#define SLAVE_PROBE_INTERVAL_MS 30000  // How often an offline slave is tried again
+#define SLAVE_PROBE_TIMEOUT_MS  300    // Response timeout while probing it
+
+#define BREAKER_TRIP_AFTER   3        // Failed reads in a row before a register is skipped
+#define BREAKER_RETRY_MS     30000    // First probe of a skipped register
+#define BREAKER_MAX_RETRY_MS 1800000  // Back-off doubles per failed probe, up to 30 min
 
-// ================ DATA BUFFERS ================
-uint16_t holdingRegs[2];
-uint16_t inputRegs[20];
+struct SlaveConfig {
+  uint8_t id;                 // Modbus slave address
+  const char* deviceId;       // Sparkplug device ID
+};
+
+const SlaveConfig slaveConfigs[] = { DV10_SLAVES };
+const int NUM_SLAVES = sizeof(slaveConfigs) / sizeof(slaveConfigs[0]);
 
-ModbusMaster modbus;
+
+ModbusRtuMaster modbus;
 
 // ================ AUTO-READ CONFIGURATION ================
-bool autoReadEnabled = true;           // Auto-read on/off
-unsigned long autoReadInterval = 5000; // Read every 5 seconds
-unsigned long lastAutoRead = 0;        // Last auto-read timestamp
+// Set from the console (network task), read by the poll engine
+std::atomic<bool> autoReadEnabled{true};              // Auto-read on/off
+std::atomic<unsigned long> autoReadInterval{5000};    // Period of the "normal" poll class
+
+// ================ POLL CLASSES ================
+// Every register belongs to a class. A sweep reads the registers of all
+// classes that are due, packed into as few block reads as possible, and
+// the blocks of higher priority classes go on the bus first.
+#define POLL_FAST        0
+#define POLL_NORMAL      1
+#define POLL_SLOW        2
+#define POLL_SAMPLE      3      // High rate, only feeds the window aggregates
+#define NUM_POLL_CLASSES 4
+#define POLL_ALL         0x0F   // Mask with every class
+
+#define SAMPLE_POLL_MS     1000    // Pressures and flows, catches short transients
+#define FAST_POLL_MS       2000    // Supply air temp, run mode
+#define SLOW_POLL_MS       60000   // Runtime counters (change once a minute)
+#define BUS_BUDGET_PCT     50      // Above this bus load, low priority classes wait
+#define BUS_LOAD_WINDOW_MS 10000
+
+struct PollClass {
+  const char* name;
+  unsigned long periodMs;     // 0 = autoReadInterval
+  uint8_t priority;           // Higher goes first
+  bool adaptive;              // Polled faster during transients (see ADAPTIVE POLL RATE)
+};
+
+const PollClass pollClasses[NUM_POLL_CLASSES] = {
+  {"fast",   FAST_POLL_MS,   2, true},
+  {"normal", 0,              1, true},
+  {"slow",   SLOW_POLL_MS,   0, false},
+  {"sample", SAMPLE_POLL_MS, 3, true},
+};
+
+// ================ ADAPTIVE POLL RATE ================
+// The periods above are the steady-state rates. A transient - a run mode
+// that is starting or stopping the unit, or a value moving more than
+// POLL_DELTA_DEADBANDS deadbands per period - divides the periods of the
+// adaptive classes by up to POLL_BOOST_MAX, as far as the measured bus load
+// says it stays within BUS_BUDGET_PCT. After POLL_BOOST_HOLD_MS without a
+// transient the divisor halves, back down to 1; over the budget it halves
+// once per bus load window.
+#define POLL_BOOST_MAX           4       // Power of two
+#define POLL_BOOST_HOLD_MS       20000
+#define POLL_DELTA_DEADBANDS     4       // Change per steady period that counts as a transient
+#define POLL_DELTA_MIN_DEADBANDS 3       // ... but one read must move at least this (noise)
+#define POLL_MIN_PERIOD_MS       250
+
+// Period of class 'c' with the periods divided by 'boost'
+unsigned long pollPeriod(uint8_t c, uint8_t boost = 1) {
+  unsigned long period = pollClasses[c].periodMs ? pollClasses[c].periodMs : autoReadInterval.load();
+  if (!pollClasses[c].adaptive || boost <= 1) return period;
+  period /= boost;
+  return period < POLL_MIN_PERIOD_MS ? POLL_MIN_PERIOD_MS : period;
+}
+
+unsigned long busRequestStart = 0;     // millis() when the current request was sent
+unsigned long busBusyMs = 0;           // Bus time used in the current window
+unsigned long busWindowStart = 0;
+std::atomic<uint8_t> busLoadPct{0};    // Bus load of the last full window (the menu reads it too)
+
+// ================ DDATA BATCHING ================
+// With batching on, the metrics of several sweeps are collected per slave and
+// sent as one DDATA, every metric with the time its block was read. Saves the
+// MQTT/TCP/broker overhead per message; the batch goes out when it holds
+// DDATA_BATCH_SWEEPS sweeps, is DDATA_BATCH_LATENCY_MS old or is full.
+#define DDATA_BATCH_SWEEPS     8
+#define DDATA_BATCH_LATENCY_MS 30000
+#define DDATA_BATCH_BYTES      1536    // Encoded metrics per slave; header + batch fit payloadArena
+
+bool batchEnabled = false;             // Protobuf only; JSON always sends per sweep
+
+// ================ COMMAND LANE ================
+// Register writes from DCMD (and the console) go ahead of the poll engine:
+// the next free bus slot writes the register and reads it straight back, and
+// the value read is published as DDATA. A command only waits for the
+// transaction already on the bus, and the pause after it is cut to t3.5.
+// The network task queues commands and the poll engine takes them off the
+// queue, both under cmdMux; the command on the bus is no longer in it.
+#define FAN_MODE_REG   367    // Holding register, 0-3
+#define CMD_QUEUE_LEN  4      // Commands waiting per slave
+
+#define CMD_IDLE       0      // No active command, the next one comes off the queue
+#define CMD_WRITE      1      // Active command, its write is next
+#define CMD_READBACK   2      // Active command, its read-back is next
+
+struct Command {
+  uint16_t reg;
+  uint16_t value;
+  bool write;                 // false = only read the register back
+  unsigned long received;     // millis() when it came in
+};
+
+portMUX_TYPE cmdMux = portMUX_INITIALIZER_UNLOCKED;
+
+// ================ MODBUS TCP SERVER CONFIGURATION ================
+// Clients read the register image of the last sweeps, never the bus. A
+// write to FAN_MODE_REG is queued in the command lane and answered when the
+// read-back shows it (or with an exception when it does not).
+#define MODBUS_TCP_PORT        502
+#define MODBUS_TCP_MAX_AGE_MS  180000   // Cached registers older than this answer 0x0B
+#define MODBUS_TCP_WRITE_MS    5000     // Writes not read back by then answer 0x0B
+
+ModbusTcpServer tcpServer(MODBUS_TCP_PORT);
+
+// ================ STORE AND FORWARD CONFIGURATION ================
+#define SF_FLASH_SPILL 0             // 1 = move samples to LittleFS when the RAM buffer is full
+#define SF_SPILL_FILE "/sf_spill.bin"
+#define SF_SPILL_MAX_RECORDS 4096    // 4096 * 40 bytes = 160 KB flash
+#define REPLAY_INTERVAL_MS 1000      // Min time between two historical DDATA
+#define REPLAY_MAX_RECORDS 8         // Max buffered samples per historical DDATA
+
+#if SF_FLASH_SPILL
+#include <LittleFS.h>
+#endif
+
+StoreForwardBuffer sampleBuffer;
+SfRecord replayBatch[REPLAY_MAX_RECORDS];
+unsigned long lastReplay = 0;
+
+#if SF_FLASH_SPILL
+uint32_t spillCount = 0;             // Records in the spill file
+uint32_t spillReadPos = 0;           // Records already replayed from it
+#endif
+
+// ================ TASKS ================
+// The poll engine (acquisition) and everything network (WiFi, MQTT,
+// publish, console) run as two FreeRTOS tasks pinned to their own core.
+// The WiFi stack lives on core 0, so the network task goes there and the
+// RS485 bus has core 1 to itself. What the network task needs from the poll
+// engine comes through seqlock snapshots (see SLAVE STATE), never from the
+// poll engine's own state. DUAL_CORE 0 runs both from loop() instead, e.g.
+// on a single-core chip.
+#ifndef DUAL_CORE
+#define DUAL_CORE 1
+#endif
+
+#define ACQ_TASK_CORE      1
+#define ACQ_TASK_PRIORITY  3      // Above the network task; loopTask runs at 1
+#define ACQ_TASK_STACK     4096
+#define NET_TASK_CORE      0
+#define NET_TASK_PRIORITY  1
+#define NET_TASK_STACK     8192   // Same as the Arduino loopTask it replaces
+
+// ================ POLL ENGINE STATE ================
+uint8_t busSlave = 0;                  // Slave of the request on the bus
+uint8_t nextSlave = 0;                 // Round-robin start for the next request
+int8_t selectedSlave = -1;             // Target of 0-3 and r, -1 = all slaves
+
+bool awaitingInterval = false;         // 'i' command is reading digits
+int intervalInput = 0;
 
 // ================ SPARKPLUG B DATATYPES ================
+// Values from the Sparkplug B spec, see sparkplug_b.h
 enum SparkplugDataType {
-  INT16 = 3,
-  INT32 = 4,
-  INT64 = 5,
-  UINT16 = 7,
-  UINT32 = 8,
-  UINT64 = 9,
-  FLOAT = 10,
-  DOUBLE = 11,
-  BOOLEAN = 12,
-  STRING = 13
+  INT16 = SPB_INT16,
+  INT32 = SPB_INT32,
+  INT64 = SPB_INT64,
+  UINT16 = SPB_UINT16,
+  UINT32 = SPB_UINT32,
+  UINT64 = SPB_UINT64,
+  FLOAT = SPB_FLOAT,
+  DOUBLE = SPB_DOUBLE,
+  BOOLEAN = SPB_BOOLEAN,
+  STRING = SPB_STRING
 };
 
+// ================ PAYLOAD FORMAT ================
+#define PAYLOAD_JSON     0   // ArduinoJson text (old format)
+#define PAYLOAD_PROTOBUF 1   // Sparkplug B protobuf, readable by standard host apps
+
+uint8_t payloadFormat = PAYLOAD_PROTOBUF;
+// The JSON DBIRTH (points with units, window metrics) is the largest payload,
+// about 3.4 kB of text and ~290 document slots; the protobuf one is ~1.7 kB
+uint8_t payloadArena[4096];  // Every payload (protobuf or JSON) is encoded here, no heap
+StaticJsonDocument<6144> jsonDoc;   // Reused for JSON payloads instead of DynamicJsonDocument
+uint8_t sparkplugSeq = 0;    // Sparkplug seq, 0-255, reset by NBIRTH
+
+SpbAliasRegistry aliasRegistry = {1, 0};
+uint32_t rebirthAlias = 0;   // Alias of "Node Control/Rebirth"
+uint32_t bdSeqAlias = 0;
+uint8_t sparkplugBdSeq = 0;  // Birth/death seq, advanced by every connect attempt, see buildNodeDeath()
+char ndeathPayload[128];     // NDEATH registered as the MQTT will; the JSON form is up to 78 chars
+bool rebirthRequested = false; // Set by an NCMD, births are re-sent by serviceNetwork()
+
 // ================ SENSOR DATA STRUKTUR ================
 struct SensorData {
   // System Status
@@ -109,61 +576,464 @@ struct SensorData {
   bool dataValid;
 };
 
-SensorData currentData = {0};
 
-// ================ REGISTER DEFINITIONS ================
-struct TempRegister {
-  uint16_t address;
-  const char* name;
+// ================ POINT TABLE ================
+// One row per DV10 register: where it is on the bus, how the raw word is
+// scaled, where it lands in SensorData, how it is published and how often it
+// is polled. Block reads, decoding, births, DDATA and the backlog all walk
+// this table, so a new register is one new row. The table is constexpr, so
+// the rows and their strings stay in flash and cost no RAM.
+#define DEADBAND_ABS 0   // Report when |value - last| > deadband
+#define DEADBAND_PCT 1   // Report when |value - last| > deadband % of last
+
+const char* runModeText(uint16_t mode) {
+  switch (mode) {
+    case 0:  return "Stopped";
+    case 1:  return "Starting up";
+    case 2:  return "Starting reduced speed";
+    case 3:  return "Starting full speed";
+    case 4:  return "Starting normal run";
+    case 5:  return "Normal run";
+    case 6:  return "Support control heating";
+    case 7:  return "Support control cooling";
+    case 8:  return "CO2 run";
+    case 9:  return "Night cooling";
+    case 10: return "Full speed stop";
+    case 11: return "Stopping fan";
+    default: return "Unknown mode";
+  }
+}
+
+struct PointDef {
+  uint16_t address;             // Input register
+  const char* label;            // Console name
+  const char* name;             // Sparkplug metric name
+  const char* unit;
+  float scale;                  // FLOAT: value = raw / scale
+  SparkplugDataType dataType;   // FLOAT or UINT16
+  size_t offset;                // Field in SensorData (float or uint16_t)
+  uint8_t pollClass;
+  bool window;                  // Min/max/mean/count per window (see WINDOWED AGGREGATES)
+  uint8_t deadbandType;         // DEADBAND_ABS or DEADBAND_PCT
+  float deadband;               // 0 = report every change
+  unsigned long maxSilence;     // Report anyway after this long (ms)
+  const char* (*describe)(uint16_t raw);   // Console text of an enum register
 };
 
-TempRegister tempRegisters[] = {
-  {0,  "Outdoor Temp"},
-  {6,  "Supply Air Temp"},
-  {7,  "Supply Air Setpoint Temp"},
-  {8,  "Exhaust Air Temp"},
-  {19, "Extract Air Temp"},
+// Temperatures step in 0.1 °C, so 0.15 ignores a single step of flicker.
+// The row order is the metric order in births and backlog records.
+constexpr PointDef pointTable[] = {
+  {1,   "Heat Exchanger Efficiency", "HeatExchangerEfficiency", "%",    10.0f, FLOAT,  offsetof(SensorData, heatExchangerEfficiency), POLL_NORMAL, false, DEADBAND_ABS, 0.5f,  300000, nullptr},
+  {2,   "Run Mode",                  "RunMode",                 "",     1.0f,  UINT16, offsetof(SensorData, runMode),                 POLL_FAST,   false, DEADBAND_ABS, 0.0f,  300000, runModeText},
+  {0,   "Outdoor Temp",              "OutdoorTemp",             "°C",   10.0f, FLOAT,  offsetof(SensorData, outdoorTemp),             POLL_NORMAL, false, DEADBAND_ABS, 0.15f, 300000, nullptr},
+  {6,   "Supply Air Temp",           "SupplyAirTemp",           "°C",   10.0f, FLOAT,  offsetof(SensorData, supplyAirTemp),           POLL_FAST,   false, DEADBAND_ABS, 0.15f, 300000, nullptr},
+  {7,   "Supply Air Setpoint Temp",  "SupplyAirSetpointTemp",   "°C",   10.0f, FLOAT,  offsetof(SensorData, supplyAirSetpointTemp),   POLL_NORMAL, false, DEADBAND_ABS, 0.0f,  300000, nullptr},
+  {8,   "Exhaust Air Temp",          "ExhaustAirTemp",          "°C",   10.0f, FLOAT,  offsetof(SensorData, exhaustAirTemp),          POLL_NORMAL, false, DEADBAND_ABS, 0.15f, 300000, nullptr},
+  {19,  "Extract Air Temp",          "ExtractAirTemp",          "°C",   10.0f, FLOAT,  offsetof(SensorData, extractAirTemp),          POLL_NORMAL, false, DEADBAND_ABS, 0.15f, 300000, nullptr},
+  {12,  "Supply Air Pressure",       "SupplyAirPressure",       "Pa",   10.0f, FLOAT,  offsetof(SensorData, supplyAirPressure),       POLL_SAMPLE, true,  DEADBAND_PCT, 2.0f,  300000, nullptr},
+  {13,  "Extract Air Pressure",      "ExtractAirPressure",      "Pa",   10.0f, FLOAT,  offsetof(SensorData, extractAirPressure),      POLL_SAMPLE, true,  DEADBAND_PCT, 2.0f,  300000, nullptr},
+  {14,  "Supply Air Flow",           "SupplyAirFlow",           "m³/h", 10.0f, FLOAT,  offsetof(SensorData, supplyAirFlow),           POLL_SAMPLE, true,  DEADBAND_PCT, 2.0f,  300000, nullptr},
+  {15,  "Extract Air Flow",          "ExtractAirFlow",          "m³/h", 10.0f, FLOAT,  offsetof(SensorData, extractAirFlow),          POLL_SAMPLE, true,  DEADBAND_PCT, 2.0f,  300000, nullptr},
+  {292, "Extra Supply Air Flow",     "ExtraSupplyAirFlow",      "m³/h", 10.0f, FLOAT,  offsetof(SensorData, extraSupplyAirFlow),      POLL_NORMAL, false, DEADBAND_PCT, 2.0f,  300000, nullptr},
+  {293, "Extra Extract Air Flow",    "ExtraExtractAirFlow",     "m³/h", 10.0f, FLOAT,  offsetof(SensorData, extraExtractAirFlow),     POLL_NORMAL, false, DEADBAND_PCT, 2.0f,  300000, nullptr},
+  {3,   "Supply Air Fan Runtime",    "SupplyFanRuntime",        "min",  1.0f,  UINT16, offsetof(SensorData, supplyFanRuntime),        POLL_SLOW,   false, DEADBAND_ABS, 15.0f, 900000, nullptr},
+  {4,   "Extract Air Fan Runtime",   "ExtractFanRuntime",       "min",  1.0f,  UINT16, offsetof(SensorData, extractFanRuntime),       POLL_SLOW,   false, DEADBAND_ABS, 15.0f, 900000, nullptr},
 };
 
-const int NUM_TEMPS = sizeof(tempRegisters) / sizeof(tempRegisters[0]);
+constexpr int NUM_POINTS = sizeof(pointTable) / sizeof(pointTable[0]);
 
-struct PressureRegister {
-  uint16_t address;
-  const char* name;
+// Compile-time checks of the table (recursion, so it also builds as C++11)
+constexpr bool addressUnique(int i, int j) {
+  return j >= NUM_POINTS ||
+         (pointTable[i].address != pointTable[j].address && addressUnique(i, j + 1));
+}
+
+constexpr bool pointsValid(int i) {
+  return i >= NUM_POINTS ||
+         (pointTable[i].pollClass < NUM_POLL_CLASSES &&
+          (pointTable[i].dataType == FLOAT || pointTable[i].dataType == UINT16) &&
+          pointTable[i].scale > 0.0f &&
+          addressUnique(i, i + 1) && pointsValid(i + 1));
+}
+
+static_assert(pointsValid(0), "pointTable: bad poll class, type or scale, or a register listed twice");
+static_assert(NUM_POINTS <= SF_MAX_VALUES, "A backlog record holds one value per point");
+static_assert(NUM_POINTS <= READ_PLAN_MAX_REGS, "Read plan too small for the point table");
+
+float metricFloat(const SensorData& data, const PointDef& p) {
+  return *(const float*)((const uint8_t*)&data + p.offset);
+}
+
+uint16_t metricUInt16(const SensorData& data, const PointDef& p) {
+  return *(const uint16_t*)((const uint8_t*)&data + p.offset);
+}
+
+float metricValue(const SensorData& data, const PointDef& p) {
+  return (p.dataType == FLOAT) ? metricFloat(data, p) : (float)metricUInt16(data, p);
+}
+
+float* dataFloat(SensorData& data, size_t offset) {
+  return (float*)((uint8_t*)&data + offset);
+}
+
+uint16_t* dataUInt16(SensorData& data, size_t offset) {
+  return (uint16_t*)((uint8_t*)&data + offset);
+}
+
+// ================ REGISTER IMAGE ================
+// Raw value and read time of every input register the poll classes read,
+// the unused registers inside their block reads included. The addresses
+// come from the plan of each class, found once by setupReadPlan().
+#define IMAGE_MAX_REGS READ_PLAN_MAX_REGS
+
+uint16_t imageAddr[IMAGE_MAX_REGS];
+uint8_t numImageRegs = 0;
+
+struct RegisterImage {
+  uint16_t value[IMAGE_MAX_REGS];
+  unsigned long readAt[IMAGE_MAX_REGS];   // millis() of the last good read
+  bool valid[IMAGE_MAX_REGS];             // Read at least once
 };
 
-PressureRegister pressureRegisters[] = {
-  {12, "Supply Air Pressure"},
-  {13, "Extract Air Pressure"},
+// Slot of 'addr' in the image, -1 if no sweep reads it
+int imageIndex(uint16_t addr) {
+  for (uint8_t j = 0; j < numImageRegs; j++) {
+    if (imageAddr[j] == addr) return j;
+  }
+  return -1;
+}
+
+// ================ WINDOWED AGGREGATES ================
+// Points with 'window' set are read by the "sample" poll class, far more
+// often than they are published. Every sample goes into a fixed accumulator;
+// the DDATA of the normal interval carries min/max/mean/count of the window
+// next to the point's own metric (= the last sample) and starts a new one.
+#define AGG_MIN       0
+#define AGG_MAX       1
+#define AGG_MEAN      2
+#define AGG_COUNT     3
+#define NUM_AGG_STATS 4
+
+const char* const aggSuffix[NUM_AGG_STATS] = {"Min", "Max", "Mean", "Count"};
+
+struct WindowAgg {
+  float min;
+  float max;
+  float sum;
+  uint16_t count;               // Samples in the window, 0 = none yet
 };
 
-const int NUM_PRESSURES = sizeof(pressureRegisters) / sizeof(pressureRegisters[0]);
+void windowAdd(WindowAgg& a, float value) {
+  if (a.count == 0 || value < a.min) a.min = value;
+  if (a.count == 0 || value > a.max) a.max = value;
+  a.sum += value;
+  if (a.count < 0xFFFF) a.count++;
+}
 
-struct FlowRegister {
-  uint16_t address;
-  const char* name;
+float windowStat(const WindowAgg& a, uint8_t stat) {
+  switch (stat) {
+    case AGG_MIN:  return a.min;
+    case AGG_MAX:  return a.max;
+    case AGG_MEAN: return a.count ? a.sum / a.count : 0.0f;
+    default:       return a.count;
+  }
+}
+
+// ================ BUS STATISTICS ================
+// Per slave, as NBIRTH/NDATA node metrics "Modbus/<device>/<name>". Counters
+// run from boot; the latency and sweep percentiles cover one NDATA period.
+#define BUS_STATS_INTERVAL_MS 60000
+
+enum BusMetric : uint8_t {
+  BM_REQUESTS, BM_TIMEOUTS, BM_CRC_ERRORS, BM_EXCEPTIONS, BM_OTHER_ERRORS, BM_RETRIES,
+  BM_LATENCY_P50, BM_LATENCY_P95, BM_LATENCY_MAX, BM_SWEEP_P50, BM_SWEEP_P95, BM_COMMAND_MAX,
+  NUM_BUS_METRICS
 };
 
-FlowRegister flowRegisters[] = {
-  {14, "Supply Air Flow"},
-  {15, "Extract Air Flow"},
-  {292, "Extra Supply Air Flow"},
-  {293, "Extra Extract Air Flow"},
+const char* const busMetricNames[NUM_BUS_METRICS] = {
+  "Requests", "Timeouts", "CrcErrors", "Exceptions", "OtherErrors", "Retries",
+  "LatencyP50", "LatencyP95", "LatencyMax", "SweepP50", "SweepP95", "CommandMax"
 };
 
-const int NUM_FLOWS = sizeof(flowRegisters) / sizeof(flowRegisters[0]);
+uint32_t busMetricValue(const BusStats& st, uint8_t m) {
+  switch (m) {
+    case BM_REQUESTS:     return st.requests;
+    case BM_TIMEOUTS:     return st.timeouts;
+    case BM_CRC_ERRORS:   return st.crcErrors;
+    case BM_EXCEPTIONS:   return st.exceptions;
+    case BM_OTHER_ERRORS: return st.otherErrors;
+    case BM_RETRIES:      return st.retries;
+    case BM_LATENCY_P50:  return st.latency.percentile(50);
+    case BM_LATENCY_P95:  return st.latency.percentile(95);
+    case BM_LATENCY_MAX:  return st.latency.maxMs;
+    case BM_SWEEP_P50:    return st.sweep.percentile(50);
+    case BM_SWEEP_P95:    return st.sweep.percentile(95);
+    case BM_COMMAND_MAX:  return st.command.maxMs;
+    default:              return 0;
+  }
+}
 
-struct RuntimeRegister {
-  uint16_t address;
-  const char* name;
+bool busMetricIsTime(uint8_t m) {
+  return m >= BM_LATENCY_P50;
+}
+
+uint32_t busLoadAlias = 0;
+bool busStatsInBirth = false;          // False if they did not fit the NBIRTH
+unsigned long lastBusStats = 0;
+
+// Every BUS_STATS_INTERVAL_MS the poll engine closes a period: it copies the
+// stats of every slave here and starts the histograms over. A period only
+// closes once the network task has taken the last one (statsTaken), so
+// while MQTT is down the histograms simply keep counting.
+struct NodeStats {
+  uint32_t period;                        // Periods closed so far
+  uint8_t busLoadPct;
+  BusStats slave[NUM_SLAVES];
+};
+
+SeqLock<NodeStats> nodeStats;
+std::atomic<uint32_t> statsTaken{0};
+NodeStats statsView;                      // Network task's copy, goes into NBIRTH/NDATA
+uint32_t statsViewSeq = 0;
+
+// ================ SLAVE STATE ================
+// Circuit breaker and learned response timeout of one register (see REGISTER HEALTH)
+struct PointHealth {
+  uint8_t failStreak;                     // Failed reads in a row
+  bool open;                              // Left out of the sweeps, only probed
+  uint8_t backoff;                        // Failed probes since it opened
+  unsigned long retryAt;                  // millis() of the next probe while open
+  uint16_t srttMs;                        // Smoothed response time, 0 = none seen yet
+  uint16_t rttvarMs;                      // Mean deviation of the response time
+  uint16_t timeoutMs;                     // 0 = MODBUS_TIMEOUT_MS
+};
+
+// What the network task gets to see of a slave. The poll engine rewrites it
+// when a sweep finishes (never halfway through one), when a command has been
+// read back and when the slave goes offline or comes back. The counters only
+// go up; the network task compares them with the last copy it worked on.
+struct SlaveSnapshot {
+  SensorData data;                        // As of the last finished sweep
+  unsigned long pointTime[NUM_POINTS];
+  bool bad[NUM_POINTS];                   // Circuit breaker open
+  uint32_t sweeps[NUM_POLL_CLASSES];      // Finished sweeps that read each class
+  WindowAgg window[NUM_POINTS];           // Last closed window
+  uint32_t windowSeq;                     // Windows closed so far
+  RegisterImage image;                    // As of the last finished sweep
+  uint8_t pollBoost;                      // Adaptive poll rate, 1 = steady
+  int32_t fanMode;                        // -1 = unknown
+  uint32_t fanModeReads;                  // Command read-backs so far
+  bool offline;
+};
+
+// Poll engine -> network task, one per slave. A window only closes when the
+// network task has taken the last one (windowTaken); until then it keeps
+// collecting samples, so a stalled network loses resolution, never samples.
+struct SlaveHandoff {
+  SeqLock<SlaveSnapshot> snapshot;
+  std::atomic<uint32_t> windowTaken{0};
+  std::atomic<bool> sweepRequested{false};  // Console 'r'
 };
 
-RuntimeRegister runtimeRegisters[] = {
-  {3, "Supply Air Fan Runtime"},
-  {4, "Extract Air Fan Runtime"},
+// Everything that exists once per DV10 on the bus
+struct Slave {
+  uint8_t id;
+  const char* deviceId;
+  char topicDBirth[TOPIC_LEN];
+  char topicDDeath[TOPIC_LEN];
+  char topicDData[TOPIC_LEN];
+  char topicDCmd[TOPIC_LEN];
+
+  SensorData data;
+  ReadPlan plan;                          // Blocks of the current sweep
+  uint16_t regs[READ_PLAN_MAX_REGS];
+  unsigned long classDue[NUM_POLL_CLASSES];   // millis() when each poll class is due
+
+  // Sweep
+  bool sweepActive;                       // A sweep is in progress
+  uint8_t sweepSpan;                      // Next block in the plan to request
+  uint8_t sweepClasses;                   // Poll classes read by this sweep (mask)
+  uint8_t sweepRegs;                      // Registers asked for in this sweep
+  int sweepSuccess;                       // Registers decoded OK in this sweep
+  unsigned long sweepStartTime;
+
+  // Command lane: queued register writes, the oldest one on the bus first
+  Command cmdQueue[CMD_QUEUE_LEN];        // Under cmdMux
+  uint8_t cmdHead;
+  uint8_t cmdCount;
+  Command cmdActive;                      // Taken off the queue, being written/read back
+  uint8_t cmdPhase;                       // CMD_IDLE, CMD_WRITE or CMD_READBACK
+  uint16_t cmdLatencyMs;                  // Command received to write acknowledged
+  uint16_t cmdReadback;
+  int32_t fanMode;                        // Last read from FAN_MODE_REG, -1 = unknown
+
+  unsigned long pointTime[NUM_POINTS];    // millis() when each point was last read
+  RegisterImage image;                    // Raw registers of the good block reads
+
+  // DDATA batch: encoded metrics of the sweeps not sent yet
+  uint8_t batchBuf[DDATA_BATCH_BYTES];
+  SpbWriter batch;
+  uint8_t batchSweeps;
+  unsigned long batchStart;
+
+  // Aggregates of the high-rate samples since the last normal-interval DDATA
+  WindowAgg window[NUM_POINTS];
+  unsigned long windowStart;
+
+  // Bus instrumentation, published as node metrics (see BUS STATISTICS)
+  BusStats stats;
+  uint16_t regErrors[NUM_POINTS];         // Failed reads per point, console only
+  uint32_t statAlias[NUM_BUS_METRICS];
+  PointHealth health[NUM_POINTS];
+  uint16_t cuts[NUM_POINTS];              // No block holds both cut - 1 and cut (see splitBlock)
+  uint8_t numCuts;
+
+  // Adaptive poll rate: the adaptive classes are polled 'pollBoost' times as often
+  uint8_t pollBoost;                      // 1 = steady state
+  unsigned long boostSince;               // millis() of the last transient or step down
+  unsigned long boostRaised;              // millis() when pollBoost last went up
+
+  // Health: a slave that keeps timing out is only probed now and then
+  uint8_t timeoutStreak;
+  bool offline;
+  unsigned long nextProbe;
+
+  // Network task: the snapshot it publishes from and what it has seen of it
+  SlaveSnapshot view;
+  uint32_t viewSeq;                       // SeqLock sequence of 'view'
+  uint32_t seenSweeps[NUM_POLL_CLASSES];
+  uint32_t seenWindowSeq;
+  uint32_t seenFanModeReads;
+
+  // Sparkplug device
+  bool born;                              // DBIRTH sent since the last NBIRTH/DDEATH
+  uint32_t metricAlias[NUM_POINTS];      // Assigned at NBIRTH, used by every DDATA
+  uint32_t windowAlias[NUM_POINTS][NUM_AGG_STATS];   // Only for points with 'window' set
+  uint32_t fanModeAlias;
+  float lastReported[NUM_POINTS];        // Value last sent for each metric
+  unsigned long lastReportedAt[NUM_POINTS];
+  bool reportedBad[NUM_POINTS];          // Quality of each metric as last published
 };
 
-const int NUM_RUNTIMES = sizeof(runtimeRegisters) / sizeof(runtimeRegisters[0]);
+Slave slaves[NUM_SLAVES];
+SlaveHandoff handoff[NUM_SLAVES];
+
+void resetWindow(Slave& s) {
+  memset(s.window, 0, sizeof(s.window));
+  s.windowStart = millis();
+}
+
+// A sweep of the sample class alone only feeds the window; it is not published
+bool sampleOnly(uint8_t classes) {
+  return classes == (1 << POLL_SAMPLE);
+}
+
+// Min/max/mean/count of every windowed point. An empty window only sends Count.
+// 'timestamp' 0 = the metrics use the payload timestamp.
+int spbAddWindow(SpbWriter& w, const Slave& s, uint64_t timestamp) {
+  int count = 0;
+  for (int i = 0; i < NUM_POINTS; i++) {
+    if (!pointTable[i].window) continue;
+    const WindowAgg& a = s.view.window[i];
+    for (uint8_t stat = 0; stat < NUM_AGG_STATS; stat++) {
+      if (a.count == 0 && stat != AGG_COUNT) continue;
+      size_t m = spbBeginAliasMetric(w, s.windowAlias[i][stat]);
+      if (timestamp) spbMetricTimestamp(w, timestamp);
+      if (stat == AGG_COUNT) {
+        spbMetricUInt(w, a.count);
+      } else {
+        spbMetricFloat(w, windowStat(a, stat));
+      }
+      spbEndMetric(w, m);
+      count++;
+    }
+  }
+  return count;
+}
+
+// Bus statistics of every slave as of the last closed period, with names
+// (NBIRTH) or by alias only (NDATA)
+void spbAddBusStats(SpbWriter& w, bool birth) {
+  char name[64];
+  uint64_t now = millis();
+
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    const Slave& s = slaves[i];
+    for (uint8_t m = 0; m < NUM_BUS_METRICS; m++) {
+      size_t mark;
+      if (birth) {
+        snprintf(name, sizeof(name), "Modbus/%s/%s", s.deviceId, busMetricNames[m]);
+        mark = spbBeginMetric(w, name, SPB_UINT32, now);
+        spbMetricAlias(w, s.statAlias[m]);
+        if (busMetricIsTime(m)) spbMetricEngUnit(w, "ms");
+      } else {
+        mark = spbBeginAliasMetric(w, s.statAlias[m]);
+      }
+      spbMetricUInt(w, busMetricValue(statsView.slave[i], m));
+      spbEndMetric(w, mark);
+    }
+  }
+
+  size_t mark = birth ? spbBeginMetric(w, "Modbus/BusLoad", SPB_UINT32, now)
+                      : spbBeginAliasMetric(w, busLoadAlias);
+  if (birth) {
+    spbMetricAlias(w, busLoadAlias);
+    spbMetricEngUnit(w, "%");
+  }
+  spbMetricUInt(w, statsView.busLoadPct);
+  spbEndMetric(w, mark);
+}
+
+// ================ REPORT BY EXCEPTION ================
+bool rbeEnabled = true;                       // Only send metrics that left their deadband
+bool reportMetric[NUM_POINTS];               // Metrics to put in the next DDATA
+int32_t reportQuality[NUM_POINTS];           // Quality property to add, -1 = none
+
+// DBIRTH carries every value, so it is the new baseline
+void resetReportCache(Slave& s) {
+  unsigned long now = millis();
+  for (int i = 0; i < NUM_POINTS; i++) {
+    s.lastReported[i] = metricValue(s.view.data, pointTable[i]);
+    s.lastReportedAt[i] = now;
+    s.reportedBad[i] = s.view.bad[i];
+  }
+}
+
+bool outsideDeadband(const PointDef& m, float value, float last) {
+  float diff = fabsf(value - last);
+  if (m.deadbandType == DEADBAND_PCT) {
+    return diff > fabsf(last) * m.deadband / 100.0f;
+  }
+  return diff > m.deadband;
+}
+
+// Fills reportMetric[] and reportQuality[] and returns how many metrics go
+// into the DDATA. A register with an open breaker only holds a stale value:
+// it goes out as null with bad quality when it turns bad (and after
+// maxSilence), and with good quality again on its first report after that.
+int selectChangedMetrics(Slave& s) {
+  unsigned long now = millis();
+  int count = 0;
+
+  for (int i = 0; i < NUM_POINTS; i++) {
+    const PointDef& m = pointTable[i];
+    bool bad = s.view.bad[i];
+    float value = metricValue(s.view.data, m);
+
+    reportMetric[i] = !rbeEnabled ||
+                      now - s.lastReportedAt[i] >= m.maxSilence ||
+                      bad != s.reportedBad[i] ||
+                      (!bad && outsideDeadband(m, value, s.lastReported[i]));
+    reportQuality[i] = bad ? SPB_QUALITY_BAD : (s.reportedBad[i] ? SPB_QUALITY_GOOD : -1);
+    if (reportMetric[i]) {
+      s.reportedBad[i] = bad;
+      s.lastReported[i] = value;
+      s.lastReportedAt[i] = now;
+      count++;
+    }
+  }
+  return count;
+}
 
 // ================ RS485 Direction Control ================
 void preTransmission() {
@@ -198,441 +1068,2533 @@ void setupWiFi() {
   }
 }
 
+// ================ SPARKPLUG B: PROTOBUF HELPERS ================
+void spbAddSensorValue(SpbWriter& w, const PointDef& m, const SensorData& data) {
+  if (m.dataType == FLOAT) {
+    spbMetricFloat(w, metricFloat(data, m));
+  } else {
+    spbMetricUInt(w, metricUInt16(data, m));
+  }
+}
+
+bool publishProtobuf(const char* topic, const SpbWriter& w) {
+  if (w.overflow) {
+    Serial.printf("[MQTT] ✗ Payload larger than %u bytes, not sent\n", (unsigned)sizeof(payloadArena));
+    return false;
+  }
+  return mqttClient.publish(topic, w.buf, w.len);
+}
+
+// Serializes into payloadArena, returns the payload size (0 = not sent)
+size_t publishJson(const char* topic, const JsonDocument& doc) {
+  size_t len = serializeJson(doc, (char*)payloadArena, sizeof(payloadArena));
+  if (doc.overflowed() || len >= sizeof(payloadArena) - 1) {
+    Serial.printf("[MQTT] ✗ Payload larger than %u bytes, not sent\n", (unsigned)sizeof(payloadArena));
+    return 0;
+  }
+  return mqttClient.publish(topic, payloadArena, len) ? len : 0;
+}
+
+// ================ SPARKPLUG B: TOPICS ================
+void buildTopics() {
+  snprintf(topicNBirth, TOPIC_LEN, "spBv1.0/%s/NBIRTH/%s", group_id, edge_node_id);
+  snprintf(topicNDeath, TOPIC_LEN, "spBv1.0/%s/NDEATH/%s", group_id, edge_node_id);
+  snprintf(topicNCmd,   TOPIC_LEN, "spBv1.0/%s/NCMD/%s", group_id, edge_node_id);
+  snprintf(topicNData,  TOPIC_LEN, "spBv1.0/%s/NDATA/%s", group_id, edge_node_id);
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    Slave& s = slaves[i];
+    snprintf(s.topicDBirth, TOPIC_LEN, "spBv1.0/%s/DBIRTH/%s/%s", group_id, edge_node_id, s.deviceId);
+    snprintf(s.topicDDeath, TOPIC_LEN, "spBv1.0/%s/DDEATH/%s/%s", group_id, edge_node_id, s.deviceId);
+    snprintf(s.topicDData,  TOPIC_LEN, "spBv1.0/%s/DDATA/%s/%s", group_id, edge_node_id, s.deviceId);
+    snprintf(s.topicDCmd,   TOPIC_LEN, "spBv1.0/%s/DCMD/%s/%s", group_id, edge_node_id, s.deviceId);
+  }
+  snprintf(mqttClientId, sizeof(mqttClientId), "ESP32_DV10_%04lX", (unsigned long)(esp_random() & 0xFFFF));
+}
+
+// ================ SPARKPLUG B: NODE DEATH ================
+// The broker publishes this will for us when the connection drops, so a host
+// application can match it to the NBIRTH with the same bdSeq. PubSubClient
+// takes the will as a C string, so the protobuf must not contain a 0 byte:
+// the metric length is a plain 1-byte varint (no 2-byte back-patch), there
+// are no timestamps, and bdSeq skips 0 when it wraps. Returns false if the
+// payload did not fit ndeathPayload.
+bool buildNodeDeath() {
+  if (payloadFormat == PAYLOAD_PROTOBUF) {
+    uint8_t metric[24];
+    SpbWriter m;
+    spbInit(m, metric, sizeof(metric));
+    spbStringField(m, 1, "bdSeq");
+    spbVarintField(m, 4, SPB_INT64);
+    spbMetricLong(m, sparkplugBdSeq);
+    
+    SpbWriter w;
+    spbInit(w, (uint8_t*)ndeathPayload, sizeof(ndeathPayload) - 1);
+    spbTag(w, 2, SPB_WIRE_LENGTH);
+    spbVarint(w, m.len);
+    spbRaw(w, m.buf, m.len);
+    ndeathPayload[w.len] = '\0';
+    return !w.overflow;
+  }
+  
+  JsonDocument& doc = jsonDoc;
+  doc.clear();
+  doc["timestamp"] = millis();
+  JsonArray metrics = doc.createNestedArray("metrics");
+  JsonObject bdSeq = metrics.createNestedObject();
+  bdSeq["name"] = "bdSeq";
+  bdSeq["dataType"] = INT64;
+  bdSeq["value"] = sparkplugBdSeq;
+  size_t len = serializeJson(doc, ndeathPayload, sizeof(ndeathPayload));
+  return !doc.overflowed() && len < sizeof(ndeathPayload) - 1;
+}
+
 // ================ SPARKPLUG B: NODE BIRTH ================
 void sendNodeBirth() {
-  String topic = String("spBv1.0/") + group_id + "/NBIRTH/" + edge_node_id;
+  sparkplugSeq = 0;
+  
+  // Batches still here were encoded for the previous session (its seq and
+  // aliases); callers flush them while that session is alive
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    Slave& s = slaves[i];
+    if (s.batchSweeps == 0) continue;
+    Serial.printf("[MQTT] ✗ %s: %u batched sweeps lost with the connection\n", s.deviceId, s.batchSweeps);
+    spbRollback(s.batch, 0);
+    s.batchSweeps = 0;
+  }
+  
+  // A new NBIRTH invalidates all aliases; node and device births reassign them
+  aliasRegistry.reset();
+  rebirthAlias = aliasRegistry.assign();
+  bdSeqAlias = aliasRegistry.assign();
+  
+  // Every slave gets its aliases now, so they stay fixed while devices die and are reborn
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    for (int m = 0; m < NUM_POINTS; m++) {
+      slaves[i].metricAlias[m] = aliasRegistry.assign();
+    }
+    for (int m = 0; m < NUM_POINTS; m++) {
+      if (!pointTable[m].window) continue;
+      for (uint8_t stat = 0; stat < NUM_AGG_STATS; stat++) {
+        slaves[i].windowAlias[m][stat] = aliasRegistry.assign();
+      }
+    }
+    slaves[i].born = false;
+  }
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    slaves[i].fanModeAlias = aliasRegistry.assign();
+    for (uint8_t m = 0; m < NUM_BUS_METRICS; m++) {
+      slaves[i].statAlias[m] = aliasRegistry.assign();
+    }
+  }
+  busLoadAlias = aliasRegistry.assign();
+  
+  if (payloadFormat == PAYLOAD_PROTOBUF) {
+    SpbWriter w;
+    spbInit(w, payloadArena, sizeof(payloadArena));
+    spbPayloadHeader(w, millis(), sparkplugSeq++);
+    
+    size_t m = spbBeginMetric(w, "Node Control/Rebirth", SPB_BOOLEAN, millis());
+    spbMetricAlias(w, rebirthAlias);
+    spbMetricBool(w, false);
+    spbEndMetric(w, m);
+    
+    m = spbBeginMetric(w, "bdSeq", SPB_INT64, millis());
+    spbMetricAlias(w, bdSeqAlias);
+    spbMetricLong(w, sparkplugBdSeq);
+    spbEndMetric(w, m);
+    
+    // Many slaves can make the bus statistics too big; the NBIRTH goes without them
+    size_t statsStart = w.len;
+    spbAddBusStats(w, true);
+    busStatsInBirth = !w.overflow;
+    if (!busStatsInBirth) {
+      spbRollback(w, statsStart);
+      Serial.println("[MQTT] ✗ Bus statistics do not fit the NBIRTH, not published");
+    }
+    
+    publishProtobuf(topicNBirth, w);
+    Serial.println("[MQTT] ✓ Node Birth (NBIRTH) sent");
+    return;
+  }
   
-  StaticJsonDocument<512> doc;
+  busStatsInBirth = false;     // Protobuf only
+  
+  JsonDocument& doc = jsonDoc;
+  doc.clear();
   doc["timestamp"] = millis();
-  doc["seq"] = 0;
+  doc["seq"] = sparkplugSeq++;
   
   JsonArray metrics = doc.createNestedArray("metrics");
   
   JsonObject rebirth = metrics.createNestedObject();
   rebirth["name"] = "Node Control/Rebirth";
+  rebirth["alias"] = rebirthAlias;
   rebirth["timestamp"] = millis();
   rebirth["dataType"] = BOOLEAN;
   rebirth["value"] = false;
   
   JsonObject bdSeq = metrics.createNestedObject();
   bdSeq["name"] = "bdSeq";
+  bdSeq["alias"] = bdSeqAlias;
   bdSeq["timestamp"] = millis();
   bdSeq["dataType"] = INT64;
-  bdSeq["value"] = 0;
-  
-  String payload;
-  serializeJson(doc, payload);
+  bdSeq["value"] = sparkplugBdSeq;
   
-  mqttClient.publish(topic.c_str(), payload.c_str());
+  publishJson(topicNBirth, doc);
   Serial.println("[MQTT] ✓ Node Birth (NBIRTH) sent");
 }
 
 // ================ SPARKPLUG B: DEVICE BIRTH ================
-void sendDeviceBirth() {
-  String topic = String("spBv1.0/") + group_id + "/DBIRTH/" + edge_node_id + "/" + device_id;
+void sendDeviceBirth(Slave& s) {
+  resetReportCache(s);
+  s.born = true;
+  
+  if (payloadFormat == PAYLOAD_PROTOBUF) {
+    SpbWriter w;
+    spbInit(w, payloadArena, sizeof(payloadArena));
+    spbPayloadHeader(w, millis(), sparkplugSeq++);
+    
+    for (int i = 0; i < NUM_POINTS; i++) {
+      const PointDef& def = pointTable[i];
+      bool bad = s.view.bad[i];
+      size_t m = spbBeginMetric(w, def.name, def.dataType, millis());
+      spbMetricAlias(w, s.metricAlias[i]);
+      spbMetricProperties(w, def.unit, bad ? SPB_QUALITY_BAD : -1);
+      if (bad) {
+        spbMetricNull(w);
+      } else {
+        spbAddSensorValue(w, def, s.view.data);
+      }
+      spbEndMetric(w, m);
+    }
+    
+    // Window metrics are named "<metric>/Min" etc. and start out with the last closed window
+    char name[64];
+    for (int i = 0; i < NUM_POINTS; i++) {
+      const PointDef& def = pointTable[i];
+      if (!def.window) continue;
+      for (uint8_t stat = 0; stat < NUM_AGG_STATS; stat++) {
+        snprintf(name, sizeof(name), "%s/%s", def.name, aggSuffix[stat]);
+        bool isCount = (stat == AGG_COUNT);
+        size_t m = spbBeginMetric(w, name, isCount ? UINT32 : FLOAT, millis());
+        spbMetricAlias(w, s.windowAlias[i][stat]);
+        if (isCount) {
+          spbMetricUInt(w, s.view.window[i].count);
+        } else {
+          spbMetricEngUnit(w, def.unit);
+          spbMetricFloat(w, windowStat(s.view.window[i], stat));
+        }
+        spbEndMetric(w, m);
+      }
+    }
+    
+    // Fan mode: writable by DCMD, null until it has been read
+    size_t m = spbBeginMetric(w, "FanMode", UINT16, millis());
+    spbMetricAlias(w, s.fanModeAlias);
+    if (s.view.fanMode < 0) {
+      spbMetricNull(w);
+    } else {
+      spbMetricUInt(w, s.view.fanMode);
+    }
+    spbEndMetric(w, m);
+    
+    publishProtobuf(s.topicDBirth, w);
+    Serial.printf("[MQTT] ✓ Device Birth (DBIRTH) sent for %s (%u bytes)\n", s.deviceId, (unsigned)w.len);
+    return;
+  }
   
-  DynamicJsonDocument doc(2048);
+  JsonDocument& doc = jsonDoc;
+  doc.clear();
   doc["timestamp"] = millis();
-  doc["seq"] = 1;
+  doc["seq"] = sparkplugSeq++;
   
   JsonArray metrics = doc.createNestedArray("metrics");
   
-  const char* metricNames[] = {
-    "HeatExchangerEfficiency", "RunMode",
-    "OutdoorTemp", "SupplyAirTemp", "SupplyAirSetpointTemp", "ExhaustAirTemp", "ExtractAirTemp",
-    "SupplyAirPressure", "ExtractAirPressure",
-    "SupplyAirFlow", "ExtractAirFlow", "ExtraSupplyAirFlow", "ExtraExtractAirFlow",
-    "SupplyFanRuntime", "ExtractFanRuntime"
-  };
-  
-  const char* units[] = {
-    "%", "", "°C", "°C", "°C", "°C", "°C", "Pa", "Pa", 
-    "m³/h", "m³/h", "m³/h", "m³/h", "min", "min"
-  };
-  
-  SparkplugDataType dataTypes[] = {
-    FLOAT, UINT16, FLOAT, FLOAT, FLOAT, FLOAT, FLOAT, FLOAT, FLOAT,
-    FLOAT, FLOAT, FLOAT, FLOAT, UINT16, UINT16
-  };
-  
-  for (int i = 0; i < 15; i++) {
+  for (int i = 0; i < NUM_POINTS; i++) {
     JsonObject metric = metrics.createNestedObject();
-    metric["name"] = metricNames[i];
+    metric["name"] = pointTable[i].name;
+    metric["alias"] = s.metricAlias[i];
     metric["timestamp"] = millis();
-    metric["dataType"] = dataTypes[i];
+    metric["dataType"] = pointTable[i].dataType;
     
     JsonObject properties = metric.createNestedObject("properties");
     JsonObject engUnit = properties.createNestedObject("engUnit");
     engUnit["type"] = STRING;
-    engUnit["value"] = units[i];
+    engUnit["value"] = pointTable[i].unit;
     
-    metric["value"] = 0;
+    // The real value, as in the protobuf DBIRTH: it is the report-by-exception baseline
+    if (s.view.bad[i]) {
+      metric["is_null"] = true;
+      JsonObject quality = properties.createNestedObject("Quality");
+      quality["type"] = INT32;
+      quality["value"] = SPB_QUALITY_BAD;
+    } else if (pointTable[i].dataType == FLOAT) {
+      metric["value"] = metricFloat(s.view.data, pointTable[i]);
+    } else {
+      metric["value"] = metricUInt16(s.view.data, pointTable[i]);
+    }
+  }
+  
+  char name[64];
+  for (int i = 0; i < NUM_POINTS; i++) {
+    if (!pointTable[i].window) continue;
+    for (uint8_t stat = 0; stat < NUM_AGG_STATS; stat++) {
+      snprintf(name, sizeof(name), "%s/%s", pointTable[i].name, aggSuffix[stat]);
+      JsonObject metric = metrics.createNestedObject();
+      metric["name"] = name;     // Copied into the document
+      metric["alias"] = s.windowAlias[i][stat];
+      metric["dataType"] = (stat == AGG_COUNT) ? UINT32 : FLOAT;
+      if (stat == AGG_COUNT) {
+        metric["value"] = s.view.window[i].count;
+      } else {
+        metric["value"] = windowStat(s.view.window[i], stat);
+      }
+    }
   }
   
-  String payload;
-  serializeJson(doc, payload);
+  JsonObject fanMode = metrics.createNestedObject();
+  fanMode["name"] = "FanMode";
+  fanMode["alias"] = s.fanModeAlias;
+  fanMode["dataType"] = UINT16;
+  if (s.view.fanMode < 0) {
+    fanMode["is_null"] = true;
+  } else {
+    fanMode["value"] = s.view.fanMode;
+  }
   
-  mqttClient.publish(topic.c_str(), payload.c_str());
-  Serial.println("[MQTT] ✓ Device Birth (DBIRTH) sent");
+  publishJson(s.topicDBirth, doc);
+  Serial.printf("[MQTT] ✓ Device Birth (DBIRTH) sent for %s\n", s.deviceId);
 }
 
-// ================ MQTT RECONNECT ================
-void reconnectMQTT() {
-  while (!mqttClient.connected()) {
-    Serial.print("[MQTT] Attempting connection...");
+// An offline slave is born with its first good sweep instead
+void sendDeviceBirths() {
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (!slaves[i].view.offline) sendDeviceBirth(slaves[i]);
+  }
+}
+
+// ================ SPARKPLUG B: DEVICE DEATH ================
+// Tells host applications that a slave stopped answering; it is born again
+// with its first good sweep
+void sendDeviceDeath(Slave& s) {
+  if (!s.born || !mqttClient.connected()) return;
+  flushBatch(s);      // Its last values belong before the death
+  s.born = false;
+  
+  if (payloadFormat == PAYLOAD_PROTOBUF) {
+    SpbWriter w;
+    spbInit(w, payloadArena, sizeof(payloadArena));
+    spbPayloadHeader(w, millis(), sparkplugSeq++);
+    publishProtobuf(s.topicDDeath, w);
+  } else {
+    JsonDocument& doc = jsonDoc;
+    doc.clear();
+    doc["timestamp"] = millis();
+    doc["seq"] = sparkplugSeq++;
+    publishJson(s.topicDDeath, doc);
+  }
+  Serial.printf("[MQTT] ✓ Device Death (DDEATH) sent for %s\n", s.deviceId);
+}
+
+// ================ SPARKPLUG B: NODE DATA ================
+// Bus statistics of each period the poll engine closes (closeBusStats), so
+// each NDATA has the percentiles of its own period. A period that comes in
+// while MQTT is down is left alone; the poll engine keeps adding to it.
+void publishBusStats() {
+  if (nodeStats.sequence() != statsViewSeq) statsViewSeq = nodeStats.read(statsView);
+  if (statsView.period == statsTaken.load(std::memory_order_relaxed)) return;
+  
+  // JSON and an NBIRTH without the statistics never publish them; just take the period
+  if (busStatsInBirth && payloadFormat == PAYLOAD_PROTOBUF) {
+    if (!mqttClient.connected()) return;
     
-    String clientId = "ESP32_DV10_" + String(random(0xffff), HEX);
+    SpbWriter w;
+    spbInit(w, payloadArena, sizeof(payloadArena));
+    spbPayloadHeader(w, millis(), sparkplugSeq++);
+    spbAddBusStats(w, false);
     
-    if (mqttClient.connect(clientId.c_str(), mqtt_user, mqtt_password)) {
-      Serial.println("✓ Connected");
-      sendNodeBirth();
-      sendDeviceBirth();
+    if (publishProtobuf(topicNData, w)) {
+      trace(TRACE_INFO, EV_NDATA, 0, NUM_SLAVES * NUM_BUS_METRICS + 1, w.len);
     } else {
-      Serial.print("✗ Failed, rc=");
-      Serial.print(mqttClient.state());
-      Serial.println(" retry in 5 sec");
-      delay(5000);
+      trace(TRACE_ERROR, EV_PUBLISH_FAIL, 0);
     }
   }
+  statsTaken.store(statsView.period, std::memory_order_release);
 }
 
-// ================ HELPER: ADD METRIC (FLOAT) ================
-void addMetric(JsonArray& metrics, const char* name, float value, SparkplugDataType dataType, unsigned long timestamp) {
-  JsonObject metric = metrics.createNestedObject();
-  metric["name"] = name;
-  metric["timestamp"] = timestamp;
-  metric["dataType"] = dataType;
-  metric["value"] = value;
-}
+// ================ SPARKPLUG B: NODE AND DEVICE COMMANDS ================
+// Host applications send NCMD "Node Control/Rebirth" when they see an alias
+// they do not know. The births are re-sent by serviceNetwork(), not from inside the
+// PubSubClient callback, because publishing reuses the receive buffer.
+// DCMD "FanMode" (by name or alias) on a device goes into its command lane.
+void mqttCallback(char* topic, uint8_t* payload, unsigned int length) {
+  SpbPayloadView header;
+  SpbMetricView metrics[4];
+  if (!spbDecodePayload(payload, length, header, metrics, 4)) {
+    Serial.printf("[MQTT] ✗ Could not decode command on %s\n", topic);
+    return;
+  }
 
-// ================ HELPER: ADD METRIC (UINT16) ================
-void addMetric(JsonArray& metrics, const char* name, uint16_t value, SparkplugDataType dataType, unsigned long timestamp) {
-  JsonObject metric = metrics.createNestedObject();
-  metric["name"] = name;
-  metric["timestamp"] = timestamp;
-  metric["dataType"] = dataType;
-  metric["value"] = value;
+  Slave* device = nullptr;
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (strcmp(topic, slaves[i].topicDCmd) == 0) device = &slaves[i];
+  }
+
+  size_t n = header.numMetrics < 4 ? header.numMetrics : 4;
+  for (size_t i = 0; i < n; i++) {
+    const SpbMetricView& m = metrics[i];
+    if (device) {
+      bool isFanMode = (m.hasAlias && m.alias == device->fanModeAlias) ||
+                       (m.nameLen == 7 && memcmp(m.name, "FanMode", 7) == 0);
+      if (!isFanMode) continue;
+      if (m.valueKind != SPB_VALUE_INT || m.intValue > 3) {
+        trace(TRACE_ERROR, EV_CMD_REJECTED, device->id, FAN_MODE_REG, (uint16_t)m.intValue);
+      } else {
+        queueCommand(*device, FAN_MODE_REG, (uint16_t)m.intValue, true);
+      }
+      continue;
+    }
+    
+    bool isRebirth = (m.hasAlias && m.alias == rebirthAlias) ||
+                     (m.nameLen == 20 && memcmp(m.name, "Node Control/Rebirth", 20) == 0);
+    if (isRebirth && m.intValue != 0) {
+      Serial.println("[MQTT] Rebirth requested by host");
+      rebirthRequested = true;
+    }
+  }
+}
+
+// ================ MQTT RECONNECT ================
+// Random value in [0, range) - spreads reconnects of many nodes after a broker restart
+unsigned long jitter(unsigned long range) {
+  return range > 0 ? esp_random() % range : 0;
+}
+
+// One connect attempt. connect() blocks for at most the socket timeout.
+bool connectMQTT() {
+  Serial.print("[MQTT] Attempting connection...");
+  
+  // Every CONNECT carries a new bdSeq; its NBIRTH below reports the same one
+  if (++sparkplugBdSeq == 0) sparkplugBdSeq = 1;
+  bool will = buildNodeDeath();
+  if (!will) Serial.print("✗ NDEATH does not fit its buffer, connecting without a will...");
+  
+  bool ok = will ? mqttClient.connect(mqttClientId, mqtt_user, mqtt_password, topicNDeath, 1, false, ndeathPayload)
+                 : mqttClient.connect(mqttClientId, mqtt_user, mqtt_password);
+  if (ok) {
+    Serial.println("✓ Connected");
+    mqttClient.subscribe(topicNCmd);
+    for (int i = 0; i < NUM_SLAVES; i++) {
+      mqttClient.subscribe(slaves[i].topicDCmd);
+    }
+    sendNodeBirth();
+    sendDeviceBirths();
+    return true;
+  }
+  
+  Serial.printf("✗ Failed, rc=%d\n", mqttClient.state());
+  return false;
+}
+
+// Called every serviceNetwork(). Never waits: it either does one step or returns.
+void serviceConnection() {
+  unsigned long now = millis();
+  
+  // ---- WiFi re-association ----
+  if (WiFi.status() != WL_CONNECTED) {
+    if (!wifiAssociating || now - wifiAssocStart >= WIFI_REASSOC_TIMEOUT_MS) {
+      Serial.println("[WiFi] Not connected, (re)starting association");
+      WiFi.disconnect();
+      WiFi.begin(ssid, password);
+      wifiAssociating = true;
+      wifiAssocStart = now;
+    }
+    mqttWasConnected = false;
+    return;
+  }
+  
+  if (wifiAssociating) {
+    wifiAssociating = false;
+    Serial.print("[WiFi] ✓ Connected, IP address: ");
+    Serial.println(WiFi.localIP());
+    mqttNextAttempt = now + jitter(MQTT_FIRST_ATTEMPT_SPREAD);
+  }
+  
+  // ---- MQTT ----
+  if (mqttClient.connected()) {
+    mqttWasConnected = true;
+    return;
+  }
+  
+  if (mqttWasConnected) {
+    mqttWasConnected = false;
+    mqttBackoff = MQTT_BACKOFF_MIN_MS;
+    mqttNextAttempt = now + jitter(MQTT_FIRST_ATTEMPT_SPREAD);
+    Serial.println("[MQTT] ✗ Connection lost");
+    return;
+  }
+  
+  if ((long)(now - mqttNextAttempt) < 0) return;
+  
+  if (now - mqttWindowStart >= MQTT_ATTEMPT_WINDOW_MS) {
+    mqttWindowStart = now;
+    mqttWindowAttempts = 0;
+  }
+  if (mqttWindowAttempts >= MQTT_MAX_ATTEMPTS) return;
+  mqttWindowAttempts++;
+  
+  if (connectMQTT()) {
+    mqttWasConnected = true;
+    mqttBackoff = MQTT_BACKOFF_MIN_MS;
+    return;
+  }
+  
+  // Equal jitter: wait between half and all of the current backoff
+  unsigned long wait = mqttBackoff / 2 + jitter(mqttBackoff / 2);
+  mqttNextAttempt = millis() + wait;
+  Serial.printf("[MQTT] Next attempt in %lu ms\n", wait);
+  mqttBackoff = (mqttBackoff * 2 > MQTT_BACKOFF_MAX_MS) ? MQTT_BACKOFF_MAX_MS : mqttBackoff * 2;
+}
+
+// ================ HELPER: ADD METRIC (FLOAT) ================
+// DDATA metrics carry only the alias from DBIRTH and the value
+void addMetric(JsonArray& metrics, uint32_t alias, float value) {
+  JsonObject metric = metrics.createNestedObject();
+  metric["alias"] = alias;
+  metric["value"] = value;
+}
+
+// ================ HELPER: ADD METRIC (UINT16) ================
+void addMetric(JsonArray& metrics, uint32_t alias, uint16_t value) {
+  JsonObject metric = metrics.createNestedObject();
+  metric["alias"] = alias;
+  metric["value"] = value;
+}
+
+// ================ HELPER: ADD METRIC (BAD QUALITY) ================
+// A register whose circuit breaker is open: no value, Quality bad
+JsonObject addBadMetric(JsonArray& metrics, uint32_t alias) {
+  JsonObject metric = metrics.createNestedObject();
+  metric["alias"] = alias;
+  metric["is_null"] = true;
+  JsonObject quality = metric.createNestedObject("properties").createNestedObject("Quality");
+  quality["type"] = INT32;
+  quality["value"] = SPB_QUALITY_BAD;
+  return metric;
+}
+
+// ================ SPARKPLUG B: DATA PUBLISH ================
+// The metrics picked by selectChangedMetrics(), with the time each was read
+// when 'timestamps' is set (batches), else under the payload timestamp
+void spbAddReported(SpbWriter& w, const Slave& s, bool timestamps) {
+  for (int i = 0; i < NUM_POINTS; i++) {
+    if (!reportMetric[i]) continue;
+    bool bad = reportQuality[i] == SPB_QUALITY_BAD;
+    size_t m = spbBeginAliasMetric(w, s.metricAlias[i]);
+    if (timestamps) spbMetricTimestamp(w, bad ? s.view.data.timestamp : s.view.pointTime[i]);
+    if (reportQuality[i] >= 0) spbMetricQuality(w, reportQuality[i]);
+    if (bad) {
+      spbMetricNull(w);
+    } else {
+      spbAddSensorValue(w, pointTable[i], s.view.data);
+    }
+    spbEndMetric(w, m);
+  }
+}
+
+// Sends the collected batch of 's' as one DDATA
+void flushBatch(Slave& s) {
+  if (s.batchSweeps == 0) return;
+  
+  SpbWriter w;
+  spbInit(w, payloadArena, sizeof(payloadArena));
+  spbPayloadHeader(w, millis(), sparkplugSeq++);
+  spbRaw(w, s.batch.buf, s.batch.len);
+  
+  if (publishProtobuf(s.topicDData, w)) {
+    trace(TRACE_INFO, EV_BATCH, s.id, s.batchSweeps, w.len);
+  } else {
+    trace(TRACE_ERROR, EV_PUBLISH_FAIL, s.id);
+  }
+  spbRollback(s.batch, 0);
+  s.batchSweeps = 0;
+}
+
+void flushBatches() {
+  for (int i = 0; i < NUM_SLAVES; i++) flushBatch(slaves[i]);
+}
+
+// Batches that are due by age, called from serviceNetwork()
+void serviceBatches() {
+  if (!mqttClient.connected()) return;
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    Slave& s = slaves[i];
+    if (s.batchSweeps > 0 && millis() - s.batchStart >= DDATA_BATCH_LATENCY_MS) flushBatch(s);
+  }
+}
+
+// Adds the metrics of this sweep to the batch of 's'. A sweep that does not
+// fit any more sends the batch first and starts the next one.
+void batchSweep(Slave& s, bool withWindow) {
+  for (int attempt = 0; attempt < 2; attempt++) {
+    size_t mark = s.batch.len;
+    spbAddReported(s.batch, s, true);
+    if (withWindow) spbAddWindow(s.batch, s, millis());
+    if (!s.batch.overflow) break;
+    
+    spbRollback(s.batch, mark);
+    if (s.batchSweeps == 0) {
+      Serial.printf("[MQTT] ✗ %s: sweep larger than the batch buffer, dropped\n", s.deviceId);
+      return;
+    }
+    flushBatch(s);
+  }
+  
+  if (s.batchSweeps++ == 0) s.batchStart = millis();
+  if (s.batchSweeps >= DDATA_BATCH_SWEEPS) flushBatch(s);
+}
+
+// The sweep in the snapshot of 's', plus the window when one has closed
+void publishSparkplugData(Slave& s, bool withWindow) {
+  if (!s.view.data.dataValid) {
+    trace(TRACE_WARN, EV_DDATA_INVALID, s.id);
+    return;
+  }
+  
+  // Back from offline: the DBIRTH carries this sweep, no DDATA needed
+  if (!s.born) {
+    sendDeviceBirth(s);
+    return;
+  }
+  
+  uint32_t allocsBefore = heapAllocCount;
+  
+  int numReported = selectChangedMetrics(s);
+  if (numReported == 0 && !withWindow) {
+    trace(TRACE_DEBUG, EV_DDATA_SKIP, s.id);
+    return;
+  }
+  
+  if (payloadFormat == PAYLOAD_PROTOBUF && batchEnabled) {
+    batchSweep(s, withWindow);
+    return;
+  }
+  
+  if (payloadFormat == PAYLOAD_PROTOBUF) {
+    SpbWriter w;
+    spbInit(w, payloadArena, sizeof(payloadArena));
+    spbPayloadHeader(w, s.view.data.timestamp, sparkplugSeq++);
+    
+    spbAddReported(w, s, false);
+    int numWindow = withWindow ? spbAddWindow(w, s, 0) : 0;
+    
+    if (publishProtobuf(s.topicDData, w)) {
+      trace(TRACE_INFO, EV_DDATA, s.id, numReported + numWindow, w.len, heapAllocCount - allocsBefore);
+    } else {
+      trace(TRACE_ERROR, EV_PUBLISH_FAIL, s.id);
+    }
+    return;
+  }
+  JsonDocument& doc = jsonDoc;
+  doc.clear();
+  doc["timestamp"] = s.view.data.timestamp;
+  doc["seq"] = sparkplugSeq++;
+  
+  JsonArray metrics = doc.createNestedArray("metrics");
+  
+  for (int i = 0; i < NUM_POINTS; i++) {
+    if (!reportMetric[i]) continue;
+    const PointDef& def = pointTable[i];
+    if (reportQuality[i] == SPB_QUALITY_BAD) {
+      addBadMetric(metrics, s.metricAlias[i]);
+    } else if (def.dataType == FLOAT) {
+      addMetric(metrics, s.metricAlias[i], metricFloat(s.view.data, def));
+    } else {
+      addMetric(metrics, s.metricAlias[i], metricUInt16(s.view.data, def));
+    }
+  }
+  
+  int numWindow = 0;
+  for (int i = 0; withWindow && i < NUM_POINTS; i++) {
+    if (!pointTable[i].window) continue;
+    const WindowAgg& a = s.view.window[i];
+    for (uint8_t stat = 0; stat < NUM_AGG_STATS; stat++) {
+      if (a.count == 0 && stat != AGG_COUNT) continue;
+      addMetric(metrics, s.windowAlias[i][stat], windowStat(a, stat));
+      numWindow++;
+    }
+  }
+  
+  size_t len = publishJson(s.topicDData, doc);
+  
+  if (len > 0) {
+    trace(TRACE_INFO, EV_DDATA, s.id, numReported + numWindow, len, heapAllocCount - allocsBefore);
+  } else {
+    trace(TRACE_ERROR, EV_PUBLISH_FAIL, s.id);
+  }
+}
+
+// Result of a command: the fan mode read back after the write, or null with
+// bad quality when it could not be read
+void publishFanMode(Slave& s) {
+  if (!s.born || !mqttClient.connected()) return;
+  
+  if (payloadFormat == PAYLOAD_PROTOBUF) {
+    SpbWriter w;
+    spbInit(w, payloadArena, sizeof(payloadArena));
+    spbPayloadHeader(w, millis(), sparkplugSeq++);
+    size_t m = spbBeginAliasMetric(w, s.fanModeAlias);
+    if (s.view.fanMode < 0) {
+      spbMetricQuality(w, SPB_QUALITY_BAD);
+      spbMetricNull(w);
+    } else {
+      spbMetricUInt(w, s.view.fanMode);
+    }
+    spbEndMetric(w, m);
+    if (publishProtobuf(s.topicDData, w)) {
+      trace(TRACE_INFO, EV_DDATA, s.id, 1, w.len);
+    } else {
+      trace(TRACE_ERROR, EV_PUBLISH_FAIL, s.id);
+    }
+    return;
+  }
+  
+  JsonDocument& doc = jsonDoc;
+  doc.clear();
+  doc["timestamp"] = millis();
+  doc["seq"] = sparkplugSeq++;
+  JsonArray metrics = doc.createNestedArray("metrics");
+  if (s.view.fanMode < 0) {
+    addBadMetric(metrics, s.fanModeAlias);
+  } else {
+    addMetric(metrics, s.fanModeAlias, (uint16_t)s.view.fanMode);
+  }
+  size_t len = publishJson(s.topicDData, doc);
+  if (len > 0) {
+    trace(TRACE_INFO, EV_DDATA, s.id, 1, len);
+  } else {
+    trace(TRACE_ERROR, EV_PUBLISH_FAIL, s.id);
+  }
+}
+
+// ================ STORE AND FORWARD ================
+SfRecord makeRecord(const Slave& s) {
+  SfRecord r;
+  memset(&r, 0, sizeof(r));
+  r.timestamp = s.view.data.timestamp;
+  r.slave = (uint8_t)(&s - slaves);
+  for (int i = 0; i < NUM_POINTS && i < SF_MAX_VALUES; i++) {
+    const PointDef& m = pointTable[i];
+    r.values[i] = (m.dataType == FLOAT) ? (uint16_t)lroundf(metricFloat(s.view.data, m) * m.scale)
+                                        : metricUInt16(s.view.data, m);
+    if (s.view.bad[i]) r.bad |= 1 << i;
+  }
+  return r;
+}
+
+void spbAddRecordValue(SpbWriter& w, const PointDef& m, uint16_t raw) {
+  if (m.dataType == FLOAT) {
+    spbMetricFloat(w, raw / m.scale);
+  } else {
+    spbMetricUInt(w, raw);
+  }
+}
+
+#if SF_FLASH_SPILL
+// Timestamps are millis(), so a spill file from before a reboot is useless
+void setupSpill() {
+  if (!LittleFS.begin(true)) {
+    Serial.println("✗ LittleFS mount failed, no flash spill");
+    return;
+  }
+  LittleFS.remove(SF_SPILL_FILE);
+}
+
+void spillRecord(const SfRecord& r) {
+  if (spillCount >= SF_SPILL_MAX_RECORDS) {
+    sampleBuffer.countDropped();
+    return;
+  }
+  File f = LittleFS.open(SF_SPILL_FILE, "a");
+  if (!f || f.write((const uint8_t*)&r, sizeof(r)) != sizeof(r)) {
+    sampleBuffer.countDropped();
+  } else {
+    spillCount++;
+  }
+  if (f) f.close();
+}
+#endif
+
+uint32_t backlogSize() {
+#if SF_FLASH_SPILL
+  return (spillCount - spillReadPos) + sampleBuffer.size();
+#else
+  return sampleBuffer.size();
+#endif
+}
+
+void storeSample(const Slave& s) {
+  if (!s.view.data.dataValid) return;
+  
+  SfRecord r = makeRecord(s);
+#if SF_FLASH_SPILL
+  SfRecord evicted;
+  if (sampleBuffer.push(r, &evicted)) spillRecord(evicted);
+#else
+  sampleBuffer.push(r);
+#endif
+  uint32_t backlog = backlogSize();
+  trace(TRACE_DEBUG, EV_STORE, s.id, 0, backlog > 0xFFFF ? 0xFFFF : backlog);
+}
+
+// Copies the oldest 'max' records (flash first, then RAM) into 'out'.
+// A batch only holds records of one slave, since it goes to one DDATA topic.
+uint16_t loadBacklog(SfRecord* out, uint16_t max) {
+  uint16_t n = 0;
+#if SF_FLASH_SPILL
+  if (spillReadPos < spillCount) {
+    File f = LittleFS.open(SF_SPILL_FILE, "r");
+    if (f && f.seek(spillReadPos * sizeof(SfRecord))) {
+      while (n < max && spillReadPos + n < spillCount &&
+             f.read((uint8_t*)&out[n], sizeof(SfRecord)) == sizeof(SfRecord)) {
+        if (out[n].slave != out[0].slave) break;
+        n++;
+      }
+    }
+    if (f) f.close();
+    if (n > 0) return n;    // Never mix flash and RAM records in one batch
+  }
+#endif
+  while (n < max && n < sampleBuffer.size()) {
+    out[n] = sampleBuffer.peek(n);
+    if (out[n].slave != out[0].slave) break;
+    n++;
+  }
+  return n;
+}
+
+// Removes 'n' records that were sent, in the same order as loadBacklog()
+void dropBacklog(uint16_t n) {
+#if SF_FLASH_SPILL
+  if (spillReadPos < spillCount) {
+    spillReadPos += n;
+    if (spillReadPos >= spillCount) {
+      LittleFS.remove(SF_SPILL_FILE);
+      spillCount = 0;
+      spillReadPos = 0;
+    }
+    return;
+  }
+#endif
+  sampleBuffer.pop(n);
+}
+
+// Sends the oldest buffered samples as one historical DDATA. Each metric
+// carries its own timestamp; host applications file them under that time.
+void replayBacklog() {
+  uint16_t n = loadBacklog(replayBatch, payloadFormat == PAYLOAD_PROTOBUF ? REPLAY_MAX_RECORDS : 1);
+  if (n == 0) return;
+  
+  // A slave that died since the births has no device to file the data under
+  Slave& s = slaves[replayBatch[0].slave < NUM_SLAVES ? replayBatch[0].slave : 0];
+  if (!s.born) {
+    dropBacklog(n);
+    for (uint16_t i = 0; i < n; i++) sampleBuffer.countDropped();
+    Serial.printf("[MQTT] ✗ %s is offline, %u buffered samples dropped\n", s.deviceId, n);
+    return;
+  }
+  
+  uint16_t sent = 0;
+  size_t len = 0;
+  
+  if (payloadFormat == PAYLOAD_PROTOBUF) {
+    SpbWriter w;
+    spbInit(w, payloadArena, sizeof(payloadArena));
+    spbPayloadHeader(w, millis(), sparkplugSeq);
+    
+    for (uint16_t r = 0; r < n; r++) {
+      size_t recordStart = w.len;
+      for (int i = 0; i < NUM_POINTS; i++) {
+        size_t m = spbBeginAliasMetric(w, s.metricAlias[i]);
+        spbMetricTimestamp(w, replayBatch[r].timestamp);
+        spbMetricHistorical(w);
+        if (replayBatch[r].bad & (1 << i)) {
+          spbMetricQuality(w, SPB_QUALITY_BAD);
+          spbMetricNull(w);
+        } else {
+          spbAddRecordValue(w, pointTable[i], replayBatch[r].values[i]);
+        }
+        spbEndMetric(w, m);
+      }
+      if (w.overflow) {
+        spbRollback(w, recordStart);   // Rest goes in the next batch
+        break;
+      }
+      sent++;
+    }
+    
+    if (sent == 0 || !mqttClient.publish(s.topicDData, w.buf, w.len)) {
+      Serial.println("[MQTT] ✗ Replay publish failed");
+      return;
+    }
+    len = w.len;
+  } else {
+    JsonDocument& doc = jsonDoc;
+    doc.clear();
+    doc["timestamp"] = millis();
+    doc["seq"] = sparkplugSeq;
+    
+    JsonArray metrics = doc.createNestedArray("metrics");
+    for (int i = 0; i < NUM_POINTS; i++) {
+      const PointDef& def = pointTable[i];
+      bool bad = replayBatch[0].bad & (1 << i);
+      JsonObject metric = bad ? addBadMetric(metrics, s.metricAlias[i]) : metrics.createNestedObject();
+      metric["alias"] = s.metricAlias[i];
+      metric["timestamp"] = replayBatch[0].timestamp;
+      metric["is_historical"] = true;
+      if (bad) continue;
+      if (def.dataType == FLOAT) {
+        metric["value"] = replayBatch[0].values[i] / def.scale;
+      } else {
+        metric["value"] = replayBatch[0].values[i];
+      }
+    }
+    
+    len = publishJson(s.topicDData, doc);
+    if (len == 0) {
+      Serial.println("[MQTT] ✗ Replay publish failed");
+      return;
+    }
+    sent = 1;
+  }
+  
+  sparkplugSeq++;
+  dropBacklog(sent);
+  trace(TRACE_INFO, EV_REPLAY, s.id, sent, len);
+}
+
+void setup() {
+  pinMode(MAX485_RE_NEG, OUTPUT);
+  pinMode(MAX485_DE, OUTPUT);
+  digitalWrite(MAX485_RE_NEG, LOW);
+  digitalWrite(MAX485_DE, LOW);
+
+  Serial.setTxBufferSize(CONSOLE_TX_BUFFER);
+  Serial.begin(115200);
+  Serial.println("\n===========================================");
+  Serial.println("ESP32 Modbus RTU + MQTT Sparkplug B");
+  Serial.println("===========================================\n");
+
+  // Modbus Setup
+  bool stored = loadLinkConfig();
+  Serial2.begin(rs485Link.baud, rs485Link.format, RX_PIN, TX_PIN);
+  modbus.begin(&Serial2, rs485Link.baud, preTransmission, postTransmission);
+  modbus.setTimeout(MODBUS_TIMEOUT_MS);
+  modbus.setTurnaround(rs485Link.turnaroundMs);
+  Serial.printf("✓ Modbus RTU Initialized: %lu %s, %ums between requests, blocks up to %u regs (%s)\n",
+                (unsigned long)rs485Link.baud, linkFormatName(rs485Link.format), rs485Link.turnaroundMs,
+                rs485Link.maxBlockRegs, stored ? "commissioned" : "defaults, 'c' to commission");
+  setupReadPlan();
+  setupSlaves();
+#if SF_FLASH_SPILL
+  setupSpill();
+#endif
+  Serial.println();
+
+  // WiFi & MQTT Setup
+  setupWiFi();
+  tcpServer.begin(tcpRead, tcpWrite);
+  Serial.printf("✓ Modbus TCP server on port %u\n", MODBUS_TCP_PORT);
+  buildTopics();
+  mqttClient.setServer(mqtt_server, mqtt_port);
+  mqttClient.setBufferSize(sizeof(payloadArena) + TOPIC_LEN + 5);   // Payload + topic + MQTT header
+  mqttClient.setCallback(mqttCallback);
+  mqttClient.setSocketTimeout(MQTT_SOCKET_TIMEOUT_S);
+  
+  // MQTT connects from the network task via serviceConnection()
+  wifiAssociating = (WiFi.status() != WL_CONNECTED);
+  wifiAssocStart = millis();
+  mqttNextAttempt = millis() + jitter(MQTT_FIRST_ATTEMPT_SPREAD);
+
+  printMenu();
+
+#if DUAL_CORE
+  xTaskCreatePinnedToCore(networkTask, "network", NET_TASK_STACK, nullptr,
+                          NET_TASK_PRIORITY, nullptr, NET_TASK_CORE);
+  xTaskCreatePinnedToCore(acquisitionTask, "acquisition", ACQ_TASK_STACK, nullptr,
+                          ACQ_TASK_PRIORITY, nullptr, ACQ_TASK_CORE);
+#endif
+}
+
+// =============== CLI MENU ===============
+void printMenu() {
+  Serial.println("\n========== MENU ==========");
+  Serial.println("Fan Mode Control:");
+  Serial.println("  0 = Off");
+  Serial.println("  1 = Manual Reduced");
+  Serial.println("  2 = Manual Normal");
+  Serial.println("  3 = Auto Speed");
+  Serial.println("\nCommands:");
+  Serial.println("  r = Read all sensors now");
+  Serial.println("  a = Toggle auto-read ON/OFF");
+  Serial.println("  i = Set auto-read interval");
+  Serial.println("  f = Toggle payload format (Protobuf/JSON)");
+  Serial.println("  e = Toggle report-by-exception ON/OFF");
+  Serial.println("  b = Toggle DDATA batching ON/OFF");
+  Serial.println("  u = Select slave for 0-3 and r (all / one)");
+  Serial.println("  v = Toggle verbose trace ON/OFF");
+  Serial.println("  t = Show the trace log");
+  Serial.println("  s = Show bus statistics");
+  Serial.println("  c = Commission the RS485 link (fastest stable setting, kept in NVS)");
+  Serial.println("  m = Show menu");
+  Serial.printf("\nAuto-read: %s | Bus load: %u%% (budget %u%%)\n",
+                autoReadEnabled ? "ON" : "OFF", busLoadPct.load(std::memory_order_relaxed), BUS_BUDGET_PCT);
+  for (uint8_t c = 0; c < NUM_POLL_CLASSES; c++) {
+    Serial.printf("  Poll class %-6s every %lu sec\n", pollClasses[c].name, pollPeriod(c) / 1000);
+  }
+  Serial.printf("Payload: %s | Report-by-exception: %s | Batching: %s\n",
+                payloadFormat == PAYLOAD_PROTOBUF ? "Sparkplug B protobuf" : "JSON",
+                rbeEnabled ? "ON" : "OFF", batchEnabled ? "ON" : "OFF");
+  Serial.printf("WiFi: %s | MQTT: %s\n",
+                WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected",
+                mqttClient.connected() ? "Connected" : "Disconnected");
+  Serial.printf("Trace: %s, %lu records logged\n",
+                traceVerbose ? "verbose" : "warnings only", (unsigned long)traceTotal());
+  Serial.printf("Backlog: %lu samples buffered, %lu dropped\n",
+                (unsigned long)backlogSize(), (unsigned long)sampleBuffer.dropped());
+  Serial.printf("Target: %s\n", selectedSlave < 0 ? "all slaves" : slaves[selectedSlave].deviceId);
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    Serial.printf("  Slave %3u %-16s %-7s fan mode %ld, polled %ux\n", slaves[i].id, slaves[i].deviceId,
+                  slaves[i].view.offline ? "OFFLINE" : "online", (long)slaves[i].view.fanMode,
+                  slaves[i].view.pollBoost);
+  }
+  Serial.println("==========================\n");
+}
+
+// =============== COMMAND LANE ===============
+// Queues a command for 's' (network task). A write to a register that is
+// already waiting just takes the new value, so only the newest setpoint goes
+// on the bus.
+bool queueCommand(Slave& s, uint16_t reg, uint16_t value, bool write) {
+  bool queued = true;
+  portENTER_CRITICAL(&cmdMux);
+  Command* c = nullptr;
+  for (uint8_t k = 0; k < s.cmdCount && !c; k++) {
+    Command& q = s.cmdQueue[(s.cmdHead + k) % CMD_QUEUE_LEN];
+    if (q.reg == reg && q.write == write) c = &q;
+  }
+  if (!c && s.cmdCount < CMD_QUEUE_LEN) {
+    c = &s.cmdQueue[(s.cmdHead + s.cmdCount++) % CMD_QUEUE_LEN];
+    c->reg = reg;
+    c->write = write;
+  }
+  if (c) {
+    c->value = value;
+    c->received = millis();
+  } else {
+    queued = false;
+  }
+  portEXIT_CRITICAL(&cmdMux);
+
+  trace(queued ? TRACE_INFO : TRACE_ERROR, queued ? EV_CMD_QUEUED : EV_CMD_REJECTED, s.id, reg, value);
+  return queued;
+}
+
+// True while a command for 'reg' is queued or on the bus (network task)
+bool commandPending(const Slave& s, uint16_t reg) {
+  bool pending = false;
+  portENTER_CRITICAL(&cmdMux);
+  for (uint8_t k = 0; k < s.cmdCount && !pending; k++) {
+    pending = s.cmdQueue[(s.cmdHead + k) % CMD_QUEUE_LEN].reg == reg;
+  }
+  if (s.cmdPhase != CMD_IDLE && s.cmdActive.reg == reg) pending = true;
+  portEXIT_CRITICAL(&cmdMux);
+  return pending;
+}
+
+// Only a hint for the Modbus master, but cmdCount belongs to the other core
+bool commandWaiting() {
+  bool waiting = false;
+  portENTER_CRITICAL(&cmdMux);
+  for (int i = 0; i < NUM_SLAVES && !waiting; i++) {
+    waiting = slaves[i].cmdCount > 0 || slaves[i].cmdPhase != CMD_IDLE;
+  }
+  portEXIT_CRITICAL(&cmdMux);
+  return waiting;
+}
+
+bool cbCommandWrite(uint8_t result, uint16_t, void*) {
+  Slave& s = slaves[busSlave];
+  const Command& c = s.cmdActive;
+  unsigned long latency = millis() - c.received;
+
+  accountBusTime();
+  noteResult(s, result);
+  if (result == RTU_SUCCESS) s.stats.command.add(latency);
+  s.cmdLatencyMs = latency > 0xFFFF ? 0xFFFF : latency;
+  trace(result == RTU_SUCCESS ? TRACE_INFO : TRACE_ERROR, EV_CMD_WRITE, s.id, c.reg, c.value, result);
+
+  // Read back even after a failed write, so the published value is the real one
+  portENTER_CRITICAL(&cmdMux);
+  s.cmdPhase = CMD_READBACK;
+  portEXIT_CRITICAL(&cmdMux);
+  return true;
+}
+
+bool cbCommandReadback(uint8_t result, uint16_t, void*) {
+  Slave& s = slaves[busSlave];
+  const Command& c = s.cmdActive;
+
+  accountBusTime();
+  noteResult(s, result);
+  trace(result == RTU_SUCCESS ? TRACE_INFO : TRACE_ERROR, EV_CMD_DONE, s.id,
+        c.write ? s.cmdLatencyMs : 0, s.cmdReadback, result);
+  if (c.write && result == RTU_SUCCESS && s.cmdReadback != c.value) {
+    trace(TRACE_WARN, EV_CMD_MISMATCH, s.id, c.reg, c.value);
+  }
+  portENTER_CRITICAL(&cmdMux);
+  s.cmdPhase = CMD_IDLE;
+  portEXIT_CRITICAL(&cmdMux);
+
+  if (c.reg == FAN_MODE_REG) {
+    s.fanMode = (result == RTU_SUCCESS) ? s.cmdReadback : -1;
+    publishSnapshot(s, 0, true);
+  }
+  return true;
+}
+
+// Starts the next command transaction, called by serviceModbus() ahead of
+// the sweeps. A read-back follows its write at once; otherwise the slaves
+// take turns like in the sweeps. Returns false if no command is waiting.
+bool serviceCommands() {
+  int pick = -1;
+  portENTER_CRITICAL(&cmdMux);
+  for (int k = 0; k < NUM_SLAVES; k++) {
+    int i = (nextSlave + k) % NUM_SLAVES;
+    if (slaves[i].cmdPhase != CMD_IDLE) {
+      pick = i;
+      break;
+    }
+    if (pick < 0 && slaves[i].cmdCount > 0) pick = i;
+  }
+  if (pick >= 0 && slaves[pick].cmdPhase == CMD_IDLE) {
+    // Off the queue: a new command for the register now queues behind it
+    Slave& s = slaves[pick];
+    s.cmdActive = s.cmdQueue[s.cmdHead];
+    s.cmdHead = (s.cmdHead + 1) % CMD_QUEUE_LEN;
+    s.cmdCount--;
+    s.cmdPhase = s.cmdActive.write ? CMD_WRITE : CMD_READBACK;
+  }
+  portEXIT_CRITICAL(&cmdMux);
+  if (pick < 0) return false;
+
+  Slave& s = slaves[pick];
+  const Command& c = s.cmdActive;
+  bool started;
+  modbus.setTimeout(s.offline ? SLAVE_PROBE_TIMEOUT_MS : MODBUS_TIMEOUT_MS);
+  if (s.cmdPhase == CMD_READBACK) {
+    started = modbus.readHreg(s.id, c.reg, &s.cmdReadback, 1, cbCommandReadback);
+  } else {
+    started = modbus.writeHreg(s.id, c.reg, c.value, cbCommandWrite);
+  }
+  if (started) {
+    busRequestStart = millis();
+    busSlave = pick;
+    nextSlave = (pick + 1) % NUM_SLAVES;
+  }
+  return true;
+}
+
+// Console 0-3: fan mode of the selected slave(s)
+void writeFanMode(uint16_t mode) {
+  if (mode > 3) {
+    Serial.println("ERROR: Invalid fan mode. Use 0-3");
+    return;
+  }
+  
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (selectedSlave >= 0 && selectedSlave != i) continue;
+    queueCommand(slaves[i], FAN_MODE_REG, mode, true);
+  }
+}
+
+// =============== REGISTER HEALTH ===============
+// Every register on every slave has a circuit breaker. After
+// BREAKER_TRIP_AFTER failed reads in a row it opens: the register is left
+// out of the sweeps, no block bridges over it, and it is only probed on its
+// own, with a back-off that doubles per failed probe. One good answer closes
+// it again.
+//
+// Only a register read on its own is blamed. A block of several registers
+// that fails that often, or answers "illegal address" even once, may be
+// failing on a gap register it bridges: it is split in two instead, for
+// good, and the halves are read separately from the next sweep on. A few
+// splits isolate the register at fault, and the healthy ones never see
+// their breaker open.
+//
+// The response timeout is learned per register the way TCP does it: smoothed
+// response time + 4 * mean deviation, doubled after a timeout. A block waits
+// as long as its slowest register.
+
+// Faults of the register rather than of the line: exception responses, wrong
+// answers, and timeouts while the slave answers its other requests. CRC
+// errors and the timeouts of a slave that stopped answering do not count.
+bool registerFault(const Slave& s, uint8_t result) {
+  switch (result) {
+    case RTU_SUCCESS:
+    case RTU_INVALID_CRC:
+    case RTU_INVALID_SLAVE:
+      return false;
+    case RTU_TIMEOUT:
+      return s.timeoutStreak == 1 && !s.offline;
+    default:
+      return true;
+  }
+}
+
+// Opens or closes the breaker of point 'i' after a read of its block.
+// 'alone' = the block held only this register; if it did not, the breaker
+// stays closed and true is returned when it would have opened, so the
+// caller splits the block.
+bool noteBreaker(Slave& s, int i, uint8_t result, bool alone) {
+  PointHealth& h = s.health[i];
+
+  if (result == RTU_SUCCESS) {
+    h.failStreak = 0;
+    if (h.open) {
+      h.open = false;
+      h.backoff = 0;
+      trace(TRACE_WARN, EV_REG_CLOSED, s.id, pointTable[i].address);
+    }
+    return false;
+  }
+  if (!registerFault(s, result)) return false;
+
+  if (h.failStreak < 255) h.failStreak++;
+  if (h.open) {
+    if (h.backoff < 255) h.backoff++;         // Failed probe
+  } else if (!alone) {
+    return result == RTU_ILLEGAL_ADDRESS || h.failStreak >= BREAKER_TRIP_AFTER;
+  } else if (h.failStreak < BREAKER_TRIP_AFTER) {
+    return false;
+  }
+
+  unsigned long wait = BREAKER_RETRY_MS;
+  for (uint8_t b = 0; b < h.backoff && wait < BREAKER_MAX_RETRY_MS; b++) wait *= 2;
+  if (wait > BREAKER_MAX_RETRY_MS) wait = BREAKER_MAX_RETRY_MS;
+
+  h.open = true;
+  h.retryAt = millis() + wait;
+  trace(TRACE_WARN, EV_REG_OPEN, s.id, pointTable[i].address, wait / 1000, result);
+  return false;
+}
+
+// Splits a block that keeps failing in two and starts the fail counts of
+// its points over. The cut goes after the widest gap it bridges - the
+// likeliest culprit - or, without gaps, before the middle point. Blocks
+// start and end at a point, so one of several registers holds at least
+// two, and every cut is a different point: the table never fills.
+void splitBlock(Slave& s, const ReadSpan& span) {
+  uint16_t inside[NUM_POINTS];
+  uint8_t n = 0;
+  for (int i = 0; i < NUM_POINTS; i++) {
+    uint16_t a = pointTable[i].address;
+    if (a < span.start || a >= span.start + span.count) continue;
+    s.health[i].failStreak = 0;
+    uint8_t j = n++;
+    while (j > 0 && inside[j - 1] > a) {
+      inside[j] = inside[j - 1];
+      j--;
+    }
+    inside[j] = a;
+  }
+  if (n < 2 || s.numCuts >= NUM_POINTS) return;
+
+  uint8_t cut = n / 2;
+  uint16_t widest = 1;
+  for (uint8_t j = 1; j < n; j++) {
+    if (inside[j] - inside[j - 1] > widest) {
+      widest = inside[j] - inside[j - 1];
+      cut = j;
+    }
+  }
+  s.cuts[s.numCuts++] = inside[cut];
+  trace(TRACE_WARN, EV_BLOCK_SPLIT, s.id, span.start, inside[cut]);
+}
+
+// Learns the response time of point 'i' from the answer to its block
+void noteResponseTime(PointHealth& h, uint8_t result) {
+  if (result == RTU_TIMEOUT) {
+    uint32_t t = h.timeoutMs ? 2UL * h.timeoutMs : MODBUS_TIMEOUT_MS;
+    h.timeoutMs = t > MODBUS_TIMEOUT_MS ? MODBUS_TIMEOUT_MS : t;
+    return;
+  }
+
+  uint32_t ms = (modbus.lastLatencyUs() + 500) / 1000;
+  if (ms == 0) ms = 1;
+  if (ms > 0xFFFF) ms = 0xFFFF;
+  if (h.srttMs == 0) {
+    h.srttMs = ms;
+    h.rttvarMs = ms / 2;
+  } else {
+    uint32_t err = ms > h.srttMs ? ms - h.srttMs : h.srttMs - ms;
+    h.rttvarMs = (3UL * h.rttvarMs + err) / 4;
+    h.srttMs = (7UL * h.srttMs + ms) / 8;
+  }
+
+  uint32_t t = h.srttMs + 4UL * h.rttvarMs;
+  if (t < MODBUS_MIN_TIMEOUT_MS) t = MODBUS_MIN_TIMEOUT_MS;
+  if (t > MODBUS_TIMEOUT_MS) t = MODBUS_TIMEOUT_MS;
+  h.timeoutMs = t;
+}
+
+// Response timeout for a block: the longest of its registers. A probe of a
+// register with an open breaker only has to show that it answers at all.
+uint16_t spanTimeout(const Slave& s, const ReadSpan& span) {
+  if (s.offline) return SLAVE_PROBE_TIMEOUT_MS;
+
+  uint16_t timeout = MODBUS_MIN_TIMEOUT_MS;
+  for (int i = 0; i < NUM_POINTS; i++) {
+    uint16_t a = pointTable[i].address;
+    if (a < span.start || a >= span.start + span.count) continue;
+    const PointHealth& h = s.health[i];
+    uint16_t t = h.open ? SLAVE_PROBE_TIMEOUT_MS : (h.timeoutMs ? h.timeoutMs : MODBUS_TIMEOUT_MS);
+    if (t > timeout) timeout = t;
+  }
+  return timeout;
+}
+
+// =============== READ PLAN ===============
+// Highest priority among the registers of 'mask' inside the block
+uint8_t spanPriority(const ReadSpan& span, uint8_t mask) {
+  uint8_t best = 0;
+  for (int i = 0; i < NUM_POINTS; i++) {
+    const PointDef& p = pointTable[i];
+    if (!(mask & (1 << p.pollClass))) continue;
+    if (p.address >= span.start && p.address < span.start + span.count &&
+        pollClasses[p.pollClass].priority > best) {
+      best = pollClasses[p.pollClass].priority;
+    }
+  }
+  return best;
+}
+
+// Packs the registers of the poll classes in 'mask' into as few block reads
+// as possible, highest priority block first. Registers of other classes that
+// fall inside a block come along for free. With a slave given, registers
+// with an open breaker are left out, and those due for a probe are read
+// alone after the other blocks. Returns the registers asked for.
+uint8_t buildSweepPlan(ReadPlan& plan, uint16_t* regs, uint8_t mask, const Slave* s = nullptr) {
+  uint16_t addrs[NUM_POINTS];
+  uint16_t avoid[NUM_POINTS];
+  uint16_t probes[NUM_POINTS];
+  uint8_t n = 0;
+  uint8_t numAvoid = 0;
+  uint8_t numProbes = 0;
+
+  for (int i = 0; i < NUM_POINTS; i++) {
+    const PointDef& p = pointTable[i];
+    bool wanted = mask & (1 << p.pollClass);
+    if (s && s->health[i].open) {
+      avoid[numAvoid++] = p.address;
+      if (wanted && (long)(millis() - s->health[i].retryAt) >= 0) probes[numProbes++] = p.address;
+    } else if (wanted) {
+      addrs[n++] = p.address;
+    }
+  }
+
+  plan.numSpans = 0;
+  plan.totalRegs = 0;
+  plan.values = regs;
+  if (n > 0 && buildReadPlan(plan, addrs, n, regs, READ_PLAN_MAX_REGS, READ_GAP_TOLERANCE,
+                             rs485Link.maxBlockRegs, avoid, numAvoid,
+                             s ? s->cuts : nullptr, s ? s->numCuts : 0) == 0) {
+    plan.numSpans = 0;
+    return 0;
+  }
+
+  // Insertion sort on priority; the offsets stay valid because each block keeps its own
+  uint8_t prio[READ_PLAN_MAX_SPANS];
+  for (uint8_t b = 0; b < plan.numSpans; b++) prio[b] = spanPriority(plan.spans[b], mask);
+  for (uint8_t b = 1; b < plan.numSpans; b++) {
+    ReadSpan span = plan.spans[b];
+    uint8_t p = prio[b];
+    int j = b - 1;
+    while (j >= 0 && prio[j] < p) {
+      plan.spans[j + 1] = plan.spans[j];
+      prio[j + 1] = prio[j];
+      j--;
+    }
+    plan.spans[j + 1] = span;
+    prio[j + 1] = p;
+  }
+
+  for (uint8_t k = 0; k < numProbes; k++) {
+    if (!planAppendSpan(plan, probes[k], 1, READ_PLAN_MAX_REGS)) break;
+    n++;
+  }
+  return n;
+}
+
+// Shows what each poll class costs on the bus
+void setupReadPlan() {
+  ReadPlan plan;
+  uint16_t regs[READ_PLAN_MAX_REGS];
+  if (buildSweepPlan(plan, regs, POLL_ALL) == 0) {
+    Serial.println("✗ ERROR: Register map does not fit the read plan");
+    return;
+  }
+
+  numImageRegs = 0;
+
+  for (uint8_t c = 0; c < NUM_POLL_CLASSES; c++) {
+    uint8_t count = buildSweepPlan(plan, regs, 1 << c);
+    Serial.printf("✓ Poll class %-6s (every %lus): %u registers in %u block reads\n",
+                  pollClasses[c].name, pollPeriod(c) / 1000, count, plan.numSpans);
+    for (uint8_t b = 0; b < plan.numSpans; b++) {
+      Serial.printf("  Block %u: Reg %u-%u (%u regs)\n", b,
+                    plan.spans[b].start,
+                    plan.spans[b].start + plan.spans[b].count - 1,
+                    plan.spans[b].count);
+      for (uint16_t k = 0; k < plan.spans[b].count; k++) {
+        uint16_t a = plan.spans[b].start + k;
+        if (imageIndex(a) < 0 && numImageRegs < IMAGE_MAX_REGS) imageAddr[numImageRegs++] = a;
+      }
+    }
+  }
+  Serial.printf("✓ Register image: %u registers\n", numImageRegs);
+}
+
+// =============== SLAVES ===============
+void setupSlaves() {
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    Slave& s = slaves[i];
+    memset(&s, 0, sizeof(s));
+    s.id = slaveConfigs[i].id;
+    s.deviceId = slaveConfigs[i].deviceId;
+    resetWindow(s);
+    spbInit(s.batch, s.batchBuf, sizeof(s.batchBuf));
+    s.fanMode = -1;
+    s.pollBoost = 1;
+    queueCommand(s, FAN_MODE_REG, 0, false);     // Learn the fan mode for the DBIRTH
+    publishSnapshot(s, 0, false);
+    s.viewSeq = handoff[i].snapshot.read(s.view);
+  }
+  Serial.printf("✓ %d slave(s) on the bus\n", NUM_SLAVES);
+}
+
+// Adds the request that just finished (incl. the turnaround) to the bus load
+void accountBusTime() {
+  busBusyMs += millis() - busRequestStart + rs485Link.turnaroundMs;
+}
+
+void updateBusLoad() {
+  unsigned long elapsed = millis() - busWindowStart;
+  if (elapsed < BUS_LOAD_WINDOW_MS) return;
+  unsigned long pct = busBusyMs * 100 / elapsed;
+  busLoadPct = pct > 100 ? 100 : pct;
+  busBusyMs = 0;
+  busWindowStart = millis();
+}
+
+// Poll classes of 's' that are due now. Over the bus budget only the
+// highest priority due class goes, unless a class is a full period late.
+uint8_t dueClasses(const Slave& s) {
+  unsigned long now = millis();
+  uint8_t mask = 0;
+  uint8_t top = 0;
+
+  for (uint8_t c = 0; c < NUM_POLL_CLASSES; c++) {
+    if ((long)(now - s.classDue[c]) < 0) continue;
+    mask |= 1 << c;
+    if (pollClasses[c].priority > top) top = pollClasses[c].priority;
+  }
+  if (mask == 0 || busLoadPct <= BUS_BUDGET_PCT) return mask;
+
+  for (uint8_t c = 0; c < NUM_POLL_CLASSES; c++) {
+    if ((mask & (1 << c)) && pollClasses[c].priority < top &&
+        now - s.classDue[c] < pollPeriod(c, s.pollBoost)) {
+      mask &= ~(1 << c);
+    }
+  }
+  return mask;
+}
+
+// Counts the result in the bus statistics and tracks timeouts per slave.
+// Any answer, even an exception or a bad CRC, proves the slave is alive.
+void noteResult(Slave& s, uint8_t result) {
+  BusStats& st = s.stats;
+  st.requests++;
+  if (st.lastFailed) st.retries++;
+  st.lastFailed = (result != RTU_SUCCESS);
+  switch (result) {
+    case RTU_SUCCESS:        break;
+    case RTU_TIMEOUT:        st.timeouts++; break;
+    case RTU_INVALID_CRC:    st.crcErrors++; break;
+    case RTU_ILLEGAL_FUNCTION:
+    case RTU_ILLEGAL_ADDRESS:
+    case RTU_ILLEGAL_VALUE:
+    case RTU_SLAVE_FAILURE:  st.exceptions++; break;
+    default:                 st.otherErrors++; break;
+  }
+  if (result != RTU_TIMEOUT) st.latency.add((modbus.lastLatencyUs() + 500) / 1000);
+
+  if (result != RTU_TIMEOUT) {
+    s.timeoutStreak = 0;
+    if (s.offline) {
+      s.offline = false;
+      trace(TRACE_WARN, EV_SLAVE_BACK, s.id);
+      publishSnapshot(s, 0, false);
+    }
+    return;
+  }
+
+  if (s.timeoutStreak < 255) s.timeoutStreak++;
+  if (s.offline) {
+    s.nextProbe = millis() + SLAVE_PROBE_INTERVAL_MS;
+  } else if (s.timeoutStreak >= SLAVE_OFFLINE_AFTER) {
+    s.offline = true;
+    s.nextProbe = millis() + SLAVE_PROBE_INTERVAL_MS;
+    trace(TRACE_ERROR, EV_SLAVE_OFFLINE, s.id, 0, s.timeoutStreak);
+    publishSnapshot(s, 0, false);     // The network task sends the DDEATH
+  }
+}
+
+// =============== ADAPTIVE POLL RATE ===============
+// Starting up (1-4) and stopping (10, 11): fans ramp, pressures and flows follow
+bool transitionalRunMode(uint16_t mode) {
+  return (mode >= 1 && mode <= 4) || mode == 10 || mode == 11;
+}
+
+// True if point 'i' of an adaptive class moved more than POLL_DELTA_DEADBANDS
+// deadbands per steady period since its last read. Must be called before
+// pointTime[i] is updated. A stopped unit is left to the run mode: its
+// pressures and flows are noise around zero, where a % deadband is nothing.
+bool movedFast(const Slave& s, int i, float value, float previous) {
+  const PointDef& p = pointTable[i];
+  if (!pollClasses[p.pollClass].adaptive || s.pointTime[i] == 0 || s.data.runMode == 0) return false;
+
+  float deadband = p.deadbandType == DEADBAND_PCT ? fabsf(previous) * p.deadband / 100.0f : p.deadband;
+  if (deadband <= 0.0f) return false;
+  unsigned long elapsed = millis() - s.pointTime[i];
+  if (elapsed == 0) return false;
+
+  float limit = POLL_DELTA_DEADBANDS * deadband * elapsed / pollPeriod(p.pollClass);
+  if (limit < POLL_DELTA_MIN_DEADBANDS * deadband) limit = POLL_DELTA_MIN_DEADBANDS * deadband;
+  return fabsf(value - previous) > limit;
+}
+
+// The highest divisor that keeps the bus within budget, if the load of the
+// last window scales with the rate. Only estimated from a window that was
+// measured at the current rate.
+uint8_t boostWithinBudget(const Slave& s) {
+  if (s.pollBoost > 1 && millis() - s.boostRaised < 2 * BUS_LOAD_WINDOW_MS) return s.pollBoost;
+  uint8_t boost = s.pollBoost;
+  while (boost < POLL_BOOST_MAX && (unsigned)busLoadPct * boost * 2 <= (unsigned)BUS_BUDGET_PCT * s.pollBoost) {
+    boost *= 2;
+  }
+  return boost;
+}
+
+// Raises the rate of 's' as far as the budget allows and pulls its due
+// times in. Over the budget the transient is ignored, so the rate decays.
+// 'reg' is the register that moved, 0xFFFF for the run mode (trace only).
+void noteTransient(Slave& s, uint16_t reg) {
+  if (busLoadPct > BUS_BUDGET_PCT) return;
+  s.boostSince = millis();
+  uint8_t boost = boostWithinBudget(s);
+  if (boost <= s.pollBoost) return;
+
+  s.pollBoost = boost;
+  s.boostRaised = millis();
+  trace(TRACE_INFO, EV_POLL_BOOST, s.id, reg, s.pollBoost);
+  for (uint8_t c = 0; c < NUM_POLL_CLASSES; c++) {
+    unsigned long due = millis() + pollPeriod(c, s.pollBoost);
+    if ((long)(s.classDue[c] - due) > 0) s.classDue[c] = due;
+  }
+}
+
+// Halves the rate after POLL_BOOST_HOLD_MS without a transient, and once
+// per bus load window while the bus is over budget
+void decayPollRate(Slave& s) {
+  if (s.pollBoost <= 1) return;
+  bool over = busLoadPct > BUS_BUDGET_PCT;
+  if (millis() - s.boostSince < (over ? BUS_LOAD_WINDOW_MS : POLL_BOOST_HOLD_MS)) return;
+  s.pollBoost /= 2;
+  s.boostSince = millis();
+  trace(over ? TRACE_WARN : TRACE_INFO, EV_POLL_DECAY, s.id, 0, s.pollBoost, busLoadPct.load());
+}
+
+// =============== DECODE ===============
+// Scales register 'i' of the point table from a finished block into the
+// slave's data. Sample-only sweeps come every second, so their good reads
+// are not traced - they would push everything else out of the ring.
+bool decodePoint(Slave& s, int i) {
+  const PointDef& p = pointTable[i];
+  uint16_t raw;
+
+  if (!planLookup(s.plan, p.address, &raw)) {
+    trace(TRACE_DEBUG, EV_REG_ERROR, s.id, p.address, 0, planResult(s.plan, p.address));
+    if (s.regErrors[i] < 0xFFFF) s.regErrors[i]++;
+    return false;
+  }
+  if (!sampleOnly(s.sweepClasses)) trace(TRACE_DEBUG, EV_REG_OK, s.id, p.address, raw);
+
+  float value;
+  float previous;
+  if (p.dataType == FLOAT) {
+    value = raw / p.scale;
+    previous = *dataFloat(s.data, p.offset);
+    *dataFloat(s.data, p.offset) = value;
+  } else {
+    value = raw;
+    previous = *dataUInt16(s.data, p.offset);
+    *dataUInt16(s.data, p.offset) = raw;
+  }
+  if (p.offset == offsetof(SensorData, runMode) && transitionalRunMode(raw)) {
+    noteTransient(s, 0xFFFF);
+  } else if (movedFast(s, i, value, previous)) {
+    noteTransient(s, p.address);
+  }
+  if (p.window) windowAdd(s.window[i], value);
+  s.pointTime[i] = millis();
+  return true;
+}
+
+// =============== POLL ENGINE ===============
+// Keeps the raw registers of a good block in the slave's register image
+void imageStore(Slave& s, const ReadSpan& span) {
+  unsigned long now = millis();
+  for (uint16_t k = 0; k < span.count; k++) {
+    int j = imageIndex(span.start + k);
+    if (j < 0) continue;
+    s.image.value[j] = s.plan.values[span.offset + k];
+    s.image.readAt[j] = now;
+    s.image.valid[j] = true;
+  }
+}
+
+// Decodes every register that lives in block 'b' into the slave's data
+void decodeSpan(Slave& s, uint8_t b) {
+  const ReadSpan& span = s.plan.spans[b];
+  uint16_t first = span.start;
+  uint16_t last = span.start + span.count - 1;
+
+  uint8_t result = s.plan.spanResult[b];
+  trace(result == RTU_SUCCESS ? TRACE_INFO : TRACE_WARN, EV_BLOCK, s.id, first, span.count, result);
+  if (result == RTU_SUCCESS) imageStore(s, span);
+
+  bool split = false;
+  for (int i = 0; i < NUM_POINTS; i++) {
+    uint16_t a = pointTable[i].address;
+    if (a < first || a > last) continue;
+    noteResponseTime(s.health[i], result);
+    if (noteBreaker(s, i, result, span.count == 1)) split = true;
+    if (decodePoint(s, i)) s.sweepSuccess++;
+  }
+  if (split) splitBlock(s, span);
+}
+
+void finishSweep(Slave& s) {
+  s.data.successfulReads = s.sweepSuccess;
+  s.data.dataValid = (s.sweepSuccess > 0);
+  s.sweepActive = false;
+
+  unsigned long duration = millis() - s.sweepStartTime;
+  bool samples = sampleOnly(s.sweepClasses);
+  if (!samples) s.stats.sweep.add(duration);
+  trace(samples ? TRACE_DEBUG : TRACE_INFO, EV_SWEEP_DONE, s.id,
+        duration > 0xFFFF ? 0xFFFF : duration, s.sweepSuccess, s.sweepRegs);
+  decayPollRate(s);
+  publishSnapshot(s, s.sweepClasses, false);
+}
+
+bool cbSpanRead(uint8_t result, uint16_t, void*) {
+  Slave& s = slaves[busSlave];
+  s.plan.spanResult[s.sweepSpan] = result;
+  accountBusTime();
+  noteResult(s, result);
+  decodeSpan(s, s.sweepSpan);
+  s.sweepSpan++;
+
+  // No point asking an offline slave for the rest of the blocks
+  if (s.offline || s.sweepSpan >= s.plan.numSpans) finishSweep(s);
+  return true;
+}
+
+// Reads the poll classes in 'classes' (mask) and schedules their next turn
+void startSweep(Slave& s, uint8_t classes) {
+  if (s.sweepActive) {
+    trace(TRACE_WARN, EV_SWEEP_BUSY, s.id);
+    return;
+  }
+
+  // An offline slave is only swept when its next probe is due
+  if (s.offline && (long)(millis() - s.nextProbe) < 0) return;
+
+  // Scheduled even when every register of a class has an open breaker
+  for (uint8_t c = 0; c < NUM_POLL_CLASSES; c++) {
+    if (classes & (1 << c)) s.classDue[c] = millis() + pollPeriod(c, s.pollBoost);
+  }
+
+  s.sweepRegs = buildSweepPlan(s.plan, s.regs, classes, &s);
+  if (s.sweepRegs == 0) return;
+
+  s.sweepActive = true;
+  s.sweepClasses = classes;
+  s.sweepSpan = 0;
+  s.sweepSuccess = 0;
+  s.sweepStartTime = millis();
+  trace(TRACE_DEBUG, EV_SWEEP_START, s.id, 0, classes);
+
+  // Reset data structure
+  s.data.timestamp = s.sweepStartTime;
+  s.data.successfulReads = 0;
+  s.data.dataValid = false;
+  for (uint8_t b = 0; b < s.plan.numSpans; b++) {
+    s.plan.spanResult[b] = READ_PLAN_NOT_READ;
+  }
+}
+
+// Console 'r': asks the poll engine for a full sweep of one slave (index) or
+// all (-1); they run interleaved on the bus
+void startSweeps(int8_t target) {
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (target >= 0 && target != i) continue;
+    handoff[i].sweepRequested.store(true);
+  }
+}
+
+bool sweepInProgress() {
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (slaves[i].sweepActive) return true;
+  }
+  return false;
+}
+
+// Starts the next transaction when the bus is free. Never blocks.
+// Slaves take turns one request at a time, so a slow or dead slave
+// delays the others by at most one (probe) timeout per round.
+void serviceModbus() {
+  if (commandWaiting()) modbus.expedite();
+  modbus.task();
+  updateBusLoad();
+  if (modbus.busy()) return;
+
+  // Commands go in between two sweep reads
+  if (serviceCommands()) return;
+
+  for (int k = 0; k < NUM_SLAVES; k++) {
+    int i = (nextSlave + k) % NUM_SLAVES;
+    Slave& s = slaves[i];
+    if (!s.sweepActive) continue;
+
+    const ReadSpan& span = s.plan.spans[s.sweepSpan];
+    modbus.setTimeout(spanTimeout(s, span));
+    if (modbus.readIreg(s.id, span.start, &s.plan.values[span.offset], span.count, cbSpanRead)) {
+      busRequestStart = millis();
+      busSlave = i;
+      nextSlave = (i + 1) % NUM_SLAVES;
+    }
+    return;
+  }
 }
 
-// ================ SPARKPLUG B: DATA PUBLISH ================
-void publishSparkplugData() {
-  if (!currentData.dataValid) {
-    Serial.println("[MQTT] ✗ Data not valid, skipping publish");
-    return;
+// =============== COMMISSIONING ===============
+// Finds the fastest setting the slaves and the wiring handle, one step at a
+// time and without blocking, while the sweeps wait:
+//  0. Baseline: which slaves answer on the current setting. A new setting
+//     must reach every one of them, or a unit at the far end of a marginal
+//     cable would be dropped for a faster bus.
+//  1. Link: every baud rate and format, fastest first. A setting passes when
+//     at least one slave and all the baseline slaves answer, and
+//     COMMISSION_REQUESTS reads to the slaves that answered all succeed. The
+//     first that passes is kept.
+//  2. Gap: the turnaround is shortened step by step until a step has an error;
+//     the shortest that passed is kept.
+//  3. Block: binary search for the largest block read the slaves accept, up
+//     to the largest block the read plans need.
+// The result goes to NVS. If no setting passes, the previous one is kept.
+#define COMM_IDLE  0
+#define COMM_LINK  1
+#define COMM_GAP   2
+#define COMM_BLOCK 3
+#define COMM_BASELINE 4
+
+struct Commissioning {
+  uint8_t phase;
+  uint8_t step;                     // Link: baud * formats + format, gap: LINK_GAPS_MS index
+  uint16_t sent;                    // Reads sent for the setting being tested
+  bool failed;                      // One of them failed
+  bool present[NUM_SLAVES];         // Answered on this link setting
+  uint8_t numPresent;
+  bool required[NUM_SLAVES];        // Answered on the setting before commissioning
+  uint8_t numRequired;
+  uint8_t asked;                    // Slave of the read on the bus
+  uint8_t next;                     // Round robin over the present slaves
+  uint16_t blockStart;              // Largest block of a full sweep
+  uint16_t blockRegs;
+  uint16_t blockLo;                 // Largest size that passed
+  uint16_t blockHi;                 // Largest size not ruled out
+  LinkConfig before;
+  uint16_t values[RTU_MAX_READ_REGS];
+};
+
+Commissioning comm;
+
+const char* linkFormatName(uint32_t format) {
+  for (uint8_t f = 0; f < NUM_LINK_FORMATS; f++) {
+    if (LINK_FORMATS[f] == format) return LINK_FORMAT_NAMES[f];
   }
-  
-  String topic = String("spBv1.0/") + group_id + "/DDATA/" + edge_node_id + "/" + device_id;
-  
-  DynamicJsonDocument doc(2048);
-  doc["timestamp"] = currentData.timestamp;
-  static uint32_t seqNum = 2;
-  doc["seq"] = seqNum++;
-  
-  JsonArray metrics = doc.createNestedArray("metrics");
-  
-  // System Status
-  addMetric(metrics, "HeatExchangerEfficiency", currentData.heatExchangerEfficiency, FLOAT, currentData.timestamp);
-  addMetric(metrics, "RunMode", currentData.runMode, UINT16, currentData.timestamp);
-  
-  // Temperatures
-  addMetric(metrics, "OutdoorTemp", currentData.outdoorTemp, FLOAT, currentData.timestamp);
-  addMetric(metrics, "SupplyAirTemp", currentData.supplyAirTemp, FLOAT, currentData.timestamp);
-  addMetric(metrics, "SupplyAirSetpointTemp", currentData.supplyAirSetpointTemp, FLOAT, currentData.timestamp);
-  addMetric(metrics, "ExhaustAirTemp", currentData.exhaustAirTemp, FLOAT, currentData.timestamp);
-  addMetric(metrics, "ExtractAirTemp", currentData.extractAirTemp, FLOAT, currentData.timestamp);
-  
-  // Pressures
-  addMetric(metrics, "SupplyAirPressure", currentData.supplyAirPressure, FLOAT, currentData.timestamp);
-  addMetric(metrics, "ExtractAirPressure", currentData.extractAirPressure, FLOAT, currentData.timestamp);
-  
-  // Air Flows
-  addMetric(metrics, "SupplyAirFlow", currentData.supplyAirFlow, FLOAT, currentData.timestamp);
-  addMetric(metrics, "ExtractAirFlow", currentData.extractAirFlow, FLOAT, currentData.timestamp);
-  addMetric(metrics, "ExtraSupplyAirFlow", currentData.extraSupplyAirFlow, FLOAT, currentData.timestamp);
-  addMetric(metrics, "ExtraExtractAirFlow", currentData.extraExtractAirFlow, FLOAT, currentData.timestamp);
-  
-  // Runtime
-  addMetric(metrics, "SupplyFanRuntime", currentData.supplyFanRuntime, UINT16, currentData.timestamp);
-  addMetric(metrics, "ExtractFanRuntime", currentData.extractFanRuntime, UINT16, currentData.timestamp);
-  
-  String payload;
-  serializeJson(doc, payload);
-  
-  bool success = mqttClient.publish(topic.c_str(), payload.c_str());
-  
-  if (success) {
-    Serial.printf("[MQTT] ✓ Data published (%d bytes, %d metrics)\n", payload.length(), 15);
-  } else {
-    Serial.println("[MQTT] ✗ Publish failed");
+  return "?";
+}
+
+uint8_t linkFormatIndex(uint32_t format) {
+  for (uint8_t f = 0; f < NUM_LINK_FORMATS; f++) {
+    if (LINK_FORMATS[f] == format) return f;
   }
+  return 0;
 }
 
-void setup() {
-  pinMode(MAX485_RE_NEG, OUTPUT);
-  pinMode(MAX485_DE, OUTPUT);
-  digitalWrite(MAX485_RE_NEG, LOW);
-  digitalWrite(MAX485_DE, LOW);
+// The stored setting, if there is a valid one. Called by setup() before the UART starts.
+bool loadLinkConfig() {
+  Preferences prefs;
+  if (!prefs.begin(LINK_PREFS_NAMESPACE, true)) return false;
+  LinkConfig l;
+  l.baud = prefs.getUInt("baud", 0);
+  l.format = prefs.getUInt("format", SERIAL_8N1);
+  l.turnaroundMs = prefs.getUShort("gap", MODBUS_TURNAROUND_MS);
+  l.maxBlockRegs = prefs.getUShort("block", READ_PLAN_MAX_REGS);
+  prefs.end();
 
-  Serial.begin(115200);
-  Serial.println("\n===========================================");
-  Serial.println("ESP32 Modbus RTU + MQTT Sparkplug B");
-  Serial.println("===========================================\n");
+  bool valid = false;
+  for (uint8_t b = 0; b < NUM_LINK_BAUDS; b++) {
+    if (LINK_BAUDS[b] == l.baud) valid = true;
+  }
+  if (!valid || linkFormatName(l.format)[0] == '?' || l.maxBlockRegs == 0 ||
+      l.maxBlockRegs > READ_PLAN_MAX_REGS) {
+    return false;
+  }
+  rs485Link = l;
+  return true;
+}
 
-  // Modbus Setup
-  Serial2.begin(BAUD_RATE, SERIAL_8N1, RX_PIN, TX_PIN);
-  modbus.begin(MODBUS_SLAVE_ID, Serial2);
-  modbus.preTransmission(preTransmission);
-  modbus.postTransmission(postTransmission);
-  Serial.println("✓ Modbus RTU Initialized\n");
+void saveLinkConfig() {
+  Preferences prefs;
+  if (!prefs.begin(LINK_PREFS_NAMESPACE, false)) return;
+  prefs.putUInt("baud", rs485Link.baud);
+  prefs.putUInt("format", rs485Link.format);
+  prefs.putUShort("gap", rs485Link.turnaroundMs);
+  prefs.putUShort("block", rs485Link.maxBlockRegs);
+  prefs.end();
+}
 
-  // WiFi & MQTT Setup
-  setupWiFi();
-  mqttClient.setServer(mqtt_server, mqtt_port);
-  mqttClient.setBufferSize(2048);
-  
-  if (WiFi.status() == WL_CONNECTED) {
-    reconnectMQTT();
-  }
+// Puts rs485Link on the UART and the master
+void applyLink() {
+  Serial2.begin(rs485Link.baud, rs485Link.format, RX_PIN, TX_PIN);
+  modbus.setBaud(rs485Link.baud);
+  modbus.setTurnaround(rs485Link.turnaroundMs);
+}
 
-  printMenu();
+// Starts testing the setting now in rs485Link
+void beginCandidate() {
+  comm.sent = 0;
+  comm.failed = false;
+  applyLink();
 }
 
-// =============== CLI MENU ===============
-void printMenu() {
-  Serial.println("\n========== MENU ==========");
-  Serial.println("Fan Mode Control:");
-  Serial.println("  0 = Off");
-  Serial.println("  1 = Manual Reduced");
-  Serial.println("  2 = Manual Normal");
-  Serial.println("  3 = Auto Speed");
-  Serial.println("\nCommands:");
-  Serial.println("  r = Read all sensors now");
-  Serial.println("  a = Toggle auto-read ON/OFF");
-  Serial.println("  i = Set auto-read interval");
-  Serial.println("  m = Show menu");
-  Serial.printf("\nAuto-read: %s (every %lu sec)\n", 
-                autoReadEnabled ? "ON" : "OFF", 
-                autoReadInterval / 1000);
-  Serial.printf("WiFi: %s | MQTT: %s\n",
-                WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected",
-                mqttClient.connected() ? "Connected" : "Disconnected");
-  Serial.println("==========================\n");
+void beginLinkCandidate() {
+  rs485Link.baud = LINK_BAUDS[comm.step / NUM_LINK_FORMATS];
+  rs485Link.format = LINK_FORMATS[comm.step % NUM_LINK_FORMATS];
+  memset(comm.present, 0, sizeof(comm.present));
+  comm.numPresent = 0;
+  beginCandidate();
 }
 
-// =============== WRITE FAN MODE ===============
-void writeFanMode(uint16_t mode) {
-  if (mode > 3) {
-    Serial.println("ERROR: Invalid fan mode. Use 0-3");
-    return;
+// Sweeps in progress are abandoned; the poll classes just come due again after
+void startCommissioning() {
+  for (int i = 0; i < NUM_SLAVES; i++) slaves[i].sweepActive = false;
+  memset(&comm, 0, sizeof(comm));
+  comm.before = rs485Link;
+  comm.phase = COMM_BASELINE;
+  beginCandidate();
+}
+
+// Baseline done: the slaves that answered are required on every candidate
+void beginLinkPhase() {
+  memcpy(comm.required, comm.present, sizeof(comm.required));
+  comm.numRequired = comm.numPresent;
+  trace(TRACE_WARN, EV_LINK_START, 0, 0, 0, comm.numRequired);
+  rs485Link.turnaroundMs = MODBUS_TURNAROUND_MS;
+  rs485Link.maxBlockRegs = READ_PLAN_MAX_REGS;
+  comm.phase = COMM_LINK;
+  comm.step = 0;
+  beginLinkCandidate();
+}
+
+// True once the first round of a link candidate found a slave missing that
+// answered on the old setting, or none at all
+bool linkLosesSlaves() {
+  if (comm.numPresent == 0) return true;
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (comm.required[i] && !comm.present[i]) return true;
   }
-  
-  unsigned long startTime = millis();
-  uint8_t result = modbus.writeSingleRegister(367, mode);
-  unsigned long duration = millis() - startTime;
+  return false;
+}
 
-  if (result == modbus.ku8MBSuccess) {
-    Serial.printf("✓ FanMode set to %u in %lums\n", mode, duration);
+void finishCommissioning(bool ok) {
+  if (ok) {
+    saveLinkConfig();
+    trace(TRACE_WARN, EV_LINK_DONE, 0, rs485Link.baud / 100, rs485Link.turnaroundMs,
+          linkFormatIndex(rs485Link.format));
   } else {
-    Serial.printf("✗ ERROR writing FanMode (code %u). Time=%lums\n", result, duration);
+    rs485Link = comm.before;
+    trace(TRACE_ERROR, EV_LINK_FAILED, 0);
+  }
+  applyLink();
+  comm.phase = COMM_IDLE;
+
+  // Slaves that were unreachable on the old setting get their probe now, and
+  // the response times learned on it no longer apply
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    Slave& s = slaves[i];
+    s.timeoutStreak = 0;
+    s.nextProbe = millis();
+    for (int p = 0; p < NUM_POINTS; p++) {
+      s.health[p].srttMs = 0;
+      s.health[p].rttvarMs = 0;
+      s.health[p].timeoutMs = 0;
+    }
+    if (s.fanMode < 0) queueCommand(s, FAN_MODE_REG, 0, false);
   }
 }
 
-// =============== READ EFFICIENCY ===============
-bool readEfficiency() {
-  uint8_t result = modbus.readInputRegisters(1, 1);
-  
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
-    float efficiency = rawValue / 10.0f;
-    currentData.heatExchangerEfficiency = efficiency;
-    Serial.printf("  %-25s [Reg   1]: %5u (%.1f %%)\n",
-                  "Heat Exchanger Efficiency", rawValue, efficiency);
-    return true;
-  } else {
-    Serial.printf("  %-25s [Reg   1]: ERROR (code %u)\n",
-                  "Heat Exchanger Efficiency", result);
-    return false;
+// Largest block of a full sweep, the biggest read the poll engine will ask for
+void beginBlockPhase() {
+  ReadPlan plan;
+  uint16_t regs[READ_PLAN_MAX_REGS];
+  comm.blockRegs = 0;
+  buildSweepPlan(plan, regs, POLL_ALL);
+  for (uint8_t b = 0; b < plan.numSpans; b++) {
+    if (plan.spans[b].count <= comm.blockRegs) continue;
+    comm.blockStart = plan.spans[b].start;
+    comm.blockRegs = plan.spans[b].count;
   }
+  if (comm.blockRegs == 0) {
+    finishCommissioning(true);
+    return;
+  }
+  comm.phase = COMM_BLOCK;
+  comm.blockLo = 0;
+  comm.blockHi = comm.blockRegs;
+  beginCandidate();
 }
 
-// =============== READ RUN MODE ===============
-bool readRunMode() {
-  uint8_t result = modbus.readInputRegisters(2, 1);
-  
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
-    currentData.runMode = rawValue;
-    
-    const char* modeText;
-    switch(rawValue) {
-      case 0:  modeText = "Stopped"; break;
-      case 1:  modeText = "Starting up"; break;
-      case 2:  modeText = "Starting reduced speed"; break;
-      case 3:  modeText = "Starting full speed"; break;
-      case 4:  modeText = "Starting normal run"; break;
-      case 5:  modeText = "Normal run"; break;
-      case 6:  modeText = "Support control heating"; break;
-      case 7:  modeText = "Support control cooling"; break;
-      case 8:  modeText = "CO2 run"; break;
-      case 9:  modeText = "Night cooling"; break;
-      case 10: modeText = "Full speed stop"; break;
-      case 11: modeText = "Stopping fan"; break;
-      default: modeText = "Unknown mode"; break;
+bool cbCommission(uint8_t result, uint16_t, void*) {
+  accountBusTime();
+  bool answered = (result == RTU_SUCCESS) ||
+                  (result >= RTU_ILLEGAL_FUNCTION && result <= RTU_SLAVE_FAILURE);
+  if ((comm.phase == COMM_LINK || comm.phase == COMM_BASELINE) && comm.sent <= NUM_SLAVES) {
+    // First round: who answers at all. Any valid frame, even an exception, counts
+    if (answered && !comm.present[comm.asked]) {
+      comm.present[comm.asked] = true;
+      comm.numPresent++;
     }
-    
-    Serial.printf("  %-25s [Reg   2]: %5u (%s)\n",
-                  "Run Mode", rawValue, modeText);
-    return true;
-  } else {
-    Serial.printf("  %-25s [Reg   2]: ERROR (code %u)\n",
-                  "Run Mode", result);
-    return false;
+  } else if (result != RTU_SUCCESS) {
+    comm.failed = true;
   }
+  return true;
 }
 
-// =============== READ SINGLE TEMPERATURE ===============
-bool readSingleTemp(uint16_t regAddress, const char* name, float* dataField) {
-  uint8_t result = modbus.readInputRegisters(regAddress, 1);
-  
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
-    float temperature = rawValue / 10.0f;
-    *dataField = temperature;
-    Serial.printf("  %-25s [Reg %3u]: %5u (%.1f °C)\n",
-                  name, regAddress, rawValue, temperature);
-    return true;
+// Decides on the setting being tested once it has had its reads, and sends
+// the next read. Called instead of serviceModbus() while commissioning.
+void serviceCommissioning() {
+  modbus.task();
+  updateBusLoad();
+  if (modbus.busy()) return;
+
+  uint16_t addr = pointTable[0].address;
+  uint16_t count = 1;
+  switch (comm.phase) {
+    case COMM_BASELINE:
+      if (comm.sent >= NUM_SLAVES) {
+        beginLinkPhase();
+        return;
+      }
+      break;
+
+    case COMM_LINK:
+      if (comm.sent == NUM_SLAVES && linkLosesSlaves()) comm.failed = true;
+      if (comm.failed || comm.sent >= NUM_SLAVES + COMMISSION_REQUESTS) {
+        trace(TRACE_INFO, EV_LINK_PROBE, 0, rs485Link.baud / 100, comm.step % NUM_LINK_FORMATS,
+              comm.failed ? 0 : comm.numPresent);
+        if (!comm.failed) {
+          comm.phase = COMM_GAP;
+          comm.step = 0;
+          rs485Link.turnaroundMs = LINK_GAPS_MS[0];
+          beginCandidate();
+        } else if (++comm.step < NUM_LINK_BAUDS * NUM_LINK_FORMATS) {
+          beginLinkCandidate();
+        } else {
+          finishCommissioning(false);
+        }
+        return;
+      }
+      break;
+
+    case COMM_GAP:
+      if (comm.failed || comm.sent >= COMMISSION_REQUESTS) {
+        trace(TRACE_INFO, EV_LINK_GAP, 0, rs485Link.turnaroundMs, 0, !comm.failed);
+        if (comm.failed || comm.step + 1 >= NUM_LINK_GAPS) {
+          if (comm.failed) rs485Link.turnaroundMs = LINK_GAPS_MS[comm.step ? comm.step - 1 : 0];
+          applyLink();
+          beginBlockPhase();
+        } else {
+          rs485Link.turnaroundMs = LINK_GAPS_MS[++comm.step];
+          beginCandidate();
+        }
+        return;
+      }
+      break;
+
+    case COMM_BLOCK: {
+      uint16_t size = (comm.blockLo + comm.blockHi + 1) / 2;
+      if (comm.blockLo == 0 && comm.blockHi == comm.blockRegs) size = comm.blockRegs;   // Whole block first
+      if (comm.failed || comm.sent >= comm.numPresent * COMMISSION_BLOCK_READS) {
+        trace(TRACE_INFO, EV_LINK_BLOCK, 0, size, 0, !comm.failed);
+        if (comm.failed) {
+          comm.blockHi = size - 1;
+        } else {
+          comm.blockLo = size;
+        }
+        if (comm.blockLo >= comm.blockHi) {
+          // The whole block fits: no limit, so a longer point table is not held back
+          rs485Link.maxBlockRegs = comm.blockLo >= comm.blockRegs ? READ_PLAN_MAX_REGS
+                                                                  : (comm.blockLo ? comm.blockLo : 1);
+          finishCommissioning(true);
+        } else {
+          beginCandidate();
+        }
+        return;
+      }
+      addr = comm.blockStart;
+      count = size;
+      break;
+    }
+  }
+
+  // Everyone once at the start of a link setting, then the slaves that answered in turn
+  uint8_t i;
+  if ((comm.phase == COMM_LINK || comm.phase == COMM_BASELINE) && comm.sent < NUM_SLAVES) {
+    i = comm.sent;
   } else {
-    Serial.printf("  %-25s [Reg %3u]: ERROR (code %u)\n",
-                  name, regAddress, result);
-    return false;
+    do {
+      i = comm.next++ % NUM_SLAVES;
+    } while (!comm.present[i]);
+  }
+  comm.asked = i;
+  modbus.setTimeout(COMMISSION_TIMEOUT_MS);
+  if (modbus.readIreg(slaves[i].id, addr, comm.values, count, cbCommission)) {
+    comm.sent++;
+    busRequestStart = millis();
   }
 }
 
-// =============== READ SINGLE PRESSURE ===============
-bool readSinglePressure(uint16_t regAddress, const char* name, float* dataField) {
-  uint8_t result = modbus.readInputRegisters(regAddress, 1);
-  
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
-    float pressure = rawValue / 10.0f;
-    *dataField = pressure;
-    Serial.printf("  %-25s [Reg %3u]: %5u (%.1f Pa)\n",
-                  name, regAddress, rawValue, pressure);
-    return true;
-  } else {
-    Serial.printf("  %-25s [Reg %3u]: ERROR (code %u)\n",
-                  name, regAddress, result);
-    return false;
+// =============== SNAPSHOTS ===============
+// Hands the state of 's' to the network task: after a sweep ('sweepClasses'
+// = its poll classes), after a command read-back ('fanModeRead') and when the
+// slave goes offline or comes back. Never waits for the network task.
+void publishSnapshot(Slave& s, uint8_t sweepClasses, bool fanModeRead) {
+  SlaveHandoff& h = handoff[&s - slaves];
+  bool closeWindow = (sweepClasses & (1 << POLL_NORMAL)) &&
+                     h.windowTaken.load(std::memory_order_acquire) == h.snapshot.value().windowSeq;
+
+  SlaveSnapshot& v = h.snapshot.beginWrite();
+  if (sweepClasses) {
+    v.data = s.data;
+    memcpy(v.pointTime, s.pointTime, sizeof(v.pointTime));
+    v.image = s.image;
+    for (int i = 0; i < NUM_POINTS; i++) v.bad[i] = s.health[i].open;
+    for (uint8_t c = 0; c < NUM_POLL_CLASSES; c++) {
+      if (sweepClasses & (1 << c)) v.sweeps[c]++;
+    }
+  }
+  if (closeWindow) {
+    memcpy(v.window, s.window, sizeof(v.window));
+    v.windowSeq++;
   }
+  v.pollBoost = s.pollBoost;
+  v.fanMode = s.fanMode;
+  if (fanModeRead) v.fanModeReads++;
+  v.offline = s.offline;
+  h.snapshot.endWrite();
+
+  if (closeWindow) resetWindow(s);
 }
 
-// =============== READ SINGLE FLOW ===============
-bool readSingleFlow(uint16_t regAddress, const char* name, float* dataField) {
-  uint8_t result = modbus.readInputRegisters(regAddress, 1);
-  
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t rawValue = modbus.getResponseBuffer(0);
-    float flow = rawValue / 10.0f;
-    *dataField = flow;
-    Serial.printf("  %-25s [Reg %3u]: %5u (%.1f m³/h)\n",
-                  name, regAddress, rawValue, flow);
-    return true;
-  } else {
-    Serial.printf("  %-25s [Reg %3u]: ERROR (code %u)\n",
-                  name, regAddress, result);
-    return false;
+// Closes a bus statistics period every BUS_STATS_INTERVAL_MS, once the
+// network task has taken the last one (see NodeStats)
+void closeBusStats() {
+  if (millis() - lastBusStats < BUS_STATS_INTERVAL_MS) return;
+  if (statsTaken.load(std::memory_order_acquire) != nodeStats.value().period) return;
+  lastBusStats = millis();
+
+  NodeStats& n = nodeStats.beginWrite();
+  n.period++;
+  n.busLoadPct = busLoadPct;
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    BusStats& st = slaves[i].stats;
+    n.slave[i] = st;
+    st.latency.reset();
+    st.sweep.reset();
+    st.command.reset();
   }
+  nodeStats.endWrite();
 }
 
-// =============== READ SINGLE RUNTIME ===============
-bool readSingleRuntime(uint16_t regAddress, const char* name, uint16_t* dataField) {
-  uint8_t result = modbus.readInputRegisters(regAddress, 1);
+// Network task: copies the snapshot of 's' when it changed and publishes
+// what happened since the last copy. Returns true if a sweep went out (or
+// into the backlog).
+bool serviceSnapshot(Slave& s) {
+  SlaveHandoff& h = handoff[&s - slaves];
+  if (h.snapshot.sequence() == s.viewSeq) return false;
+  s.viewSeq = h.snapshot.read(s.view);
 
-  if (result == modbus.ku8MBSuccess) {
-    uint16_t raw = modbus.getResponseBuffer(0);
-    *dataField = raw;
-    Serial.printf("  %-25s [Reg %3u]: %5u (minutes)\n",
-                  name, regAddress, raw);
-    return true;
-  } else {
-    Serial.printf("  %-25s [Reg %3u]: ERROR (code %u)\n",
-                  name, regAddress, result);
-    return false;
+  uint8_t classes = 0;
+  for (uint8_t c = 0; c < NUM_POLL_CLASSES; c++) {
+    if (s.view.sweeps[c] == s.seenSweeps[c]) continue;
+    classes |= 1 << c;
+    s.seenSweeps[c] = s.view.sweeps[c];
+  }
+  bool newWindow = (s.view.windowSeq != s.seenWindowSeq);
+  if (newWindow) {
+    s.seenWindowSeq = s.view.windowSeq;
+    h.windowTaken.store(s.view.windowSeq, std::memory_order_release);
+  }
+
+  if (s.view.offline && s.born) sendDeviceDeath(s);
+  if (s.view.fanModeReads != s.seenFanModeReads) {
+    s.seenFanModeReads = s.view.fanModeReads;
+    publishFanMode(s);
+  }
+
+  if (classes == 0 || sampleOnly(classes)) return false;   // Only went into the window
+  if (mqttClient.connected()) {
+    publishSparkplugData(s, newWindow);
+  } else if (newWindow) {
+    storeSample(s);       // Backlog keeps the normal cadence, not every fast sweep
   }
+  return true;
 }
 
-// =============== READ ALL SENSORS ===============
-void readAllSensors() {
-  unsigned long startTime = millis();
-  int totalSuccess = 0;
-  int totalSensors = 2 + NUM_TEMPS + NUM_PRESSURES + NUM_FLOWS + NUM_RUNTIMES;
-  
-  // Reset data structure
-  currentData.timestamp = millis();
-  currentData.successfulReads = 0;
-  currentData.dataValid = false;
-  
-  Serial.println("\n╔════════════════════════════════════════════════╗");
-  Serial.println("║          READING ALL SENSORS                   ║");
-  Serial.println("╚════════════════════════════════════════════════╝\n");
-  
-  // System Status
-  Serial.println("--- System Status ---");
-  if (readEfficiency()) totalSuccess++;
-  delay(50);
-  if (readRunMode()) totalSuccess++;
-  delay(50);
-  
-  // Temperatures
-  Serial.println("\n--- Temperatures ---");
-  if (readSingleTemp(0, "Outdoor Temp", &currentData.outdoorTemp)) totalSuccess++;
-  delay(50);
-  if (readSingleTemp(6, "Supply Air Temp", &currentData.supplyAirTemp)) totalSuccess++;
-  delay(50);
-  if (readSingleTemp(7, "Supply Air Setpoint Temp", &currentData.supplyAirSetpointTemp)) totalSuccess++;
-  delay(50);
-  if (readSingleTemp(8, "Exhaust Air Temp", &currentData.exhaustAirTemp)) totalSuccess++;
-  delay(50);
-  if (readSingleTemp(19, "Extract Air Temp", &currentData.extractAirTemp)) totalSuccess++;
-  delay(50);
-  
-  // Pressures
-  Serial.println("\n--- Pressures ---");
-  if (readSinglePressure(12, "Supply Air Pressure", &currentData.supplyAirPressure)) totalSuccess++;
-  delay(50);
-  if (readSinglePressure(13, "Extract Air Pressure", &currentData.extractAirPressure)) totalSuccess++;
-  delay(50);
-  
-  // Air Flows
-  Serial.println("\n--- Air Flows ---");
-  if (readSingleFlow(14, "Supply Air Flow", &currentData.supplyAirFlow)) totalSuccess++;
-  delay(50);
-  if (readSingleFlow(15, "Extract Air Flow", &currentData.extractAirFlow)) totalSuccess++;
-  delay(50);
-  if (readSingleFlow(292, "Extra Supply Air Flow", &currentData.extraSupplyAirFlow)) totalSuccess++;
-  delay(50);
-  if (readSingleFlow(293, "Extra Extract Air Flow", &currentData.extraExtractAirFlow)) totalSuccess++;
-  delay(50);
-  
-  // Runtime
-  Serial.println("\n--- Runtime ---");
-  if (readSingleRuntime(3, "Supply Air Fan Runtime", &currentData.supplyFanRuntime)) totalSuccess++;
-  delay(50);
-  if (readSingleRuntime(4, "Extract Air Fan Runtime", &currentData.extractFanRuntime)) totalSuccess++;
-  delay(50);
-  
-  currentData.successfulReads = totalSuccess;
-  currentData.dataValid = (totalSuccess > 0);
-  
-  unsigned long duration = millis() - startTime;
-  Serial.println("\n╔════════════════════════════════════════════════╗");
-  Serial.printf("║  Total: %d/%d successful reads in %lums         ║\n",
-                totalSuccess, totalSensors, duration);
-  Serial.println("╚════════════════════════════════════════════════╝\n");
+// =============== MODBUS TCP ===============
+// Runs in the network task and answers from the slaves' snapshots only
+// A client write waiting for the command lane to read the register back
+struct TcpWrite {
+  bool active;
+  uint8_t slave;                // Index in slaves[]
+  uint16_t value;
+  uint32_t reads;               // view.fanModeReads when it was queued
+  unsigned long since;
+};
+
+TcpWrite tcpWrites[MODBUS_TCP_MAX_CLIENTS];
+
+// Unit id = Modbus address of the slave on the RS485 bus
+int slaveByUnit(uint8_t unit) {
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (slaves[i].id == unit) return i;
+  }
+  return -1;
+}
+
+uint8_t tcpRead(uint8_t unit, uint8_t fc, uint16_t addr, uint16_t count, uint16_t* dst) {
+  int i = slaveByUnit(unit);
+  if (i < 0) return TCP_GATEWAY_PATH;
+  if ((uint32_t)addr + count > 0x10000) return RTU_ILLEGAL_ADDRESS;
+
+  const SlaveSnapshot& v = slaves[i].view;
+  unsigned long now = millis();
+  bool stale = v.offline;
+  for (uint16_t k = 0; k < count; k++) {
+    uint16_t a = addr + k;
+    if (fc == RTU_FC_READ_HOLDING) {
+      // FanMode is the only holding register, as last read back
+      if (a != FAN_MODE_REG) return RTU_ILLEGAL_ADDRESS;
+      if (v.fanMode < 0) stale = true;
+      dst[k] = v.fanMode;
+      continue;
+    }
+    int j = imageIndex(a);
+    if (j < 0) return RTU_ILLEGAL_ADDRESS;
+    if (!v.image.valid[j] || now - v.image.readAt[j] > MODBUS_TCP_MAX_AGE_MS) stale = true;
+    dst[k] = v.image.value[j];
+  }
+  return stale ? TCP_GATEWAY_TARGET : 0;
+}
+
+uint8_t tcpWrite(uint8_t client, uint8_t unit, uint16_t addr, uint16_t count, const uint16_t* values) {
+  int i = slaveByUnit(unit);
+  if (i < 0) return TCP_GATEWAY_PATH;
+  if (addr != FAN_MODE_REG || count != 1) return RTU_ILLEGAL_ADDRESS;
+  if (values[0] > 3) return RTU_ILLEGAL_VALUE;
+
+  Slave& s = slaves[i];
+  if (s.view.offline) return TCP_GATEWAY_TARGET;
+  if (!queueCommand(s, FAN_MODE_REG, values[0], true)) return TCP_SLAVE_BUSY;
+  tcpWrites[client] = {true, (uint8_t)i, values[0], s.view.fanModeReads, millis()};
+  return MODBUS_TCP_PENDING;
+}
+
+// Answers the writes whose register has been read back. A read-back with
+// another value only fails the write once no command for the register is
+// left: it may have belonged to a command queued before this one.
+void serviceTcpWrites() {
+  for (uint8_t k = 0; k < MODBUS_TCP_MAX_CLIENTS; k++) {
+    TcpWrite& w = tcpWrites[k];
+    if (!w.active) continue;
+    const Slave& s = slaves[w.slave];
+    bool readBack = (s.view.fanModeReads != w.reads);
+
+    uint8_t result;
+    if (readBack && s.view.fanMode == w.value) {
+      result = 0;
+    } else if (readBack && !commandPending(s, FAN_MODE_REG)) {
+      result = s.view.fanMode < 0 ? TCP_GATEWAY_TARGET : RTU_SLAVE_FAILURE;
+    } else if (millis() - w.since >= MODBUS_TCP_WRITE_MS) {
+      result = TCP_GATEWAY_TARGET;
+    } else {
+      continue;
+    }
+    w.active = false;
+    tcpServer.complete(k, result);
+  }
+}
+
+// =============== TRACE RENDERING ===============
+const char* slaveName(uint8_t id) {
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (slaves[i].id == id) return slaves[i].deviceId;
+  }
+  return "-";
+}
+
+const PointDef* findPoint(uint16_t address) {
+  for (int i = 0; i < NUM_POINTS; i++) {
+    if (pointTable[i].address == address) return &pointTable[i];
+  }
+  return nullptr;
+}
+
+// One record as one line of text. Only runs when someone looks at it.
+void renderTrace(const TraceRecord& r) {
+  static const char levelChar[] = {'D', 'I', 'W', 'E'};
+  Serial.printf("%6lu.%03lu %c %-12s ", (unsigned long)(r.timestamp / 1000),
+                (unsigned long)(r.timestamp % 1000), levelChar[r.level & 3], slaveName(r.slave));
+
+  switch (r.event) {
+    case EV_REG_OK: {
+      const PointDef* p = findPoint(r.reg);
+      if (!p) {
+        Serial.printf("[Reg %3u]: %5u\n", r.reg, r.value);
+      } else if (p->dataType == FLOAT) {
+        Serial.printf("%-25s [Reg %3u]: %5u (%.1f %s)\n", p->label, r.reg, r.value, r.value / p->scale, p->unit);
+      } else {
+        Serial.printf("%-25s [Reg %3u]: %5u (%s)\n", p->label, r.reg, r.value,
+                      p->describe ? p->describe(r.value) : p->unit);
+      }
+      break;
+    }
+    case EV_REG_ERROR: {
+      const PointDef* p = findPoint(r.reg);
+      Serial.printf("%-25s [Reg %3u]: ERROR (code %u)\n", p ? p->label : "", r.reg, r.result);
+      break;
+    }
+    case EV_BLOCK:
+      Serial.printf("Block Reg %u-%u: %s (code %u)\n", r.reg, r.reg + r.value - 1,
+                    r.result == RTU_SUCCESS ? "OK" : "ERROR", r.result);
+      break;
+    case EV_SWEEP_START:
+      Serial.printf("Sweep started, poll classes 0x%02X\n", r.value);
+      break;
+    case EV_SWEEP_BUSY:
+      Serial.println("Sweep already running");
+      break;
+    case EV_SWEEP_DONE:
+      Serial.printf("Sweep done: %u successful reads (%u asked for) in %ums\n", r.value, r.result, r.reg);
+      break;
+    case EV_CMD_QUEUED:
+      Serial.printf("Command queued: Reg %u = %u\n", r.reg, r.value);
+      break;
+    case EV_CMD_WRITE:
+      if (r.result == RTU_SUCCESS) {
+        Serial.printf("Reg %u set to %u\n", r.reg, r.value);
+      } else {
+        Serial.printf("ERROR writing %u to Reg %u (code %u)\n", r.value, r.reg, r.result);
+      }
+      break;
+    case EV_CMD_DONE:
+      if (r.result == RTU_SUCCESS) {
+        Serial.printf("Command done: read back %u, written %ums after the command\n", r.value, r.reg);
+      } else {
+        Serial.printf("ERROR reading back the command register (code %u)\n", r.result);
+      }
+      break;
+    case EV_CMD_MISMATCH:
+      Serial.printf("Reg %u reads back a different value than %u\n", r.reg, r.value);
+      break;
+    case EV_CMD_REJECTED:
+      Serial.printf("Command rejected: Reg %u = %u (out of range or queue full)\n", r.reg, r.value);
+      break;
+    case EV_SLAVE_OFFLINE:
+      Serial.printf("Offline after %u timeouts, probing every %us\n", r.value, SLAVE_PROBE_INTERVAL_MS / 1000);
+      break;
+    case EV_SLAVE_BACK:
+      Serial.println("Slave is back");
+      break;
+    case EV_DDATA:
+      Serial.printf("DDATA published (%u bytes, %u metrics, %u heap allocs)\n", r.value, r.reg, r.result);
+      break;
+    case EV_DDATA_SKIP:
+      Serial.println("No metric outside its deadband, nothing published");
+      break;
+    case EV_DDATA_INVALID:
+      Serial.println("Sweep without valid data, not published");
+      break;
+    case EV_PUBLISH_FAIL:
+      Serial.println("✗ Publish failed");
+      break;
+    case EV_BATCH:
+      Serial.printf("DDATA batch published (%u sweeps, %u bytes)\n", r.reg, r.value);
+      break;
+    case EV_STORE:
+      Serial.printf("MQTT down, sample buffered (%u in backlog)\n", r.value);
+      break;
+    case EV_REPLAY:
+      Serial.printf("Replayed %u buffered samples (%u bytes)\n", r.reg, r.value);
+      break;
+    case EV_NDATA:
+      Serial.printf("Bus statistics published (%u bytes, %u metrics)\n", r.value, r.reg);
+      break;
+    case EV_REG_OPEN: {
+      const PointDef* p = findPoint(r.reg);
+      Serial.printf("%-25s [Reg %3u]: failing (code %u), skipped, next probe in %us\n",
+                    p ? p->label : "", r.reg, r.result, r.value);
+      break;
+    }
+    case EV_REG_CLOSED: {
+      const PointDef* p = findPoint(r.reg);
+      Serial.printf("%-25s [Reg %3u]: answers again, back in the sweeps\n", p ? p->label : "", r.reg);
+      break;
+    }
+    case EV_BLOCK_SPLIT:
+      Serial.printf("Block from Reg %u fails, read in two from Reg %u on\n", r.reg, r.value);
+      break;
+    case EV_LINK_START:
+      Serial.printf("Commissioning: %u slave(s) answer on the current setting, probing baud rates and formats\n",
+                    r.result);
+      break;
+    case EV_LINK_PROBE:
+      if (r.result) {
+        Serial.printf("Commissioning: %lu %s stable, %u slave(s) answer\n", r.reg * 100UL,
+                      LINK_FORMAT_NAMES[r.value % NUM_LINK_FORMATS], r.result);
+      } else {
+        Serial.printf("Commissioning: %lu %s: no answer or errors\n", r.reg * 100UL,
+                      LINK_FORMAT_NAMES[r.value % NUM_LINK_FORMATS]);
+      }
+      break;
+    case EV_LINK_GAP:
+      Serial.printf("Commissioning: %ums between requests %s\n", r.reg, r.result ? "OK" : "fails");
+      break;
+    case EV_LINK_BLOCK:
+      Serial.printf("Commissioning: blocks of %u registers %s\n", r.reg, r.result ? "OK" : "fail");
+      break;
+    case EV_LINK_DONE:
+      Serial.printf("Commissioning done: %lu %s, %ums between requests, stored\n", r.reg * 100UL,
+                    LINK_FORMAT_NAMES[r.result % NUM_LINK_FORMATS], r.value);
+      break;
+    case EV_LINK_FAILED:
+      Serial.println("✗ Commissioning: no setting works, keeping the previous one");
+      break;
+    case EV_POLL_BOOST:
+      if (r.reg == 0xFFFF) {
+        Serial.printf("Run mode in transition, polling %ux faster\n", r.value);
+      } else {
+        Serial.printf("Reg %u moving fast, polling %ux faster\n", r.reg, r.value);
+      }
+      break;
+    case EV_POLL_DECAY:
+      if (r.value > 1) {
+        Serial.printf("Poll rate down to %ux (bus load %u%%)\n", r.value, r.result);
+      } else {
+        Serial.printf("Poll rate back to steady state (bus load %u%%)\n", r.result);
+      }
+      break;
+    default:
+      Serial.printf("Event %u reg=%u value=%u result=%u\n", r.event, r.reg, r.value, r.result);
+      break;
+  }
+}
+
+// Renders new records while the console TX buffer has room, so the loop
+// never waits for the UART. Records the ring overwrote first are skipped.
+void serviceTrace() {
+  uint32_t oldest = traceOldest();
+  if (traceShown < oldest) {
+    if (traceVerbose) {
+      Serial.printf("[TRACE] %lu records overwritten before they were shown\n",
+                    (unsigned long)(oldest - traceShown));
+    }
+    traceShown = oldest;
+  }
+
+  uint8_t liveLevel = traceVerbose ? TRACE_DEBUG : TRACE_WARN;
+  TraceRecord r;
+  while (traceShown < traceTotal() && Serial.availableForWrite() >= TRACE_LINE_MAX) {
+    if (traceCopy(traceShown++, r) && r.level >= liveLevel) renderTrace(r);
+  }
+}
+
+// Everything still in the ring, on request. This one may block, a human asked.
+void dumpTrace() {
+  uint32_t from = traceOldest();
+  uint32_t to = traceTotal();
+  Serial.printf("\n[TRACE] Last %lu records:\n", (unsigned long)(to - from));
+  TraceRecord r;
+  for (uint32_t n = from; n < to; n++) {
+    if (traceCopy(n, r)) renderTrace(r);
+  }
+  traceShown = to;
+}
+
+// =============== BUS STATISTICS (CONSOLE) ===============
+// The 's' command asks the poll engine for a copy of its counters
+// (consoleWanted); it fills the SeqLock between two steps and the network
+// task prints the copy once it has arrived, so neither core waits for the
+// other or reads what the other one is changing.
+struct SlaveConsole {
+  BusStats stats;
+  uint16_t regErrors[NUM_POINTS];
+  PointHealth health[NUM_POINTS];
+  uint16_t cuts[NUM_POINTS];
+  uint8_t numCuts;
+};
+
+struct ConsoleView {
+  uint8_t busLoadPct;
+  LinkConfig link;
+  SlaveConsole slave[NUM_SLAVES];
+};
+
+SeqLock<ConsoleView> consoleView;
+std::atomic<bool> consoleWanted{false};
+ConsoleView consoleCopy;                  // Network task's copy
+uint32_t consoleAskedSeq = 0;
+bool busStatsPending = false;             // Print when a view newer than consoleAskedSeq arrives
+
+// Poll engine: copies its counters when the console asked for them
+void serviceConsoleView() {
+  if (!consoleWanted.exchange(false)) return;
+  ConsoleView& v = consoleView.beginWrite();
+  v.busLoadPct = busLoadPct;
+  v.link = rs485Link;
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    const Slave& s = slaves[i];
+    SlaveConsole& c = v.slave[i];
+    c.stats = s.stats;
+    memcpy(c.regErrors, s.regErrors, sizeof(c.regErrors));
+    memcpy(c.health, s.health, sizeof(c.health));
+    memcpy(c.cuts, s.cuts, sizeof(c.cuts));
+    c.numCuts = s.numCuts;
+  }
+  consoleView.endWrite();
+}
+
+// Network task, 's'
+void requestBusStats() {
+  consoleAskedSeq = consoleView.sequence();
+  busStatsPending = true;
+  consoleWanted = true;
+}
+
+void printBusStats() {
+  if (!busStatsPending || consoleView.sequence() == consoleAskedSeq) return;
+  busStatsPending = false;
+  consoleView.read(consoleCopy);
+  const ConsoleView& v = consoleCopy;
+
+  Serial.printf("\n[BUS] Load %u%%, statistics since boot (percentiles: last %us)\n",
+                v.busLoadPct, BUS_STATS_INTERVAL_MS / 1000);
+  Serial.printf("  Link: %lu %s, %ums between requests, blocks up to %u regs\n",
+                (unsigned long)v.link.baud, linkFormatName(v.link.format),
+                v.link.turnaroundMs, v.link.maxBlockRegs);
+  Serial.printf("  Modbus TCP: %u clients, %lu requests, %lu exceptions (none on the bus)\n",
+                tcpServer.connectedClients(), (unsigned long)tcpServer.requests(),
+                (unsigned long)tcpServer.exceptions());
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    const SlaveConsole& s = v.slave[i];
+    const BusStats& st = s.stats;
+    const char* deviceId = slaves[i].deviceId;
+    Serial.printf("  %-12s req %lu, timeout %lu, crc %lu, exception %lu, other %lu, retry %lu\n",
+                  deviceId, (unsigned long)st.requests, (unsigned long)st.timeouts,
+                  (unsigned long)st.crcErrors, (unsigned long)st.exceptions,
+                  (unsigned long)st.otherErrors, (unsigned long)st.retries);
+    Serial.printf("  %-12s latency p50 %lums p95 %lums max %lums | sweep p50 %lums p95 %lums"
+                  " | command max %lums\n", "",
+                  (unsigned long)st.latency.percentile(50), (unsigned long)st.latency.percentile(95),
+                  (unsigned long)st.latency.maxMs,
+                  (unsigned long)st.sweep.percentile(50), (unsigned long)st.sweep.percentile(95),
+                  (unsigned long)st.command.maxMs);
+    for (int p = 0; p < NUM_POINTS; p++) {
+      const PointHealth& h = s.health[p];
+      if (s.regErrors[p] == 0 && !h.open) continue;
+      Serial.printf("  %-12s %-25s [Reg %3u]: %u failed reads, timeout %ums", "",
+                    pointTable[p].label, pointTable[p].address, s.regErrors[p],
+                    h.timeoutMs ? h.timeoutMs : MODBUS_TIMEOUT_MS);
+      if (h.open) {
+        long wait = (long)(h.retryAt - millis());
+        Serial.printf(", SKIPPED (probe in %lds)", wait > 0 ? wait / 1000 : 0);
+      }
+      Serial.println();
+    }
+    if (s.numCuts > 0) {
+      Serial.printf("  %-12s blocks split before Reg", "");
+      for (uint8_t c = 0; c < s.numCuts; c++) Serial.printf(" %u", s.cuts[c]);
+      Serial.println();
+    }
+  }
 }
 
 // =============== HANDLE SERIAL INPUT ===============
+// Collects the digits for the 'i' command without blocking the loop
+void readIntervalInput() {
+  while (Serial.available() > 0) {
+    char c = Serial.read();
+
+    if (c >= '0' && c <= '9') {
+      if (intervalInput < 1000) intervalInput = intervalInput * 10 + (c - '0');
+    } else if (c == '\n' || c == '\r') {
+      awaitingInterval = false;
+      if (intervalInput >= 5 && intervalInput <= 300) {
+        autoReadInterval = intervalInput * 1000UL;
+        Serial.printf("Auto-read interval set to %d seconds\n", intervalInput);
+      } else {
+        Serial.println("Invalid interval. Use 5-300 seconds.");
+      }
+      while (Serial.available() > 0) {
+        Serial.read();
+      }
+      return;
+    }
+  }
+}
+
 void handleSerialInput() {
+  if (awaitingInterval) {
+    readIntervalInput();
+    return;
+  }
+
   if (Serial.available() > 0) {
     char input = Serial.read();
     
@@ -650,10 +3612,7 @@ void handleSerialInput() {
         
       case 'r':
       case 'R':
-        readAllSensors();
-        if (mqttClient.connected()) {
-          publishSparkplugData();
-        }
+        startSweeps(selectedSlave);
         break;
         
       case 'a':
@@ -665,20 +3624,64 @@ void handleSerialInput() {
       case 'i':
       case 'I':
         Serial.println("Enter interval in seconds (5-300):");
-        while(Serial.available() == 0) {
-          delay(10);
-        }
-        {
-          int newInterval = Serial.parseInt();
-          if (newInterval >= 5 && newInterval <= 300) {
-            autoReadInterval = newInterval * 1000;
-            Serial.printf("Auto-read interval set to %d seconds\n", newInterval);
-          } else {
-            Serial.println("Invalid interval. Use 5-300 seconds.");
-          }
+        awaitingInterval = true;
+        intervalInput = 0;
+        break;
+        
+      case 'f':
+      case 'F':
+        if (mqttClient.connected()) flushBatches();
+        payloadFormat = (payloadFormat == PAYLOAD_PROTOBUF) ? PAYLOAD_JSON : PAYLOAD_PROTOBUF;
+        Serial.printf("Payload format: %s\n", payloadFormat == PAYLOAD_PROTOBUF ? "Protobuf" : "JSON");
+        // Host apps must see births in the new format before any data
+        if (mqttClient.connected()) {
+          sendNodeBirth();
+          sendDeviceBirths();
         }
         break;
         
+      case 'e':
+      case 'E':
+        rbeEnabled = !rbeEnabled;
+        Serial.printf("Report-by-exception %s\n", rbeEnabled ? "ENABLED" : "DISABLED");
+        break;
+        
+      case 'b':
+      case 'B':
+        batchEnabled = !batchEnabled;
+        if (!batchEnabled && mqttClient.connected()) flushBatches();
+        Serial.printf("DDATA batching %s (%u sweeps / %us)\n", batchEnabled ? "ENABLED" : "DISABLED",
+                      DDATA_BATCH_SWEEPS, DDATA_BATCH_LATENCY_MS / 1000);
+        break;
+        
+      case 'v':
+      case 'V':
+        traceVerbose = !traceVerbose;
+        Serial.printf("Verbose trace %s\n", traceVerbose ? "ON" : "OFF (warnings and errors only)");
+        break;
+        
+      case 't':
+      case 'T':
+        dumpTrace();
+        break;
+        
+      case 's':
+      case 'S':
+        requestBusStats();      // printBusStats() shows it once the poll engine has copied it
+        break;
+
+      case 'c':
+      case 'C':
+        Serial.println("Commissioning the RS485 link, polling stops meanwhile (progress in the trace)");
+        commissionRequested = true;
+        break;
+        
+      case 'u':
+      case 'U':
+        selectedSlave = (selectedSlave + 1 < NUM_SLAVES) ? selectedSlave + 1 : -1;
+        Serial.printf("Target: %s\n", selectedSlave < 0 ? "all slaves" : slaves[selectedSlave].deviceId);
+        break;
+        
       case 'm':
       case 'M':
         printMenu();
@@ -695,33 +3698,100 @@ void handleSerialInput() {
   }
 }
 
-// =============== LOOP ===============
-void loop() {
-  // Maintain MQTT connection
-  if (WiFi.status() == WL_CONNECTED) {
-    if (!mqttClient.connected()) {
-      reconnectMQTT();
-    }
+// =============== TASKS ===============
+// Acquisition: sweeps, command lane and bus statistics. Never touches the network.
+void serviceAcquisition() {
+  serviceConsoleView();
+  
+  // Commissioning owns the bus until it is done; it starts between two transactions
+  if (comm.phase == COMM_IDLE && commissionRequested && !modbus.busy()) {
+    commissionRequested = false;
+    startCommissioning();
+  }
+  if (comm.phase != COMM_IDLE) {
+    serviceCommissioning();
+    return;
+  }
+
+  // Auto-read: a slave starts a sweep as soon as one of its poll classes is
+  // due. A slave still busy with its last sweep (e.g. one that is timing
+  // out) is skipped, the others start on time.
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    Slave& s = slaves[i];
+    if (handoff[i].sweepRequested.exchange(false)) startSweep(s, POLL_ALL);
+    if (!autoReadEnabled || s.sweepActive) continue;
+    uint8_t due = dueClasses(s);
+    if (due) startSweep(s, due);
+  }
+  
+  // Drive the Modbus state machine one step
+  serviceModbus();
+  closeBusStats();
+}
+
+// Network: WiFi, MQTT, publishing, Modbus TCP and the console
+void serviceNetwork() {
+  // Maintain WiFi & MQTT connection (non-blocking)
+  serviceConnection();
+  if (mqttClient.connected()) {
     mqttClient.loop();
+    
+    if (rebirthRequested && mqttClient.connected()) {
+      rebirthRequested = false;
+      flushBatches();
+      sendNodeBirth();
+      sendDeviceBirths();
+    }
   }
   
   // Handle manual commands
   handleSerialInput();
+  serviceBatches();
+  publishBusStats();
+  printBusStats();
+  serviceTrace();
   
-  // Auto-read sensors if enabled
-  if (autoReadEnabled) {
-    unsigned long currentMillis = millis();
-    if (currentMillis - lastAutoRead >= autoReadInterval) {
-      lastAutoRead = currentMillis;
-      Serial.println("\n[AUTO-READ]");
-      readAllSensors();
-      
-      // Publish via MQTT hvis forbundet
-      if (mqttClient.connected()) {
-        publishSparkplugData();
-      }
-    }
+  // Publish via MQTT hvis forbundet, ellers gem til senere
+  bool published = false;
+  for (int i = 0; i < NUM_SLAVES; i++) {
+    if (serviceSnapshot(slaves[i])) published = true;
   }
+  tcpServer.task();
+  serviceTcpWrites();
   
-  delay(10);
+  if (!published && mqttClient.connected() && backlogSize() > 0 &&
+      millis() - lastReplay >= REPLAY_INTERVAL_MS) {
+    // Live data goes first; the backlog only gets the loops without a new sample
+    lastReplay = millis();
+    replayBacklog();
+  }
+}
+
+#if DUAL_CORE
+void acquisitionTask(void*) {
+  for (;;) {
+    serviceAcquisition();
+    vTaskDelay(1);        // One tick, so the idle task of this core can feed the watchdog
+  }
+}
+
+void networkTask(void*) {
+  for (;;) {
+    serviceNetwork();
+    vTaskDelay(1);
+  }
+}
+#endif
+
+// =============== LOOP ===============
+// With DUAL_CORE both tasks were started by setup() and the Arduino loop
+// task has nothing left to do
+void loop() {
+#if DUAL_CORE
+  vTaskDelete(NULL);
+#else
+  serviceAcquisition();
+  serviceNetwork();
+  yield();
+#endif
 }
@@ -0,0 +1,331 @@
+/**
+ * @file
+ * @brief Simulated DV10 ventilation unit: register model and Modbus RTU slave logic
+ *
+ * Serves the registers the edge firmware uses (dataMQTTpub.cpp and
+ * VentEdgeMaster.cpp), with values following slow trajectories:
+ *
+ *   Input regs 0-19    temperatures, efficiency, run mode (2), runtimes,
+ *                      pressures and flows (unused addresses read as 0)
+ *   Input reg  183     alarm summary
+ *   Input regs 292-293 extra supply/extract air flow
+ *   Holding reg 367    fan mode 0-3, drives the run mode sequence
+ *
+ * All values are raw register words (tenths for temperatures, pressures,
+ * flows and efficiency), exactly as the real unit sends them. The model
+ * has no I/O and no clock of its own: the caller passes the simulated time,
+ * so it can run in real time behind a pty or much faster in a host build.
+ */
+
+#ifndef DV10_SIM_H
+#define DV10_SIM_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <random>
+#include "modbus_rtu_defs.h"
+
+#define DV10_REG_FAN_MODE   367
+#define DV10_REG_ALARM      183
+
+/**
+ * @class Dv10Model
+ * @brief Register image of one DV10 unit as a function of simulated time
+ */
+class Dv10Model {
+public:
+    static constexpr double PI = 3.14159265358979323846;
+    static constexpr double DAY = 86400.0;
+
+    explicit Dv10Model(uint32_t seed = 1) : rng_(seed) {}
+
+    /// Advances the model to 'now' (seconds of simulated time, monotonic)
+    void update(double now) {
+        double dt = now - lastUpdate_;
+        if (dt <= 0) return;
+        lastUpdate_ = now;
+
+        stepRunMode(now);
+
+        // Fans ramp towards the speed of the current run mode
+        double target = targetSpeed(now);
+        double rate = dt / 20.0;                    // 20 s from stop to full speed
+        if (speed_ < target) speed_ = std::min(target, speed_ + rate);
+        if (speed_ > target) speed_ = std::max(target, speed_ - rate);
+
+        if (runMode_ != 0) runtimeSec_ += dt;
+
+        double outdoor = 5.0 + 8.0 * std::sin(2 * PI * (now / DAY - 0.375));
+        double extract = 22.0 + 0.5 * std::sin(2 * PI * now / 3600.0);
+        double efficiency = speed_ > 0 ? 82.0 - 6.0 * speed_ : 0.0;
+        double supply = runMode_ != 0 ? setpoint_ + 0.3 * std::sin(2 * PI * now / 600.0) : outdoor;
+        double exhaust = extract - (extract - outdoor) * efficiency / 100.0;
+
+        setTenths(0, outdoor + noise(0.05));
+        setTenths(1, efficiency);
+        inputs_[2] = runMode_;
+        inputs_[3] = static_cast<uint16_t>(runtimeSec_ / 60.0);
+        inputs_[4] = static_cast<uint16_t>(runtimeSec_ / 60.0);
+        setTenths(6, supply + noise(0.05));
+        setTenths(7, setpoint_);
+        setTenths(8, exhaust + noise(0.05));
+        setTenths(12, 120.0 * speed_ * speed_ + noise(0.5));
+        setTenths(13, 110.0 * speed_ * speed_ + noise(0.5));
+        setTenths(14, 450.0 * speed_ + noise(2.0));
+        setTenths(15, 440.0 * speed_ + noise(2.0));
+        setTenths(19, extract + noise(0.05));
+
+        // One minute of alarm every 6 hours
+        alarm_ = std::fmod(now, 6 * 3600.0) < 60.0 ? 1 : 0;
+        extraSupplyFlow_ = tenths(50.0 * speed_ + noise(1.0));
+        extraExtractFlow_ = tenths(45.0 * speed_ + noise(1.0));
+    }
+
+    /// Returns false for an address the unit does not have
+    bool readInput(uint16_t addr, uint16_t& value) const {
+        if (addr == rejected_) return false;
+        if (addr < 20) {
+            value = inputs_[addr];
+        } else if (addr == DV10_REG_ALARM) {
+            value = alarm_;
+        } else if (addr == 292 && hasExtraFlow_) {
+            value = extraSupplyFlow_;
+        } else if (addr == 293 && hasExtraFlow_) {
+            value = extraExtractFlow_;
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    bool readHolding(uint16_t addr, uint16_t& value) const {
+        if (addr != DV10_REG_FAN_MODE) return false;
+        value = fanMode_;
+        return true;
+    }
+
+    /// Returns a Modbus exception code, or 0 when the write was accepted
+    uint8_t writeHolding(uint16_t addr, uint16_t value) {
+        if (addr != DV10_REG_FAN_MODE) return RTU_ILLEGAL_ADDRESS;
+        if (value > 3) return RTU_ILLEGAL_VALUE;
+        fanMode_ = value;
+        return 0;
+    }
+
+    /// Units without the extra flow option answer 292-293 with an exception
+    void setExtraFlow(bool present) { hasExtraFlow_ = present; }
+
+    /// Input register the unit answers with an exception, e.g. an unused
+    /// one a block read bridges (0xFFFF = none)
+    void setRejected(uint16_t addr) { rejected_ = addr; }
+
+    uint16_t runMode() const { return runMode_; }
+    uint16_t fanMode() const { return fanMode_; }
+
+private:
+    // Start: 1 -> 2 -> 3 -> 4 -> 5 (normal run). Stop: 10 -> 11 -> 0.
+    void stepRunMode(double now) {
+        bool wantRun = fanMode_ != 0;
+        double inMode = now - modeSince_;
+
+        switch (runMode_) {
+            case 0:  if (wantRun) setMode(1, now); break;
+            case 1:  if (!wantRun) setMode(10, now); else if (inMode >= 5) setMode(2, now); break;
+            case 2:  if (!wantRun) setMode(10, now); else if (inMode >= 5) setMode(3, now); break;
+            case 3:  if (!wantRun) setMode(10, now); else if (inMode >= 5) setMode(4, now); break;
+            case 4:  if (!wantRun) setMode(10, now); else if (inMode >= 10) setMode(5, now); break;
+            case 10: if (inMode >= 5) setMode(11, now); break;
+            case 11: if (inMode >= 10) setMode(wantRun ? 1 : 0, now); break;
+            default: if (!wantRun) setMode(10, now); break;
+        }
+    }
+
+    void setMode(uint16_t mode, double now) {
+        runMode_ = mode;
+        modeSince_ = now;
+    }
+
+    double targetSpeed(double now) const {
+        switch (runMode_) {
+            case 0: case 10: case 11: return 0.0;
+            case 1: case 2:           return 0.4;
+            case 3:                   return 1.0;
+            default: break;
+        }
+        switch (fanMode_) {
+            case 1:  return 0.6;
+            case 2:  return 1.0;
+            case 3:  return 0.8 + 0.2 * std::sin(2 * PI * (now / DAY - 0.25));
+            default: return 0.0;
+        }
+    }
+
+    double noise(double amplitude) {
+        return std::uniform_real_distribution<double>(-amplitude, amplitude)(rng_);
+    }
+
+    static uint16_t tenths(double v) {
+        long raw = std::lround(v * 10.0);
+        return static_cast<uint16_t>(raw < 0 ? 0 : (raw > 0xFFFF ? 0xFFFF : raw));
+    }
+
+    void setTenths(uint16_t addr, double v) { inputs_[addr] = tenths(v); }
+
+    std::mt19937 rng_;
+    uint16_t inputs_[20] = {};
+    uint16_t alarm_ = 0;
+    uint16_t extraSupplyFlow_ = 0;
+    uint16_t extraExtractFlow_ = 0;
+    uint16_t fanMode_ = 3;              // Auto, like a unit out of the box
+    bool hasExtraFlow_ = true;
+    uint16_t rejected_ = 0xFFFF;
+    uint16_t runMode_ = 0;
+    double modeSince_ = 0;
+    double speed_ = 0;
+    double setpoint_ = 19.0;
+    double runtimeSec_ = 1000 * 60.0;
+    double lastUpdate_ = 0;
+};
+
+/**
+ * @brief Fault injection and timing of the simulated slave
+ */
+struct Dv10SlaveConfig {
+    uint8_t slaveId = 1;
+    double latencyMs = 20.0;        ///< Processing time before the response starts
+    double latencyJitterMs = 5.0;   ///< +/- random part of the latency
+    double crcErrorRate = 0.0;      ///< Share of responses sent with a broken CRC
+    double timeoutRate = 0.0;       ///< Share of requests that get no response
+    uint16_t maxReadRegs = RTU_MAX_READ_REGS;   ///< Longer reads are answered with ILLEGAL_VALUE
+};
+
+/**
+ * @class Dv10Slave
+ * @brief Modbus RTU slave (FC 03, 04, 06) in front of a Dv10Model
+ */
+class Dv10Slave {
+public:
+    struct Stats {
+        uint64_t requests = 0;
+        uint64_t responses = 0;
+        uint64_t exceptions = 0;
+        uint64_t writes = 0;            ///< Register writes accepted
+        uint64_t badFrames = 0;         ///< Bad CRC or too short, ignored like a real slave
+        uint64_t otherSlave = 0;
+        uint64_t injectedCrc = 0;
+        uint64_t injectedTimeouts = 0;
+    };
+
+    Dv10Slave(Dv10Model& model, const Dv10SlaveConfig& config, uint32_t seed = 2)
+        : model_(model), config_(config), rng_(seed) {}
+
+    /**
+     * @brief Handles one complete request frame
+     *
+     * @return Length of the response in 'resp' (0 = stay silent)
+     */
+    size_t handle(const uint8_t* req, size_t len, uint8_t* resp) {
+        if (len < 4 || !crcOk(req, len)) {
+            stats_.badFrames++;
+            return 0;
+        }
+        if (req[0] != config_.slaveId) {
+            stats_.otherSlave++;
+            return 0;
+        }
+        stats_.requests++;
+
+        if (chance(config_.timeoutRate)) {
+            stats_.injectedTimeouts++;
+            return 0;
+        }
+
+        size_t n = buildResponse(req, len, resp);
+        if (n == 0) return 0;
+
+        if (chance(config_.crcErrorRate)) {
+            resp[n - 1] ^= 0x5A;
+            stats_.injectedCrc++;
+        }
+        stats_.responses++;
+        return n;
+    }
+
+    /// Latency for the next response, in milliseconds
+    double nextLatencyMs() {
+        double j = config_.latencyJitterMs;
+        double ms = config_.latencyMs + (j > 0 ? std::uniform_real_distribution<double>(-j, j)(rng_) : 0.0);
+        return ms < 0 ? 0 : ms;
+    }
+
+    const Stats& stats() const { return stats_; }
+    Dv10SlaveConfig& config() { return config_; }
+
+private:
+    size_t buildResponse(const uint8_t* req, size_t len, uint8_t* resp) {
+        uint8_t fc = req[1];
+        if (len != 8) return exception(req, resp, RTU_ILLEGAL_VALUE);
+
+        uint16_t addr = (req[2] << 8) | req[3];
+        uint16_t arg = (req[4] << 8) | req[5];
+
+        if (fc == RTU_FC_READ_INPUT || fc == RTU_FC_READ_HOLDING) {
+            if (arg == 0 || arg > config_.maxReadRegs) return exception(req, resp, RTU_ILLEGAL_VALUE);
+            resp[0] = req[0];
+            resp[1] = fc;
+            resp[2] = static_cast<uint8_t>(2 * arg);
+            for (uint16_t i = 0; i < arg; i++) {
+                uint16_t v;
+                bool ok = (fc == RTU_FC_READ_INPUT) ? model_.readInput(addr + i, v)
+                                                    : model_.readHolding(addr + i, v);
+                if (!ok) return exception(req, resp, RTU_ILLEGAL_ADDRESS);
+                resp[3 + 2 * i] = v >> 8;
+                resp[4 + 2 * i] = v & 0xFF;
+            }
+            return appendCrc(resp, 3 + 2 * arg);
+        }
+
+        if (fc == RTU_FC_WRITE_SINGLE) {
+            uint8_t ex = model_.writeHolding(addr, arg);
+            if (ex != 0) return exception(req, resp, ex);
+            stats_.writes++;
+            for (int i = 0; i < 6; i++) resp[i] = req[i];     // Echo
+            return appendCrc(resp, 6);
+        }
+
+        return exception(req, resp, RTU_ILLEGAL_FUNCTION);
+    }
+
+    size_t exception(const uint8_t* req, uint8_t* resp, uint8_t code) {
+        stats_.exceptions++;
+        resp[0] = req[0];
+        resp[1] = req[1] | 0x80;
+        resp[2] = code;
+        return appendCrc(resp, 3);
+    }
+
+    static size_t appendCrc(uint8_t* buf, size_t len) {
+        uint16_t crc = rtuCrc16(buf, static_cast<uint16_t>(len));
+        buf[len] = crc & 0xFF;
+        buf[len + 1] = crc >> 8;
+        return len + 2;
+    }
+
+    static bool crcOk(const uint8_t* buf, size_t len) {
+        uint16_t crc = rtuCrc16(buf, static_cast<uint16_t>(len - 2));
+        return buf[len - 2] == (crc & 0xFF) && buf[len - 1] == (crc >> 8);
+    }
+
+    bool chance(double p) {
+        return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng_) < p;
+    }
+
+    Dv10Model& model_;
+    Dv10SlaveConfig config_;
+    std::mt19937 rng_;
+    Stats stats_;
+};
+
+#endif
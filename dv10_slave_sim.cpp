@@ -0,0 +1,235 @@
+/**
+ * @file
+ * @brief DV10 Modbus RTU slave simulator on a Linux pseudo-terminal
+ *
+ * Opens a pty and answers Modbus RTU requests on it with the DV10 register
+ * map from dv10_sim.h, so the poller can be benchmarked without a real unit
+ * on RS485. A pty delivers bytes instantly, so the wire time is simulated:
+ * the request's air time and the slave latency are waited out, and the
+ * response is written one character at a time at the configured baud rate.
+ *
+ * Usage:
+ *   dv10_slave_sim [--baud 9600] [--slave 1] [--latency 20] [--jitter 5]
+ *                  [--crc-rate 0.01] [--timeout-rate 0.01] [--speed 1]
+ *                  [--link /tmp/ttyDV10]
+ *
+ * --speed runs the value trajectories faster than real time (e.g. 60 =
+ * one simulated hour per minute). The pty path is printed on start; with
+ * --link a symlink to it is created as well.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <spdlog/spdlog.h>
+#include "dv10_sim.h"
+
+const auto STATS_INTERVAL = std::chrono::seconds(10);
+
+std::atomic<bool> running(true);
+
+void onSignal(int) {
+    running = false;
+}
+
+struct SimOptions {
+    uint32_t baud = 9600;
+    double speed = 1.0;
+    std::string link;
+    Dv10SlaveConfig slave;
+};
+
+/// Microseconds per character: 11 bits (start, 8 data, parity/stop, stop)
+uint32_t charMicros(uint32_t baud) {
+    return 11000000UL / baud;
+}
+
+/// Same rule as the master: fixed 1750 us above 19200 baud
+uint32_t t35Micros(uint32_t baud) {
+    return baud > 19200 ? 1750 : charMicros(baud) * 7 / 2;
+}
+
+void sleepUntil(const timespec& t) {
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, nullptr) == EINTR) {}
+}
+
+timespec addMicros(timespec t, uint64_t us) {
+    t.tv_sec += us / 1000000;
+    t.tv_nsec += (us % 1000000) * 1000;
+    if (t.tv_nsec >= 1000000000) {
+        t.tv_sec++;
+        t.tv_nsec -= 1000000000;
+    }
+    return t;
+}
+
+/**
+ * @brief Writes a frame paced at the baud rate, one character per char time
+ */
+void writePaced(int fd, const uint8_t* buf, size_t len, uint32_t charUs) {
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    for (size_t i = 0; i < len; i++) {
+        t = addMicros(t, charUs);
+        sleepUntil(t);
+        if (write(fd, buf + i, 1) != 1) {
+            spdlog::warn("Write to pty failed: {}", std::strerror(errno));
+            return;
+        }
+    }
+}
+
+bool parseOptions(int argc, char* argv[], SimOptions& opt) {
+    static const option longOpts[] = {
+        {"baud", required_argument, nullptr, 'b'},
+        {"slave", required_argument, nullptr, 's'},
+        {"latency", required_argument, nullptr, 'l'},
+        {"jitter", required_argument, nullptr, 'j'},
+        {"crc-rate", required_argument, nullptr, 'c'},
+        {"timeout-rate", required_argument, nullptr, 't'},
+        {"speed", required_argument, nullptr, 'x'},
+        {"link", required_argument, nullptr, 'L'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "", longOpts, nullptr)) != -1) {
+        switch (c) {
+            case 'b': opt.baud = static_cast<uint32_t>(std::atoi(optarg)); break;
+            case 's': opt.slave.slaveId = static_cast<uint8_t>(std::atoi(optarg)); break;
+            case 'l': opt.slave.latencyMs = std::atof(optarg); break;
+            case 'j': opt.slave.latencyJitterMs = std::atof(optarg); break;
+            case 'c': opt.slave.crcErrorRate = std::atof(optarg); break;
+            case 't': opt.slave.timeoutRate = std::atof(optarg); break;
+            case 'x': opt.speed = std::atof(optarg); break;
+            case 'L': opt.link = optarg; break;
+            default: return false;
+        }
+    }
+    return opt.baud > 0 && opt.speed > 0;
+}
+
+/**
+ * @brief Opens the pty pair and puts the slave side in raw mode
+ *
+ * The slave side stays open here too, so the master does not see EIO while
+ * no client has the port open.
+ */
+int openPty(int& slaveFd, std::string& path) {
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) return -1;
+    path = ptsname(fd);
+
+    slaveFd = open(path.c_str(), O_RDWR | O_NOCTTY);
+    if (slaveFd < 0) return -1;
+
+    termios tio;
+    tcgetattr(slaveFd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slaveFd, TCSANOW, &tio);
+    return fd;
+}
+
+void logStats(const Dv10Slave::Stats& s, double seconds, uint64_t lastRequests) {
+    spdlog::info("{} requests ({:.1f}/s), {} responses, {} exceptions, {} bad frames, "
+                 "{} other slave | injected: {} CRC errors, {} timeouts",
+                 s.requests, (s.requests - lastRequests) / seconds, s.responses, s.exceptions,
+                 s.badFrames, s.otherSlave, s.injectedCrc, s.injectedTimeouts);
+}
+
+int main(int argc, char* argv[])
+{
+    SimOptions opt;
+    if (!parseOptions(argc, argv, opt)) {
+        std::fprintf(stderr, "Usage: %s [--baud N] [--slave ID] [--latency MS] [--jitter MS] "
+                             "[--crc-rate P] [--timeout-rate P] [--speed X] [--link PATH]\n", argv[0]);
+        return 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    int slaveFd = -1;
+    std::string path;
+    int fd = openPty(slaveFd, path);
+    if (fd < 0) {
+        spdlog::error("Cannot open pty: {}", std::strerror(errno));
+        return 1;
+    }
+    if (!opt.link.empty()) {
+        unlink(opt.link.c_str());
+        if (symlink(path.c_str(), opt.link.c_str()) != 0) {
+            spdlog::warn("Cannot create link {}: {}", opt.link, std::strerror(errno));
+        }
+    }
+
+    const uint32_t charUs = charMicros(opt.baud);
+    const int silenceMs = static_cast<int>((t35Micros(opt.baud) + 999) / 1000);
+
+    Dv10Model model;
+    Dv10Slave slave(model, opt.slave);
+
+    spdlog::info("DV10 simulator on {} (slave {}, {} baud, latency {}±{} ms, CRC {:.1f}%, timeout {:.1f}%)",
+                 opt.link.empty() ? path : opt.link + " -> " + path, opt.slave.slaveId, opt.baud,
+                 opt.slave.latencyMs, opt.slave.latencyJitterMs,
+                 opt.slave.crcErrorRate * 100, opt.slave.timeoutRate * 100);
+
+    auto start = std::chrono::steady_clock::now();
+    auto lastStats = start;
+    uint64_t lastRequests = 0;
+
+    uint8_t rx[RTU_MAX_FRAME];
+    uint8_t tx[RTU_MAX_FRAME];
+    size_t rxLen = 0;
+
+    while (running) {
+        pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, rxLen > 0 ? silenceMs : 100);
+
+        if (ready > 0) {
+            ssize_t n = read(fd, rx + rxLen, sizeof(rx) - rxLen);
+            if (n > 0) rxLen += static_cast<size_t>(n);
+            if (rxLen < sizeof(rx)) continue;      // Keep reading until the line goes silent
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastStats >= STATS_INTERVAL) {
+            logStats(slave.stats(), std::chrono::duration<double>(now - lastStats).count(), lastRequests);
+            lastRequests = slave.stats().requests;
+            lastStats = now;
+        }
+
+        if (rxLen == 0) continue;
+
+        // t3.5 of silence: the request is complete
+        timespec frameEnd;
+        clock_gettime(CLOCK_MONOTONIC, &frameEnd);
+
+        model.update(std::chrono::duration<double>(now - start).count() * opt.speed);
+        size_t txLen = slave.handle(rx, rxLen, tx);
+        uint64_t airUs = rxLen * charUs;
+        rxLen = 0;
+        if (txLen == 0) continue;
+
+        // The request would still have been on the wire, then the unit thinks
+        sleepUntil(addMicros(frameEnd, airUs + static_cast<uint64_t>(slave.nextLatencyMs() * 1000)));
+        writePaced(fd, tx, txLen, charUs);
+    }
+
+    logStats(slave.stats(), std::chrono::duration<double>(std::chrono::steady_clock::now() - lastStats).count(),
+             lastRequests);
+    if (!opt.link.empty()) unlink(opt.link.c_str());
+    close(slaveFd);
+    close(fd);
+    return 0;
+}
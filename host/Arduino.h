@@ -0,0 +1,169 @@
+/**
+ * @file
+ * @brief Host (Linux) stand-in for the parts of the Arduino/ESP32 core the firmware uses
+ *
+ * Time comes from a virtual clock that only moves when the host driver
+ * (edge_host_main.cpp) or delay() advances it, so hours of firmware time
+ * run in seconds. millis() and micros() are 32-bit like on the ESP32, so
+ * wrap-around behaves the same.
+ *
+ * Serial is the console (stdout, or counted and dropped when quiet).
+ * Serial2 is the RS485 port, wired to a simulated DV10 (hal_sim_serial.h).
+ */
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <cmath>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <string>
+
+// ================ VIRTUAL CLOCK ================
+inline uint64_t halClockUs = 0;
+
+inline void halAdvanceUs(uint64_t us) { halClockUs += us; }
+
+inline uint32_t millis() { return static_cast<uint32_t>(halClockUs / 1000); }
+inline uint32_t micros() { return static_cast<uint32_t>(halClockUs); }
+inline void delay(uint32_t ms) { halAdvanceUs(static_cast<uint64_t>(ms) * 1000); }
+inline void delayMicroseconds(uint32_t us) { halAdvanceUs(us); }
+inline void yield() {}
+
+// ================ GPIO ================
+#define LOW    0
+#define HIGH   1
+#define INPUT  0
+#define OUTPUT 1
+
+inline void pinMode(uint8_t, uint8_t) {}
+inline void digitalWrite(uint8_t, uint8_t) {}
+
+// ================ ESP32 ================
+inline std::mt19937& halRng() {
+    static std::mt19937 rng(12345);
+    return rng;
+}
+
+inline uint32_t esp_random() { return halRng()(); }
+
+class EspClass {
+public:
+    uint32_t getFreeHeap() const { return 0; }
+    uint64_t getEfuseMac() const { return 0x0000A1B2C3D4E5F6ULL; }
+};
+inline EspClass ESP;
+
+// ================ FREERTOS ================
+// The host build runs the firmware single-threaded (DUAL_CORE 0), so the
+// spinlocks guarding state shared between the two tasks have nothing to do.
+struct portMUX_TYPE {
+    int owner;
+};
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+inline void portENTER_CRITICAL(portMUX_TYPE*) {}
+inline void portEXIT_CRITICAL(portMUX_TYPE*) {}
+
+// ================ PRINT / STREAM ================
+#define SERIAL_8N1 0x800001c
+#define SERIAL_8E1 0x800001e
+#define SERIAL_8O1 0x800001f
+#define SERIAL_8N2 0x800003c
+
+struct IPAddress {
+    uint8_t octets[4];
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buf, size_t len) {
+        for (size_t i = 0; i < len; i++) write(buf[i]);
+        return len;
+    }
+
+    size_t print(const char* s) { return write(reinterpret_cast<const uint8_t*>(s), strlen(s)); }
+    size_t print(char c) { return write(static_cast<uint8_t>(c)); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t print(unsigned v) { return printf("%u", v); }
+    size_t print(long v) { return printf("%ld", v); }
+    size_t print(unsigned long v) { return printf("%lu", v); }
+    size_t print(double v) { return printf("%.2f", v); }
+    size_t print(const IPAddress& ip) {
+        return printf("%u.%u.%u.%u", ip.octets[0], ip.octets[1], ip.octets[2], ip.octets[3]);
+    }
+
+    template <typename T>
+    size_t println(const T& v) { return print(v) + println(); }
+    size_t println() { return print("\r\n"); }
+
+    size_t printf(const char* fmt, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[512];
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if (n < 0) return 0;
+        return write(reinterpret_cast<const uint8_t*>(buf), n < (int)sizeof(buf) ? n : sizeof(buf) - 1);
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+// ================ CONSOLE (Serial) ================
+class HostConsole : public Stream {
+public:
+    bool quiet = false;           ///< Drop output (still counted)
+    uint64_t bytesOut = 0;
+
+    void begin(unsigned long) {}
+    size_t setTxBufferSize(size_t size) { return size; }
+    int availableForWrite() { return 4096; }     ///< Output never backs up here
+
+    size_t write(uint8_t c) override {
+        bytesOut++;
+        if (!quiet) fputc(c, stdout);
+        return 1;
+    }
+
+    size_t write(const uint8_t* buf, size_t len) override {
+        bytesOut += len;
+        if (!quiet) fwrite(buf, 1, len, stdout);
+        return len;
+    }
+
+    /// Queues characters as if they were typed on the console
+    void inject(const std::string& s) { input_.insert(input_.end(), s.begin(), s.end()); }
+
+    int available() override { return static_cast<int>(input_.size()); }
+    int peek() override { return input_.empty() ? -1 : input_.front(); }
+    int read() override {
+        if (input_.empty()) return -1;
+        int c = input_.front();
+        input_.pop_front();
+        return c;
+    }
+
+private:
+    std::deque<uint8_t> input_;
+};
+
+inline HostConsole Serial;
+
+#include "hal_sim_serial.h"
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * @file
+ * @brief Host stand-in for the ESP32 Preferences (NVS) library
+ *
+ * Keys live in a fixed table for the whole process, so a value survives
+ * end()/begin() like in flash, and nothing allocates. Only the getters and
+ * setters the firmware uses are here. The host driver can look at the table
+ * (or fill it before setup()) through a Preferences object of its own.
+ */
+
+#ifndef HOST_PREFERENCES_H
+#define HOST_PREFERENCES_H
+
+#include "Arduino.h"
+
+struct HalNvsEntry {
+    char ns[16];
+    char key[16];
+    uint32_t value;
+    bool used;
+};
+
+inline HalNvsEntry halNvs[32];
+
+class Preferences {
+public:
+    bool begin(const char* ns, bool readOnly = false) {
+        if (strlen(ns) >= sizeof(HalNvsEntry::ns)) return false;
+        ns_ = ns;
+        readOnly_ = readOnly;
+        return true;
+    }
+
+    void end() { ns_ = nullptr; }
+
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0) {
+        HalNvsEntry* e = find(key);
+        return e ? e->value : defaultValue;
+    }
+
+    uint16_t getUShort(const char* key, uint16_t defaultValue = 0) {
+        return static_cast<uint16_t>(getUInt(key, defaultValue));
+    }
+
+    size_t putUInt(const char* key, uint32_t value) { return put(key, value) ? 4 : 0; }
+    size_t putUShort(const char* key, uint16_t value) { return put(key, value) ? 2 : 0; }
+
+    bool isKey(const char* key) { return find(key) != nullptr; }
+
+private:
+    HalNvsEntry* find(const char* key) {
+        if (!ns_) return nullptr;
+        for (HalNvsEntry& e : halNvs) {
+            if (e.used && strcmp(e.ns, ns_) == 0 && strcmp(e.key, key) == 0) return &e;
+        }
+        return nullptr;
+    }
+
+    bool put(const char* key, uint32_t value) {
+        if (!ns_ || readOnly_ || strlen(key) >= sizeof(HalNvsEntry::key)) return false;
+        HalNvsEntry* e = find(key);
+        for (size_t i = 0; !e && i < sizeof(halNvs) / sizeof(halNvs[0]); i++) {
+            if (!halNvs[i].used) e = &halNvs[i];
+        }
+        if (!e) return false;       // NVS full
+        strcpy(e->ns, ns_);
+        strcpy(e->key, key);
+        e->value = value;
+        e->used = true;
+        return true;
+    }
+
+    const char* ns_ = nullptr;
+    bool readOnly_ = false;
+};
+
+#endif
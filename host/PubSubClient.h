@@ -0,0 +1,167 @@
+/**
+ * @file
+ * @brief In-process stand-in for PubSubClient, backed by a simulated broker
+ *
+ * Published messages go straight to HostBroker::onPublish (the host driver
+ * decodes and counts them), so no network or broker process is needed.
+ * The driver makes the broker go away by clearing HostBroker::up, and sends
+ * commands to the firmware with HostBroker::inject(); they are delivered by
+ * the next PubSubClient::loop(), like a real subscription. The will is
+ * published when the client loses its link while the broker is still up.
+ *
+ * Connecting, publishing and an empty loop() do not allocate, so the
+ * firmware's heap allocation counter only sees the firmware.
+ */
+
+#ifndef HOST_PUBSUBCLIENT_H
+#define HOST_PUBSUBCLIENT_H
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "WiFi.h"
+
+#define MQTT_CONNECTION_TIMEOUT  -4
+#define MQTT_CONNECTION_LOST     -3
+#define MQTT_CONNECT_FAILED      -2
+#define MQTT_DISCONNECTED        -1
+#define MQTT_CONNECTED            0
+
+/**
+ * @brief The simulated broker as seen from the firmware
+ */
+struct HostBroker {
+    struct Message {
+        std::string topic;
+        std::vector<uint8_t> payload;
+    };
+
+    bool up = true;
+    std::function<void(const char* topic, const uint8_t* payload, size_t len)> onPublish;
+
+    uint64_t connects = 0;
+    uint64_t publishes = 0;
+    uint64_t bytes = 0;
+
+    void inject(const std::string& topic, const uint8_t* payload, size_t len) {
+        inbound.push_back({topic, std::vector<uint8_t>(payload, payload + len)});
+    }
+
+    std::vector<Message> inbound;
+};
+
+inline HostBroker halBroker;
+
+class PubSubClient {
+public:
+    using Callback = void (*)(char*, uint8_t*, unsigned int);
+    static constexpr size_t MAX_SUBSCRIPTIONS = 8;
+
+    explicit PubSubClient(WiFiClient&) {}
+
+    PubSubClient& setServer(const char*, uint16_t) { return *this; }
+    PubSubClient& setCallback(Callback cb) { callback_ = cb; return *this; }
+    PubSubClient& setSocketTimeout(uint16_t seconds) { socketTimeoutS_ = seconds; return *this; }
+    bool setBufferSize(uint16_t size) { bufferSize_ = size; return true; }
+
+    bool connect(const char* id, const char* user, const char* pass) {
+        return connect(id, user, pass, nullptr, 0, false, nullptr);
+    }
+
+    /// The will is a C string, as in the library
+    bool connect(const char*, const char*, const char*, const char* willTopic, uint8_t, bool,
+                 const char* willMessage) {
+        if (WiFi.status() != WL_CONNECTED || !halBroker.up) {
+            // A dead broker costs the socket timeout, like a real TCP connect
+            delay(socketTimeoutS_ * 1000UL);
+            state_ = MQTT_CONNECTION_TIMEOUT;
+            return false;
+        }
+        halBroker.connects++;
+        halBroker.inbound.clear();
+        numSubscriptions_ = 0;
+        willTopic_[0] = '\0';
+        willLen_ = 0;
+        if (willTopic && willMessage) {
+            snprintf(willTopic_, sizeof(willTopic_), "%s", willTopic);
+            willLen_ = std::min(strlen(willMessage), sizeof(willMessage_));
+            memcpy(willMessage_, willMessage, willLen_);
+        }
+        state_ = MQTT_CONNECTED;
+        return true;
+    }
+
+    void disconnect() { state_ = MQTT_DISCONNECTED; }
+
+    bool connected() {
+        if (state_ == MQTT_CONNECTED && (!halBroker.up || WiFi.status() != WL_CONNECTED)) {
+            state_ = MQTT_CONNECTION_LOST;
+            if (halBroker.up && willTopic_[0]) publishWill();
+        }
+        return state_ == MQTT_CONNECTED;
+    }
+
+    int state() const { return state_; }
+
+    bool subscribe(const char* topic) {
+        if (!connected() || numSubscriptions_ == MAX_SUBSCRIPTIONS) return false;
+        snprintf(subscriptions_[numSubscriptions_++], sizeof(subscriptions_[0]), "%s", topic);
+        return true;
+    }
+
+    bool publish(const char* topic, const uint8_t* payload, unsigned int len) {
+        // Header (fixed + topic length + topic) must fit the buffer, as in the library
+        if (!connected() || 5 + strlen(topic) + len > bufferSize_) return false;
+        halBroker.publishes++;
+        halBroker.bytes += len;
+        if (halBroker.onPublish) halBroker.onPublish(topic, payload, len);
+        return true;
+    }
+
+    bool publish(const char* topic, const char* payload) {
+        return publish(topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload));
+    }
+
+    bool loop() {
+        if (!connected()) return false;
+        if (halBroker.inbound.empty()) return true;
+        std::vector<HostBroker::Message> inbound;
+        inbound.swap(halBroker.inbound);
+        for (HostBroker::Message& m : inbound) {
+            if (callback_ && subscribed(m.topic)) {
+                callback_(&m.topic[0], m.payload.data(), static_cast<unsigned int>(m.payload.size()));
+            }
+        }
+        return true;
+    }
+
+private:
+    /// The broker's side of a dropped connection
+    void publishWill() {
+        halBroker.publishes++;
+        halBroker.bytes += willLen_;
+        if (halBroker.onPublish) halBroker.onPublish(willTopic_, willMessage_, willLen_);
+    }
+
+    bool subscribed(const std::string& topic) const {
+        for (size_t i = 0; i < numSubscriptions_; i++) {
+            if (topic == subscriptions_[i]) return true;
+        }
+        return false;
+    }
+
+    Callback callback_ = nullptr;
+    uint16_t bufferSize_ = 256;
+    uint16_t socketTimeoutS_ = 15;
+    int state_ = MQTT_DISCONNECTED;
+    char subscriptions_[MAX_SUBSCRIPTIONS][128];
+    size_t numSubscriptions_ = 0;
+    char willTopic_[128] = "";
+    uint8_t willMessage_[256];
+    size_t willLen_ = 0;
+};
+
+#endif
@@ -0,0 +1,152 @@
+/**
+ * @file
+ * @brief Host stand-in for the ESP32 WiFi library
+ *
+ * The link state is the halWiFiUp flag, which the host driver toggles to
+ * simulate access point outages. begin() takes halWiFiAssocMs of virtual
+ * time to associate, like a real station.
+ *
+ * WiFiServer accepts connections the host driver opens with halTcpConnect();
+ * the driver plays the remote peer on the other end of each HostTcpConn.
+ */
+
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "Arduino.h"
+
+#define WL_IDLE_STATUS   0
+#define WL_CONNECTED     3
+#define WL_DISCONNECTED  6
+
+inline bool halWiFiUp = true;           ///< Access point reachable
+inline uint32_t halWiFiAssocMs = 1200;  ///< Association time after begin()
+
+class WiFiClass {
+public:
+    int begin(const char*, const char*) {
+        started_ = true;
+        beginMs_ = millis();
+        return status();
+    }
+
+    void disconnect() { started_ = false; }
+
+    int status() const {
+        if (!started_ || !halWiFiUp) return WL_DISCONNECTED;
+        return millis() - beginMs_ >= halWiFiAssocMs ? WL_CONNECTED : WL_IDLE_STATUS;
+    }
+
+    IPAddress localIP() const { return {{192, 168, 1, 50}}; }
+
+private:
+    bool started_ = false;
+    uint32_t beginMs_ = 0;
+};
+
+inline WiFiClass WiFi;
+
+/**
+ * @brief One simulated TCP connection to a WiFiServer
+ *
+ * The host driver is the peer: it appends to toServer and drains toPeer.
+ * Both buffers are reserved when the connection opens, so the firmware's
+ * reads and writes do not allocate.
+ */
+struct HostTcpConn {
+    uint16_t port = 0;
+    bool open = true;               ///< Peer still connected
+    bool accepted = false;          ///< Handed out by WiFiServer::accept()
+    bool closedByServer = false;    ///< The firmware called stop()
+    std::vector<uint8_t> toServer;
+    size_t rxPos = 0;               ///< Bytes of toServer the firmware has read
+    std::vector<uint8_t> toPeer;
+};
+
+/// All connections ever opened; a deque, so the firmware's pointers stay valid
+inline std::deque<HostTcpConn> halTcpConns;
+
+inline HostTcpConn& halTcpConnect(uint16_t port) {
+    HostTcpConn& c = halTcpConns.emplace_back();
+    c.port = port;
+    c.toServer.reserve(1024);
+    c.toPeer.reserve(4096);
+    return c;
+}
+
+/**
+ * @brief Socket handle: the PubSubClient handle (no connection) or the
+ * firmware's end of a HostTcpConn. Copies share the connection, like on
+ * the ESP32.
+ */
+class WiFiClient {
+public:
+    WiFiClient() = default;
+    explicit WiFiClient(HostTcpConn* conn) : conn_(conn) {}
+
+    explicit operator bool() { return connected(); }
+
+    uint8_t connected() { return conn_ && conn_->open && !conn_->closedByServer; }
+
+    int available() {
+        if (!connected()) return 0;
+        return static_cast<int>(conn_->toServer.size() - conn_->rxPos);
+    }
+
+    int read(uint8_t* buf, size_t size) {
+        size_t n = std::min<size_t>(size, available());
+        if (n == 0) return -1;
+        memcpy(buf, conn_->toServer.data() + conn_->rxPos, n);
+        conn_->rxPos += n;
+        if (conn_->rxPos == conn_->toServer.size()) {
+            conn_->toServer.clear();
+            conn_->rxPos = 0;
+        }
+        return static_cast<int>(n);
+    }
+
+    size_t write(const uint8_t* buf, size_t size) {
+        if (!connected()) return 0;
+        conn_->toPeer.insert(conn_->toPeer.end(), buf, buf + size);
+        return size;
+    }
+
+    void stop() {
+        if (conn_) conn_->closedByServer = true;
+        conn_ = nullptr;
+    }
+
+    int setNoDelay(bool) { return 0; }
+
+private:
+    HostTcpConn* conn_ = nullptr;
+};
+
+class WiFiServer {
+public:
+    explicit WiFiServer(uint16_t port) : port_(port) {}
+
+    void begin() { listening_ = true; }
+    void setNoDelay(bool) {}
+
+    /// The oldest connection to this port not accepted yet, if the link is up
+    WiFiClient accept() {
+        if (!listening_ || WiFi.status() != WL_CONNECTED) return WiFiClient();
+        for (HostTcpConn& c : halTcpConns) {
+            if (c.port == port_ && c.open && !c.accepted) {
+                c.accepted = true;
+                return WiFiClient(&c);
+            }
+        }
+        return WiFiClient();
+    }
+
+private:
+    uint16_t port_;
+    bool listening_ = false;
+};
+
+#endif
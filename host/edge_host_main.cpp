@@ -0,0 +1,836 @@
+/**
+ * @file
+ * @brief Runs the edge firmware (dataMQTTpub.cpp) as a Linux process on a virtual clock
+ *
+ * setup() and loop() are the unmodified firmware; Arduino.h, WiFi.h and
+ * PubSubClient.h in this directory replace the ESP32 core with a simulated
+ * DV10 on Serial2, an in-process broker and a clock that only moves when
+ * this driver advances it. While the bus is busy the clock moves in small
+ * steps so the Modbus timing stays realistic; when the firmware is idle it
+ * jumps, so 24 hours of firmware time take seconds.
+ *
+ * Every message the firmware publishes is decoded again, and the Sparkplug
+ * sequence numbers are checked, so a run doubles as an end-to-end test.
+ * DCMD commands are timed from the moment they are sent until the unit
+ * takes the write (actuation) and until the DDATA that confirms them.
+ * Simulated Modbus TCP clients poll the firmware's register image and
+ * check every response against their request. The requests each unit gets
+ * are counted per second of transitional run mode (starting, stopping) and
+ * of steady state, and the adaptive poll rate must make the first higher.
+ *
+ * Usage: edge_host [options]
+ *   --hours H             Simulated time to run (default 24)
+ *   --verbose             Show the firmware console output
+ *   --units N             DV10 units on the bus, addresses 1..N (default 1)
+ *   --crc-rate P          Share of slave responses with a broken CRC
+ *   --timeout-rate P      Share of requests the slaves ignore
+ *   --latency MS          Slave response latency (default 20)
+ *   --tcp-clients N       Modbus TCP clients polling port 502 once a second (default 0)
+ *   --link BAUD-FORMAT    Line setting of the units, e.g. 38400-8E1 (default 9600-8N1)
+ *   --unit-link ID:BAUD-FORMAT
+ *                         Line setting of one unit, repeatable, e.g. 3:9600-8N1
+ *   --min-gap MS          Units miss requests sooner than this after their response
+ *   --max-read N          Units reject reads of more than N registers
+ *   --expect-link BAUD-FORMAT-GAP-BLOCK
+ *                         Fail unless commissioning stored this setting, e.g. 38400-8E1-5-16
+ *   --max-bad-quality N   Fail if more DDATA metrics than this go out with Quality bad
+ *   --at SEC:ACTION       Scheduled action, repeatable. ACTION is
+ *                         wifi-down, wifi-up, broker-down, broker-up,
+ *                         kill-ID / revive-ID (unit stops / starts answering),
+ *                         noextra-ID / extra-ID (unit without / with regs 292-293),
+ *                         reject-ID-REG (unit answers input REG with an exception),
+ *                         fanmode-DEVICE-MODE (DCMD FanMode, e.g. fanmode-AHU_2-1),
+ *                         tcpwrite-UNIT-MODE (FC06 to holding 367 from the first
+ *                         Modbus TCP client, e.g. tcpwrite-2-1),
+ *                         rebirth (NCMD from a host application) or
+ *                         console text, e.g. "7200:f", "3600:i60\n" or "60:c" (commissioning)
+ *
+ * The firmware polls the slaves in its DV10_SLAVES table; an address
+ * without a unit behaves like a dead slave.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include "Arduino.h"
+#include "Preferences.h"
+#include "PubSubClient.h"
+#include "../sparkplug_b.h"
+#include "../modbus_rtu_master.h"
+
+// Firmware entry points and the state the driver looks at
+void setup();
+void loop();
+uint32_t backlogSize();
+bool sweepInProgress();
+extern ModbusRtuMaster modbus;
+extern std::atomic<uint32_t> heapAllocCount;
+extern char topicNCmd[];
+
+namespace {
+
+constexpr uint64_t BUSY_STEP_US = 250;      ///< Below one character time at 38400 baud
+constexpr uint64_t IDLE_STEP_US = 10000;    ///< Granularity of timers while idle
+
+struct Action {
+    uint64_t atUs;
+    std::string what;
+};
+
+struct PublishStats {
+    uint64_t births = 0;
+    uint64_t deaths = 0;            ///< DDEATH
+    uint64_t nodeDeaths = 0;        ///< NDEATH, published by the broker as the will
+    uint64_t ddata = 0;
+    uint64_t ndata = 0;             ///< Bus statistics
+    uint64_t ddataBytes = 0;
+    uint64_t metrics = 0;
+    uint64_t historical = 0;
+    uint64_t badQuality = 0;        ///< DDATA metrics sent with Quality bad
+    uint64_t historicalBad = 0;     ///< ... of them replayed from the backlog
+    uint64_t json = 0;              ///< Payloads that were not protobuf
+    uint64_t decodeErrors = 0;
+    uint64_t seqErrors = 0;
+    uint64_t bdSeqErrors = 0;       ///< bdSeq not advanced by a connect, NDEATH not matching its NBIRTH
+    int nextSeq = -1;               ///< Expected seq, -1 until the first NBIRTH
+    int birthBdSeq = -1;            ///< bdSeq of the last NBIRTH
+    uint64_t birthConnect = 0;      ///< HostBroker::connects at the last NBIRTH
+};
+
+PublishStats pub;
+uint32_t hostAllocs = 0;            ///< Heap allocations of this driver, not the firmware
+
+/// What the driver knows about a Sparkplug device from its DBIRTH
+struct Device {
+    std::string dcmdTopic;
+    uint64_t fanModeAlias = 0;
+};
+
+std::map<std::string, Device> devices;
+
+/// A DCMD FanMode waiting for the DDATA with its read-back value
+struct PendingCommand {
+    std::string device;
+    uint16_t value;
+    uint64_t sentUs;
+    SimSerial::Unit* unit;          ///< Unit behind the device, nullptr if none
+    uint64_t writesAtSend;
+    bool actuated;
+};
+
+/// Device IDs of the firmware's slave table, to find the unit behind a device
+struct SlaveName {
+    uint8_t id;
+    const char* deviceId;
+};
+#ifdef DV10_SLAVES
+const SlaveName slaveNames[] = {DV10_SLAVES};
+#else
+const SlaveName slaveNames[] = {{1, "Sensor_Unit"}};
+#endif
+
+struct CommandStats {
+    uint64_t sent = 0;
+    uint64_t confirmed = 0;
+    uint64_t failed = 0;            ///< Answered with another value or bad quality
+    uint64_t lost = 0;              ///< Never answered, a later command was
+    uint64_t totalUs = 0;           ///< Of the confirmed ones
+    uint64_t maxUs = 0;
+    uint64_t actuated = 0;          ///< Written to the unit
+    uint64_t actuationTotalUs = 0;
+    uint64_t actuationMaxUs = 0;
+};
+
+std::vector<PendingCommand> pendingCommands;
+CommandStats commands;
+
+/// Requests the units got, split by the run mode they were in
+struct PollRateStats {
+    uint64_t transientRequests = 0;
+    uint64_t transientSeconds = 0;      ///< Unit-seconds in run modes 1-4, 10, 11
+    uint64_t steadyRequests = 0;
+    uint64_t steadySeconds = 0;
+    std::vector<uint64_t> lastRequests;
+    std::vector<uint64_t> lastResponses;
+    uint64_t nextUs = 1000000;
+};
+
+PollRateStats pollRate;
+
+/// Once a simulated second: attributes each unit's new requests to its run mode.
+/// A second without a response (unit dead or on another line setting) is left out.
+void samplePollRate() {
+    if (halClockUs < pollRate.nextUs) return;
+    pollRate.nextUs += 1000000;
+    for (size_t i = 0; i < Serial2.numUnits(); i++) {
+        SimSerial::Unit& unit = Serial2.unit(i);
+        uint64_t requests = unit.slave.stats().requests;
+        uint64_t n = requests - pollRate.lastRequests[i];
+        pollRate.lastRequests[i] = requests;
+        uint64_t responses = unit.slave.stats().responses;
+        bool answered = responses != pollRate.lastResponses[i];
+        pollRate.lastResponses[i] = responses;
+        if (!answered) continue;
+        uint16_t mode = unit.model.runMode();
+        if ((mode >= 1 && mode <= 4) || mode == 10 || mode == 11) {
+            pollRate.transientRequests += n;
+            pollRate.transientSeconds++;
+        } else {
+            pollRate.steadyRequests += n;
+            pollRate.steadySeconds++;
+        }
+    }
+}
+
+constexpr uint16_t MODBUS_TCP_PORT = 502;
+constexpr uint64_t TCP_POLL_US = 1000000;
+constexpr uint64_t TCP_RESPONSE_TIMEOUT_US = 10000000;   ///< Longer than any pending write
+
+/// A Modbus TCP client (e.g. a BMS) reading the firmware's register image
+struct TcpClient {
+    HostTcpConn* conn = nullptr;
+    uint16_t nextTid = 0;
+    uint64_t nextPollUs = 0;
+    unsigned step = 0;              ///< Position in the polling cycle
+    bool waiting = false;
+    uint8_t request[12];            ///< Outstanding request
+    uint64_t sentUs = 0;
+    std::vector<uint8_t> rx;
+};
+
+struct TcpStats {
+    uint64_t connects = 0;
+    uint64_t requests = 0;
+    uint64_t responses = 0;
+    uint64_t exceptions = 0;
+    uint64_t malformed = 0;         ///< Wrong transaction id, unit, function or length
+    uint64_t timeouts = 0;          ///< No response within TCP_RESPONSE_TIMEOUT_US
+    uint64_t wrongFanMode = 0;      ///< FC03 367 differs from the unit while no write is in flight
+    uint64_t totalUs = 0;           ///< Of the read responses
+    uint64_t maxUs = 0;
+    uint64_t writes = 0;
+    uint64_t writesOk = 0;
+    uint64_t writeResponses = 0;
+    uint64_t writeTotalUs = 0;
+    uint64_t writeMaxUs = 0;
+};
+
+std::vector<TcpClient> tcpClients;
+std::vector<std::pair<uint8_t, uint16_t>> tcpWrites;   ///< Unit and value, sent by client 0
+TcpStats tcp;
+
+// Device name = last level of a DBIRTH/DDATA topic
+std::string deviceOf(const char* topic) {
+    const char* slash = strrchr(topic, '/');
+    return slash ? slash + 1 : topic;
+}
+
+// A FanMode DDATA answers the newest command to the device; older ones
+// still waiting were lost (e.g. sent while the firmware was reconnecting)
+void checkCommands(const std::string& device, const SpbMetricView& m) {
+    int newest = -1;
+    for (size_t i = 0; i < pendingCommands.size(); i++) {
+        if (pendingCommands[i].device == device) newest = static_cast<int>(i);
+    }
+    if (newest < 0) return;
+
+    const PendingCommand& c = pendingCommands[newest];
+    if (!m.isNull && m.intValue == c.value && m.quality == SPB_QUALITY_GOOD) {
+        uint64_t us = halClockUs - c.sentUs;
+        commands.confirmed++;
+        commands.totalUs += us;
+        commands.maxUs = std::max(commands.maxUs, us);
+    } else {
+        commands.failed++;
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < pendingCommands.size(); i++) {
+        if (pendingCommands[i].device != device) {
+            pendingCommands[kept++] = pendingCommands[i];
+        } else if (static_cast<int>(i) != newest) {
+            commands.lost++;
+        }
+    }
+    pendingCommands.resize(kept);
+}
+
+void onPublishImpl(const char* topic, const uint8_t* payload, size_t len);
+
+void onPublish(const char* topic, const uint8_t* payload, size_t len) {
+    uint32_t before = heapAllocCount;
+    onPublishImpl(topic, payload, len);
+    hostAllocs += heapAllocCount - before;
+}
+
+void onPublishImpl(const char* topic, const uint8_t* payload, size_t len) {
+    bool nbirth = strstr(topic, "/NBIRTH/") != nullptr;
+    bool dbirth = strstr(topic, "/DBIRTH/") != nullptr;
+    bool ddata = strstr(topic, "/DDATA/") != nullptr;
+    bool ndeath = strstr(topic, "/NDEATH/") != nullptr;
+    if (nbirth || strstr(topic, "/DBIRTH/")) pub.births++;
+    if (strstr(topic, "/DDEATH/")) pub.deaths++;
+    if (ndeath) pub.nodeDeaths++;
+    if (strstr(topic, "/NDATA/")) pub.ndata++;
+    if (ddata) {
+        pub.ddata++;
+        pub.ddataBytes += len;
+    }
+
+    if (len > 0 && payload[0] == '{') {
+        pub.json++;
+        return;
+    }
+
+    SpbPayloadView header;
+    SpbMetricView metrics[64];
+    if (!spbDecodePayload(payload, len, header, metrics, 64)) {
+        pub.decodeErrors++;
+        return;
+    }
+
+    // NBIRTH starts at 0, every following message of the node is +1 (mod 256)
+    if (nbirth) pub.nextSeq = 0;
+    if (pub.nextSeq >= 0 && header.hasSeq) {
+        if (header.seq != static_cast<uint64_t>(pub.nextSeq)) pub.seqErrors++;
+        pub.nextSeq = static_cast<int>((header.seq + 1) % 256);
+    }
+
+    size_t n = std::min<size_t>(header.numMetrics, 64);
+    if (nbirth || ndeath) {
+        int bdSeq = -1;
+        for (size_t i = 0; i < n; i++) {
+            if (metrics[i].nameLen == 5 && memcmp(metrics[i].name, "bdSeq", 5) == 0) {
+                bdSeq = static_cast<int>(metrics[i].intValue);
+            }
+        }
+        // Every connect advances bdSeq, a rebirth keeps it; the will carries the one of its session
+        bool sameSession = ndeath || halBroker.connects == pub.birthConnect;
+        if (bdSeq < 0 || (bdSeq == pub.birthBdSeq) != sameSession) pub.bdSeqErrors++;
+        if (nbirth) {
+            pub.birthBdSeq = bdSeq;
+            pub.birthConnect = halBroker.connects;
+        }
+    }
+    if (dbirth) {
+        Device& d = devices[deviceOf(topic)];
+        d.dcmdTopic = topic;
+        d.dcmdTopic.replace(d.dcmdTopic.find("/DBIRTH/"), 8, "/DCMD/");
+        for (size_t i = 0; i < n; i++) {
+            if (metrics[i].nameLen == 7 && memcmp(metrics[i].name, "FanMode", 7) == 0) {
+                d.fanModeAlias = metrics[i].alias;
+            }
+        }
+    }
+
+    if (ddata) {
+        std::string device = deviceOf(topic);
+        uint64_t fanModeAlias = devices[device].fanModeAlias;
+        pub.metrics += header.numMetrics;
+        for (size_t i = 0; i < n; i++) {
+            if (metrics[i].isHistorical) pub.historical++;
+            if (metrics[i].quality == SPB_QUALITY_BAD) {
+                pub.badQuality++;
+                if (metrics[i].isHistorical) pub.historicalBad++;
+                if (!metrics[i].isNull) pub.decodeErrors++;     // A stale value must not look like data
+            }
+            if (fanModeAlias != 0 && metrics[i].alias == fanModeAlias) checkCommands(device, metrics[i]);
+        }
+    }
+}
+
+void sendRebirthCommand() {
+    uint8_t buf[64];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    spbPayloadHeader(w, millis(), 0);
+    size_t m = spbBeginMetric(w, "Node Control/Rebirth", SPB_BOOLEAN, millis());
+    spbMetricBool(w, true);
+    spbEndMetric(w, m);
+    halBroker.inject(topicNCmd, w.buf, w.len);
+}
+
+// DCMD FanMode by name, as a host application that has not mapped the aliases sends it
+void sendFanModeCommand(const std::string& device, uint16_t value) {
+    auto it = devices.find(device);
+    if (it == devices.end()) {
+        std::fprintf(stderr, "[host] %s has not been born, command not sent\n", device.c_str());
+        return;
+    }
+    if (!halBroker.up || !halWiFiUp) {
+        std::fprintf(stderr, "[host] broker unreachable, command not sent\n");
+        return;
+    }
+    uint8_t buf[64];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    spbPayloadHeader(w, millis(), 0);
+    size_t m = spbBeginMetric(w, "FanMode", SPB_UINT16, millis());
+    spbMetricUInt(w, value);
+    spbEndMetric(w, m);
+    halBroker.inject(it->second.dcmdTopic, w.buf, w.len);
+
+    SimSerial::Unit* unit = nullptr;
+    for (const SlaveName& n : slaveNames) {
+        if (device == n.deviceId) unit = Serial2.findUnit(n.id);
+    }
+    pendingCommands.push_back({device, value, halClockUs, unit,
+                               unit ? unit->slave.stats().writes : 0, false});
+    commands.sent++;
+}
+
+// Actuation = the unit accepted a register write after the command was sent.
+// The write belongs to the newest command to the unit; older ones were lost.
+// SimSerial hands the request over as it is written, so its air time is added.
+void checkActuation() {
+    for (size_t i = 0; i < pendingCommands.size(); i++) {
+        PendingCommand& c = pendingCommands[i];
+        if (c.actuated || !c.unit || c.unit->slave.stats().writes == c.writesAtSend) continue;
+        c.actuated = true;
+        bool superseded = false;
+        for (size_t j = i + 1; j < pendingCommands.size(); j++) {
+            if (pendingCommands[j].unit == c.unit) superseded = true;
+        }
+        if (superseded) continue;
+        uint64_t us = halClockUs - c.sentUs + 8 * 11000000ULL / Serial2.baud();
+        commands.actuated++;
+        commands.actuationTotalUs += us;
+        commands.actuationMaxUs = std::max(commands.actuationMaxUs, us);
+    }
+}
+
+// Request with MBAP header; 'arg' is the count of a read or the value of a write
+void sendTcpRequest(TcpClient& c, uint8_t unit, uint8_t fc, uint16_t addr, uint16_t arg) {
+    uint8_t* r = c.request;
+    uint16_t tid = ++c.nextTid;
+    const uint8_t frame[12] = {uint8_t(tid >> 8), uint8_t(tid), 0, 0, 0, 6, unit, fc,
+                               uint8_t(addr >> 8), uint8_t(addr), uint8_t(arg >> 8), uint8_t(arg)};
+    memcpy(r, frame, sizeof(frame));
+    c.conn->toServer.insert(c.conn->toServer.end(), r, r + 12);
+    c.waiting = true;
+    c.sentUs = halClockUs;
+    tcp.requests++;
+    if (fc == RTU_FC_WRITE_SINGLE) tcp.writes++;
+}
+
+bool writeInFlight(uint8_t unit) {
+    for (const auto& w : tcpWrites) {
+        if (w.first == unit) return true;
+    }
+    for (const TcpClient& c : tcpClients) {
+        if (c.waiting && c.request[7] == RTU_FC_WRITE_SINGLE && c.request[6] == unit) return true;
+    }
+    for (const SlaveName& n : slaveNames) {
+        if (n.id != unit) continue;
+        for (const PendingCommand& p : pendingCommands) {
+            if (p.device == n.deviceId) return true;
+        }
+    }
+    return false;
+}
+
+// Checks a complete response against the outstanding request
+void checkTcpResponse(TcpClient& c, const uint8_t* resp, size_t len) {
+    const uint8_t* req = c.request;
+    uint8_t fc = req[7];
+    uint64_t us = halClockUs - c.sentUs;
+    bool write = fc == RTU_FC_WRITE_SINGLE;
+    c.waiting = false;
+    tcp.responses++;
+
+    if (memcmp(resp, req, 4) != 0 || resp[6] != req[6] || len < 9) {
+        tcp.malformed++;
+        return;
+    }
+    if (write) {
+        tcp.writeResponses++;
+        tcp.writeTotalUs += us;
+        tcp.writeMaxUs = std::max(tcp.writeMaxUs, us);
+    } else {
+        tcp.totalUs += us;
+        tcp.maxUs = std::max(tcp.maxUs, us);
+    }
+    if (resp[7] == (fc | 0x80)) {
+        if (len == 9) tcp.exceptions++; else tcp.malformed++;
+        return;
+    }
+    if (resp[7] != fc) {
+        tcp.malformed++;
+        return;
+    }
+    if (write) {
+        if (len == 12 && memcmp(resp + 4, req + 4, 8) == 0) tcp.writesOk++; else tcp.malformed++;
+        return;
+    }
+
+    uint16_t count = (req[10] << 8) | req[11];
+    if (len != 9 + 2u * count || resp[8] != 2 * count) {
+        tcp.malformed++;
+        return;
+    }
+    if (fc == RTU_FC_READ_HOLDING && !writeInFlight(req[6])) {
+        SimSerial::Unit* unit = Serial2.findUnit(req[6]);
+        uint16_t value = (resp[9] << 8) | resp[10];
+        if (unit && value != unit->model.fanMode()) tcp.wrongFanMode++;
+    }
+}
+
+// Every client keeps one request outstanding at most: the temperatures, the
+// pressures and flows, the extra flows and the fan mode of a unit in turn,
+// one unit after another.
+// Clients reconnect after a WiFi outage, which drops their connections.
+void serviceTcpClients() {
+    for (size_t i = 0; i < tcpClients.size(); i++) {
+        TcpClient& c = tcpClients[i];
+        if (c.conn && (!halWiFiUp || c.conn->closedByServer)) {
+            c.conn->open = false;
+            c.conn = nullptr;
+            c.waiting = false;
+        }
+        if (!c.conn) {
+            if (!halWiFiUp) continue;
+            c.conn = &halTcpConnect(MODBUS_TCP_PORT);
+            c.rx.clear();
+            tcp.connects++;
+        }
+
+        std::vector<uint8_t>& in = c.conn->toPeer;
+        c.rx.insert(c.rx.end(), in.begin(), in.end());
+        in.clear();
+        while (c.rx.size() >= 6) {
+            size_t frameLen = 6 + ((c.rx[4] << 8) | c.rx[5]);
+            if (c.rx.size() < frameLen) break;
+            if (c.waiting) checkTcpResponse(c, c.rx.data(), frameLen); else tcp.malformed++;
+            c.rx.erase(c.rx.begin(), c.rx.begin() + frameLen);
+        }
+
+        if (c.waiting) {
+            if (halClockUs - c.sentUs < TCP_RESPONSE_TIMEOUT_US) continue;
+            tcp.timeouts++;
+            c.waiting = false;
+        }
+        if (i == 0 && !tcpWrites.empty()) {
+            sendTcpRequest(c, tcpWrites.front().first, RTU_FC_WRITE_SINGLE, 367, tcpWrites.front().second);
+            tcpWrites.erase(tcpWrites.begin());
+            continue;
+        }
+        if (halClockUs < c.nextPollUs) continue;
+        c.nextPollUs = halClockUs + TCP_POLL_US;
+
+        size_t numUnits = sizeof(slaveNames) / sizeof(slaveNames[0]);
+        uint8_t unit = slaveNames[(i + c.step / 4) % numUnits].id;
+        switch (c.step++ % 4) {
+            case 0: sendTcpRequest(c, unit, RTU_FC_READ_INPUT, 0, 9); break;
+            case 1: sendTcpRequest(c, unit, RTU_FC_READ_INPUT, 12, 4); break;
+            case 2: sendTcpRequest(c, unit, RTU_FC_READ_INPUT, 292, 2); break;
+            default: sendTcpRequest(c, unit, RTU_FC_READ_HOLDING, 367, 1); break;
+        }
+    }
+}
+
+void runAction(const std::string& what) {
+    std::fprintf(stderr, "[host] t=%.1f s: %s\n", halClockUs / 1e6, what.c_str());
+    if (what == "wifi-down") {
+        halWiFiUp = false;
+    } else if (what == "wifi-up") {
+        halWiFiUp = true;
+    } else if (what == "broker-down") {
+        halBroker.up = false;
+    } else if (what == "broker-up") {
+        halBroker.up = true;
+    } else if (what == "rebirth") {
+        sendRebirthCommand();
+    } else if (what.rfind("kill-", 0) == 0 || what.rfind("revive-", 0) == 0) {
+        bool kill = what[0] == 'k';
+        SimSerial::Unit* unit = Serial2.findUnit(std::atoi(what.c_str() + (kill ? 5 : 7)));
+        if (unit) unit->slave.config().timeoutRate = kill ? 1.0 : 0.0;
+    } else if (what.rfind("fanmode-", 0) == 0 && what.rfind('-') > 8) {
+        size_t dash = what.rfind('-');
+        sendFanModeCommand(what.substr(8, dash - 8), static_cast<uint16_t>(std::atoi(what.c_str() + dash + 1)));
+    } else if (what.rfind("tcpwrite-", 0) == 0 && what.rfind('-') > 9) {
+        size_t dash = what.rfind('-');
+        if (tcpClients.empty()) {
+            std::fprintf(stderr, "[host] no Modbus TCP clients (--tcp-clients), write not sent\n");
+        } else {
+            tcpWrites.push_back({static_cast<uint8_t>(std::atoi(what.c_str() + 9)),
+                                 static_cast<uint16_t>(std::atoi(what.c_str() + dash + 1))});
+        }
+    } else if (what.rfind("reject-", 0) == 0 && what.rfind('-') > 7) {
+        SimSerial::Unit* unit = Serial2.findUnit(std::atoi(what.c_str() + 7));
+        if (unit) unit->model.setRejected(static_cast<uint16_t>(std::atoi(what.c_str() + what.rfind('-') + 1)));
+    } else if (what.rfind("noextra-", 0) == 0 || what.rfind("extra-", 0) == 0) {
+        bool present = what[0] == 'e';
+        SimSerial::Unit* unit = Serial2.findUnit(std::atoi(what.c_str() + (present ? 6 : 8)));
+        if (unit) unit->model.setExtraFlow(present);
+    } else {
+        Serial.inject(what);
+    }
+}
+
+// "\n" in a console action means Enter
+std::string unescape(const std::string& s) {
+    std::string out;
+    for (size_t i = 0; i < s.size(); i++) {
+        if (s[i] == '\\' && i + 1 < s.size() && s[i + 1] == 'n') {
+            out += '\n';
+            i++;
+        } else {
+            out += s[i];
+        }
+    }
+    return out;
+}
+
+const char* const formatNames[] = {"8N1", "8E1", "8O1", "8N2"};
+const uint32_t formats[] = {SERIAL_8N1, SERIAL_8E1, SERIAL_8O1, SERIAL_8N2};
+
+const char* formatName(uint32_t format) {
+    for (size_t i = 0; i < 4; i++) {
+        if (formats[i] == format) return formatNames[i];
+    }
+    return "?";
+}
+
+/// "38400-8E1" -> baud and format; false if it is not one
+bool parseLink(const std::string& spec, unsigned long& baud, uint32_t& format) {
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos) return false;
+    baud = std::strtoul(spec.c_str(), nullptr, 10);
+    std::string name = spec.substr(dash + 1, 3);
+    for (size_t i = 0; i < 4; i++) {
+        if (name == formatNames[i]) {
+            format = formats[i];
+            return baud > 0;
+        }
+    }
+    return false;
+}
+
+void usage(const char* prog) {
+    std::fprintf(stderr,
+                 "Usage: %s [--hours H] [--verbose] [--units N] [--crc-rate P] [--timeout-rate P]\n"
+                 "          [--latency MS] [--tcp-clients N] [--link BAUD-FORMAT] [--unit-link ID:BAUD-FORMAT]...\n"
+                 "          [--min-gap MS] [--max-read N] [--max-bad-quality N] [--expect-link BAUD-FORMAT-GAP-BLOCK] [--at SEC:ACTION]...\n",
+                 prog);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    double hours = 24.0;
+    bool verbose = false;
+    std::vector<Action> actions;
+    Dv10SlaveConfig faults;
+    int units = 1;
+    int numTcpClients = 0;
+    unsigned long linkBaud = 9600;
+    uint32_t linkFormat = SERIAL_8N1;
+    std::map<int, std::pair<unsigned long, uint32_t>> unitLinks;
+    double minGapMs = 0;
+    std::string expectLink;
+    long maxBadQuality = -1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--verbose") {
+            verbose = true;
+        } else if (arg == "--hours" && hasValue) {
+            hours = std::atof(argv[++i]);
+        } else if (arg == "--units" && hasValue) {
+            units = std::atoi(argv[++i]);
+        } else if (arg == "--crc-rate" && hasValue) {
+            faults.crcErrorRate = std::atof(argv[++i]);
+        } else if (arg == "--timeout-rate" && hasValue) {
+            faults.timeoutRate = std::atof(argv[++i]);
+        } else if (arg == "--latency" && hasValue) {
+            faults.latencyMs = std::atof(argv[++i]);
+        } else if (arg == "--tcp-clients" && hasValue) {
+            numTcpClients = std::atoi(argv[++i]);
+        } else if (arg == "--link" && hasValue) {
+            if (!parseLink(argv[++i], linkBaud, linkFormat)) {
+                usage(argv[0]);
+                return 1;
+            }
+        } else if (arg == "--unit-link" && hasValue) {
+            std::string spec = argv[++i];
+            size_t colon = spec.find(':');
+            std::pair<unsigned long, uint32_t> link;
+            if (colon == std::string::npos || !parseLink(spec.substr(colon + 1), link.first, link.second)) {
+                usage(argv[0]);
+                return 1;
+            }
+            unitLinks[std::atoi(spec.substr(0, colon).c_str())] = link;
+        } else if (arg == "--min-gap" && hasValue) {
+            minGapMs = std::atof(argv[++i]);
+        } else if (arg == "--max-read" && hasValue) {
+            faults.maxReadRegs = static_cast<uint16_t>(std::atoi(argv[++i]));
+        } else if (arg == "--max-bad-quality" && hasValue) {
+            maxBadQuality = std::atol(argv[++i]);
+        } else if (arg == "--expect-link" && hasValue) {
+            expectLink = argv[++i];
+        } else if (arg == "--at" && hasValue) {
+            std::string spec = argv[++i];
+            size_t colon = spec.find(':');
+            if (colon == std::string::npos) {
+                usage(argv[0]);
+                return 1;
+            }
+            actions.push_back({static_cast<uint64_t>(std::atof(spec.substr(0, colon).c_str()) * 1e6),
+                               unescape(spec.substr(colon + 1))});
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    std::stable_sort(actions.begin(), actions.end(),
+                     [](const Action& a, const Action& b) { return a.atUs < b.atUs; });
+
+    for (int id = 1; id <= units; id++) {
+        SimSerial::Unit& unit = Serial2.addUnit(static_cast<uint8_t>(id));
+        Dv10SlaveConfig& config = unit.slave.config();
+        config.crcErrorRate = faults.crcErrorRate;
+        config.timeoutRate = faults.timeoutRate;
+        config.latencyMs = faults.latencyMs;
+        config.maxReadRegs = faults.maxReadRegs;
+        auto own = unitLinks.find(id);
+        unit.baud = own != unitLinks.end() ? own->second.first : linkBaud;
+        unit.format = own != unitLinks.end() ? own->second.second : linkFormat;
+        unit.minGapMs = minGapMs;
+    }
+    pollRate.lastRequests.assign(Serial2.numUnits(), 0);
+    pollRate.lastResponses.assign(Serial2.numUnits(), 0);
+
+    Serial.quiet = !verbose;
+    halBroker.onPublish = onPublish;
+    tcpClients.resize(numTcpClients);
+    for (int i = 0; i < numTcpClients; i++) {
+        tcpClients[i].nextPollUs = 5000000 + i * TCP_POLL_US / numTcpClients;   // Spread over a second
+    }
+
+    auto wallStart = std::chrono::steady_clock::now();
+    uint64_t endUs = static_cast<uint64_t>(hours * 3600e6);
+    uint64_t loops = 0;
+    uint64_t busyLoops = 0;
+    size_t nextAction = 0;
+
+    setup();
+    uint32_t allocsAfterSetup = heapAllocCount;
+    hostAllocs = 0;
+
+    while (halClockUs < endUs) {
+        while (nextAction < actions.size() && actions[nextAction].atUs <= halClockUs) {
+            uint32_t before = heapAllocCount;
+            runAction(actions[nextAction++].what);
+            hostAllocs += heapAllocCount - before;
+        }
+
+        loop();
+        loops++;
+        if (!pendingCommands.empty()) checkActuation();
+        if (!tcpClients.empty()) {
+            uint32_t before = heapAllocCount;
+            serviceTcpClients();
+            hostAllocs += heapAllocCount - before;
+        }
+        samplePollRate();
+
+        bool busy = modbus.busy() || sweepInProgress() || Serial2.pending();
+        if (busy) busyLoops++;
+        halAdvanceUs(busy ? BUSY_STEP_US : IDLE_STEP_US);
+    }
+
+    double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+    Dv10Slave::Stats slave;
+    uint64_t missedRequests = 0;
+    for (size_t i = 0; i < Serial2.numUnits(); i++) {
+        const Dv10Slave::Stats& u = Serial2.unit(i).slave.stats();
+        slave.requests += u.requests;
+        slave.responses += u.responses;
+        slave.exceptions += u.exceptions;
+        slave.injectedCrc += u.injectedCrc;
+        slave.injectedTimeouts += u.injectedTimeouts;
+        missedRequests += Serial2.unit(i).missedRequests;
+    }
+
+    std::printf("Simulated %.2f h in %.2f s wall time (%.0fx)\n", halClockUs / 3600e6, wallS,
+                halClockUs / 1e6 / (wallS > 0 ? wallS : 1e-9));
+    std::printf("Loops:        %llu (%llu with the bus busy)\n",
+                (unsigned long long)loops, (unsigned long long)busyLoops);
+    std::printf("Modbus:       %llu requests, %llu responses, %llu exceptions, "
+                "%llu injected CRC errors, %llu injected timeouts\n",
+                (unsigned long long)slave.requests, (unsigned long long)slave.responses,
+                (unsigned long long)slave.exceptions, (unsigned long long)slave.injectedCrc,
+                (unsigned long long)slave.injectedTimeouts);
+    Preferences nvs;
+    nvs.begin("rs485", true);
+    char stored[48] = "defaults, not commissioned";
+    if (nvs.isKey("baud")) {
+        std::snprintf(stored, sizeof(stored), "%lu-%s-%u-%u", (unsigned long)nvs.getUInt("baud"),
+                      formatName(nvs.getUInt("format")), nvs.getUShort("gap"), nvs.getUShort("block"));
+    }
+    nvs.end();
+    std::printf("RS485:        %lu %s, stored %s, %llu requests missed by the units (line setting or gap)\n",
+                Serial2.baud(), formatName(Serial2.format()), stored, (unsigned long long)missedRequests);
+    double transientRate = pollRate.transientSeconds ?
+        double(pollRate.transientRequests) / pollRate.transientSeconds : 0.0;
+    double steadyRate = pollRate.steadySeconds ? double(pollRate.steadyRequests) / pollRate.steadySeconds : 0.0;
+    std::printf("Poll rate:    %.2f requests/s per unit starting or stopping (%llu s), %.2f steady (%llu s)\n",
+                transientRate, (unsigned long long)pollRate.transientSeconds,
+                steadyRate, (unsigned long long)pollRate.steadySeconds);
+    std::printf("MQTT:         %llu connects, %llu publishes, %llu bytes\n",
+                (unsigned long long)halBroker.connects, (unsigned long long)halBroker.publishes,
+                (unsigned long long)halBroker.bytes);
+    std::printf("Sparkplug:    %llu births, %llu NDEATH, %llu DDEATH, %llu DDATA (%llu bytes, %llu metrics, %llu historical), "
+                "%llu NDATA, %llu JSON\n"
+                "              %llu metrics with bad quality (%llu historical)\n",
+                (unsigned long long)pub.births, (unsigned long long)pub.nodeDeaths,
+                (unsigned long long)pub.deaths,
+                (unsigned long long)pub.ddata,
+                (unsigned long long)pub.ddataBytes, (unsigned long long)pub.metrics,
+                (unsigned long long)pub.historical, (unsigned long long)pub.ndata,
+                (unsigned long long)pub.json, (unsigned long long)pub.badQuality,
+                (unsigned long long)pub.historicalBad);
+    std::printf("Commands:     %llu DCMD sent, %llu actuated (mean %.1f ms, max %.1f ms), "
+                "%llu confirmed by DDATA (mean %.1f ms, max %.1f ms),\n"
+                "              %llu failed, %llu lost, %zu unanswered\n",
+                (unsigned long long)commands.sent, (unsigned long long)commands.actuated,
+                commands.actuated ? commands.actuationTotalUs / 1e3 / commands.actuated : 0.0,
+                commands.actuationMaxUs / 1e3, (unsigned long long)commands.confirmed,
+                commands.confirmed ? commands.totalUs / 1e3 / commands.confirmed : 0.0,
+                commands.maxUs / 1e3, (unsigned long long)commands.failed,
+                (unsigned long long)commands.lost, pendingCommands.size());
+    std::printf("Modbus TCP:   %zu clients, %llu connects, %llu requests, %llu responses "
+                "(mean %.2f ms, max %.2f ms), %llu exceptions,\n"
+                "              %llu/%llu writes confirmed (answered in mean %.1f ms, max %.1f ms), "
+                "%llu malformed, %llu timeouts, %llu wrong FanMode\n",
+                tcpClients.size(), (unsigned long long)tcp.connects,
+                (unsigned long long)tcp.requests, (unsigned long long)tcp.responses,
+                tcp.responses > tcp.writeResponses ?
+                    tcp.totalUs / 1e3 / (tcp.responses - tcp.writeResponses) : 0.0,
+                tcp.maxUs / 1e3, (unsigned long long)tcp.exceptions,
+                (unsigned long long)tcp.writesOk, (unsigned long long)tcp.writes,
+                tcp.writeResponses ? tcp.writeTotalUs / 1e3 / tcp.writeResponses : 0.0, tcp.writeMaxUs / 1e3,
+                (unsigned long long)tcp.malformed, (unsigned long long)tcp.timeouts,
+                (unsigned long long)tcp.wrongFanMode);
+    std::printf("Checks:       %llu decode errors, %llu seq errors, %llu bdSeq errors\n",
+                (unsigned long long)pub.decodeErrors, (unsigned long long)pub.seqErrors,
+                (unsigned long long)pub.bdSeqErrors);
+    std::printf("Firmware:     %u heap allocs after setup(), %u samples in backlog, "
+                "%llu console bytes\n",
+                (unsigned)(heapAllocCount - allocsAfterSetup - hostAllocs), (unsigned)backlogSize(),
+                (unsigned long long)Serial.bytesOut);
+
+    bool ok = pub.decodeErrors == 0 && pub.seqErrors == 0 && pub.bdSeqErrors == 0 && pendingCommands.empty() &&
+              tcp.malformed == 0 && tcp.timeouts == 0 && tcp.wrongFanMode == 0 &&
+              (expectLink.empty() || expectLink == stored) &&
+              (maxBadQuality < 0 || pub.badQuality <= static_cast<uint64_t>(maxBadQuality)) &&
+              (pollRate.transientSeconds == 0 || pollRate.steadySeconds == 0 || transientRate > steadyRate);
+    return ok ? 0 : 2;
+}
@@ -0,0 +1,166 @@
+/**
+ * @file
+ * @brief Serial2 for the host build: an RS485 line with simulated DV10 units on it
+ *
+ * A request written by the master is handed to every Dv10Slave (dv10_sim.h)
+ * on the line the moment it is written; the one with the matching address
+ * answers. The response bytes are then scheduled on the
+ * virtual clock the way they would arrive on the wire: after the request's
+ * air time, t3.5 of silence and the slave latency, one character per char
+ * time. available() only reports bytes whose arrival time has passed.
+ *
+ * Each unit has its own line setting (baud rate and format) and only
+ * understands requests sent with exactly that setting. A unit with a
+ * minimum gap keeps driving the line for that long after its response,
+ * like a slave slow to turn its RS485 transceiver around: a request sent
+ * meanwhile is garbled for every unit.
+ *
+ * Units are added before the firmware starts (addUnit()). After that
+ * nothing here allocates, so the firmware's heap allocation counter only
+ * sees the firmware.
+ */
+
+#ifndef HOST_HAL_SIM_SERIAL_H
+#define HOST_HAL_SIM_SERIAL_H
+
+#include <memory>
+#include <vector>
+#include "../dv10_sim.h"
+
+class SimSerial : public Stream {
+public:
+    struct Stats {
+        uint64_t framesOut = 0;     ///< Requests written by the master
+        uint64_t bytesOut = 0;
+        uint64_t bytesIn = 0;       ///< Response bytes delivered
+        uint64_t busyUs = 0;        ///< Time the line carried data
+    };
+
+    /// One DV10 on the line
+    struct Unit {
+        Dv10Model model;
+        Dv10Slave slave;
+        unsigned long baud = 9600;
+        uint32_t format = SERIAL_8N1;
+        double minGapMs = 0;            ///< Keeps driving the line this long after a response
+        uint64_t missedRequests = 0;    ///< Wrong line setting or garbled by a short gap
+
+        Unit(uint8_t id, uint32_t seed)
+            : model(seed), slave(model, configFor(id), seed + 1000) {}
+
+        static Dv10SlaveConfig configFor(uint8_t id) {
+            Dv10SlaveConfig config;
+            config.slaveId = id;
+            return config;
+        }
+    };
+
+    Unit& addUnit(uint8_t id) {
+        units_.push_back(std::make_unique<Unit>(id, id));
+        return *units_.back();
+    }
+
+    size_t numUnits() const { return units_.size(); }
+    Unit& unit(size_t i) { return *units_[i]; }
+
+    /// Returns nullptr if no unit has that address
+    Unit* findUnit(uint8_t id) {
+        for (auto& u : units_) {
+            if (u->slave.config().slaveId == id) return u.get();
+        }
+        return nullptr;
+    }
+
+    void begin(unsigned long baud, uint32_t format = SERIAL_8N1, int8_t = -1, int8_t = -1) {
+        baud_ = baud;
+        format_ = format;
+        charUs_ = 11000000UL / baud;
+        rxHead_ = rxLen_ = 0;       // A response on its way is garbage after a change
+    }
+
+    const Stats& stats() const { return stats_; }
+    unsigned long baud() const { return baud_; }
+    uint32_t format() const { return format_; }
+
+    /// True while response bytes are still on their way
+    bool pending() const { return rxHead_ < rxLen_; }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+
+    size_t write(const uint8_t* buf, size_t len) override {
+        stats_.bytesOut += len;
+        stats_.framesOut++;
+
+        uint8_t resp[RTU_MAX_FRAME];
+        size_t n = 0;
+        Unit* responder = nullptr;
+        bool garbled = halClockUs < lineDrivenUntilUs_;
+        for (auto& u : units_) {
+            if (u->baud != baud_ || u->format != format_ || garbled) {
+                if (len > 0 && buf[0] == u->slave.config().slaveId) u->missedRequests++;
+                continue;
+            }
+            u->model.update(halClockUs / 1e6);
+            size_t r = u->slave.handle(buf, len, resp);
+            if (r > 0) {
+                n = r;
+                responder = u.get();
+            }
+        }
+
+        uint64_t airUs = len * charUs_;
+        stats_.busyUs += (len + n) * charUs_;
+        if (n == 0) return len;
+
+        // A response still unread when the next request goes out is lost, as on the bus
+        uint64_t t35 = baud_ > 19200 ? 1750 : charUs_ * 7 / 2;
+        uint64_t t = halClockUs + airUs + t35 + static_cast<uint64_t>(responder->slave.nextLatencyMs() * 1000);
+        for (size_t i = 0; i < n; i++) {
+            t += charUs_;
+            rx_[i] = {t, resp[i]};
+        }
+        lineDrivenUntilUs_ = t + static_cast<uint64_t>(responder->minGapMs * 1000);
+        rxHead_ = 0;
+        rxLen_ = n;
+        return len;
+    }
+
+    int available() override {
+        size_t i = rxHead_;
+        while (i < rxLen_ && rx_[i].at <= halClockUs) i++;
+        return static_cast<int>(i - rxHead_);
+    }
+
+    int peek() override {
+        return (pending() && rx_[rxHead_].at <= halClockUs) ? rx_[rxHead_].value : -1;
+    }
+
+    int read() override {
+        int c = peek();
+        if (c >= 0) {
+            rxHead_++;
+            stats_.bytesIn++;
+        }
+        return c;
+    }
+
+private:
+    struct RxByte {
+        uint64_t at;        ///< Virtual time the byte has fully arrived
+        uint8_t value;
+    };
+
+    std::vector<std::unique_ptr<Unit>> units_;
+    RxByte rx_[RTU_MAX_FRAME];
+    size_t rxHead_ = 0;
+    size_t rxLen_ = 0;
+    unsigned long baud_ = 9600;
+    uint32_t format_ = SERIAL_8N1;
+    uint64_t lineDrivenUntilUs_ = 0;
+    uint64_t charUs_ = 1146;
+    Stats stats_;
+};
+
+inline SimSerial Serial2;
+
+#endif
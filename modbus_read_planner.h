@@ -0,0 +1,165 @@
+/*
+Modbus read planner til DV10 registerkortet.
+
+Samler de enkelte register-adresser fra register-tabellerne til så få
+sammenhængende blok-læsninger som muligt. To adresser kommer i samme blok
+hvis hullet imellem dem højst er 'gapTolerance' ubrugte registre, og blokken
+ikke bliver længere end 'maxSpan' (ModbusMaster kan max have 64 words i sin
+response buffer).
+
+Eksempel for DV10 med gapTolerance = 8:
+  0-4, 6-8, 12-15, 19  ->  ét read af 0-19
+  292-293              ->  ét read af 292-293
+
+Adresser i 'avoid' (registre der fejler, se circuit breaker i
+dataMQTTpub.cpp) bliver aldrig lagt ind i et hul, så én dårlig adresse ikke
+får en hel blok til at fejle. Vil man stadig prøve dem, læses de alene med
+planAppendSpan(). En adresse i 'cuts' deler blokkene: ingen blok indeholder
+både adressen før den og den selv (bruges når en blok med et hul fejler, og
+det ikke vides hvilket register unit'en afviser).
+*/
+
+#ifndef MODBUS_READ_PLANNER_H
+#define MODBUS_READ_PLANNER_H
+
+#include <stdint.h>
+
+#define READ_PLAN_MAX_SPANS 8     // Max block reads in one plan
+#define READ_PLAN_MAX_REGS  64    // Max registers in total (= ModbusMaster buffer)
+#define READ_PLAN_NOT_READ  0xFF  // Result code for a block that has not been read yet
+
+struct ReadSpan {
+  uint16_t start;     // First register in the block
+  uint16_t count;     // Number of registers in the block
+  uint16_t offset;    // Where the block starts in the value buffer
+};
+
+struct ReadPlan {
+  ReadSpan spans[READ_PLAN_MAX_SPANS];
+  uint8_t numSpans;
+  uint16_t totalRegs;       // Registers read in total (incl. gaps)
+  uint16_t* values;         // Buffer with room for totalRegs values
+  uint8_t spanResult[READ_PLAN_MAX_SPANS];   // Modbus result code per block, 0 = success
+};
+
+// ================ BUILD PLAN ================
+// True if one of the 'avoid' addresses lies in [from, to)
+inline bool planAvoids(const uint16_t* avoid, uint8_t numAvoid, uint16_t from, uint16_t to) {
+  for (uint8_t i = 0; i < numAvoid; i++) {
+    if (avoid[i] >= from && avoid[i] < to) return true;
+  }
+  return false;
+}
+
+// True if one of the 'cuts' lies in [from, to]: a block ending before 'from'
+// must not be extended to 'to'
+inline bool planCuts(const uint16_t* cuts, uint8_t numCuts, uint16_t from, uint16_t to) {
+  for (uint8_t i = 0; i < numCuts; i++) {
+    if (cuts[i] >= from && cuts[i] <= to) return true;
+  }
+  return false;
+}
+
+// Sorts and merges the addresses. 'addrs' is sorted in-place.
+// Returns the number of spans, or 0 if the plan does not fit the buffer.
+inline uint8_t buildReadPlan(ReadPlan& plan, uint16_t* addrs, uint8_t numAddrs,
+                             uint16_t* valueBuffer, uint16_t bufferSize,
+                             uint16_t gapTolerance, uint16_t maxSpan = READ_PLAN_MAX_REGS,
+                             const uint16_t* avoid = nullptr, uint8_t numAvoid = 0,
+                             const uint16_t* cuts = nullptr, uint8_t numCuts = 0) {
+  plan.numSpans = 0;
+  plan.totalRegs = 0;
+  plan.values = valueBuffer;
+
+  // Insertion sort - the tables are small
+  for (uint8_t i = 1; i < numAddrs; i++) {
+    uint16_t key = addrs[i];
+    int j = i - 1;
+    while (j >= 0 && addrs[j] > key) {
+      addrs[j + 1] = addrs[j];
+      j--;
+    }
+    addrs[j + 1] = key;
+  }
+
+  for (uint8_t i = 0; i < numAddrs; i++) {
+    uint16_t addr = addrs[i];
+
+    if (plan.numSpans > 0) {
+      ReadSpan& last = plan.spans[plan.numSpans - 1];
+      uint16_t end = last.start + last.count;       // First register after the block
+
+      if (addr < end) continue;                     // Duplicate
+
+      uint16_t gap = addr - end;
+      uint16_t newCount = addr - last.start + 1;
+      if (gap <= gapTolerance && newCount <= maxSpan &&
+          !planAvoids(avoid, numAvoid, end, addr) && !planCuts(cuts, numCuts, end, addr)) {
+        last.count = newCount;
+        continue;
+      }
+    }
+
+    if (plan.numSpans >= READ_PLAN_MAX_SPANS) return 0;
+    ReadSpan& span = plan.spans[plan.numSpans++];
+    span.start = addr;
+    span.count = 1;
+  }
+
+  uint16_t offset = 0;
+  for (uint8_t s = 0; s < plan.numSpans; s++) {
+    plan.spans[s].offset = offset;
+    plan.spanResult[s] = READ_PLAN_NOT_READ;
+    offset += plan.spans[s].count;
+  }
+
+  if (offset > bufferSize) {
+    plan.numSpans = 0;
+    return 0;
+  }
+
+  plan.totalRegs = offset;
+  return plan.numSpans;
+}
+
+// Adds a block of its own after the planned ones, e.g. a single register
+// that must not share a block. Returns false if it does not fit.
+inline bool planAppendSpan(ReadPlan& plan, uint16_t start, uint16_t count, uint16_t bufferSize) {
+  if (plan.numSpans >= READ_PLAN_MAX_SPANS || plan.totalRegs + count > bufferSize) return false;
+  ReadSpan& span = plan.spans[plan.numSpans];
+  span.start = start;
+  span.count = count;
+  span.offset = plan.totalRegs;
+  plan.spanResult[plan.numSpans] = READ_PLAN_NOT_READ;
+  plan.numSpans++;
+  plan.totalRegs += count;
+  return true;
+}
+
+// ================ LOOKUP ================
+// Looks up the raw value of an address after a sweep.
+// Returns false if the address is not in the plan, or its block failed.
+inline bool planLookup(const ReadPlan& plan, uint16_t addr, uint16_t* rawValue) {
+  for (uint8_t s = 0; s < plan.numSpans; s++) {
+    const ReadSpan& span = plan.spans[s];
+    if (addr >= span.start && addr < span.start + span.count) {
+      if (plan.spanResult[s] != 0) return false;
+      *rawValue = plan.values[span.offset + (addr - span.start)];
+      return true;
+    }
+  }
+  return false;
+}
+
+// Result code of the block holding 'addr' (READ_PLAN_NOT_READ if not planned)
+inline uint8_t planResult(const ReadPlan& plan, uint16_t addr) {
+  for (uint8_t s = 0; s < plan.numSpans; s++) {
+    const ReadSpan& span = plan.spans[s];
+    if (addr >= span.start && addr < span.start + span.count) {
+      return plan.spanResult[s];
+    }
+  }
+  return READ_PLAN_NOT_READ;
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+Modbus RTU fælles definitioner: result codes, function codes og CRC.
+
+Ligger for sig selv uden Arduino afhængigheder, så både ESP32 masteren
+(modbus_rtu_master.h) og host-side værktøjer som DV10 simulatoren
+(dv10_sim.h) kan bruge dem.
+*/
+
+#ifndef MODBUS_RTU_DEFS_H
+#define MODBUS_RTU_DEFS_H
+
+#include <stdint.h>
+
+// ================ RESULT CODES ================
+#define RTU_SUCCESS           0x00
+#define RTU_ILLEGAL_FUNCTION  0x01  // Modbus exception codes from the slave
+#define RTU_ILLEGAL_ADDRESS   0x02
+#define RTU_ILLEGAL_VALUE     0x03
+#define RTU_SLAVE_FAILURE     0x04
+#define RTU_INVALID_SLAVE     0xE0  // Response from the wrong slave
+#define RTU_INVALID_FUNCTION  0xE1  // Response with wrong function code or length
+#define RTU_TIMEOUT           0xE2  // No (complete) response before timeout
+#define RTU_INVALID_CRC       0xE3  // Response with bad CRC
+
+#define RTU_FC_READ_HOLDING   0x03
+#define RTU_FC_READ_INPUT     0x04
+#define RTU_FC_WRITE_SINGLE   0x06
+
+#define RTU_MAX_FRAME         256
+#define RTU_MAX_READ_REGS     125   // Modbus limit for one read
+
+// Called when a transaction is done. 'data' is the destination buffer
+// that was passed to readIreg()/readHreg() (nullptr for writes).
+typedef bool (*RtuCallback)(uint8_t result, uint16_t transactionId, void* data);
+
+// ================ CRC ================
+inline uint16_t rtuCrc16(const uint8_t* buf, uint16_t len) {
+  uint16_t crc = 0xFFFF;
+  for (uint16_t i = 0; i < len; i++) {
+    crc ^= buf[i];
+    for (uint8_t b = 0; b < 8; b++) {
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+    }
+  }
+  return crc;
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*
+Non-blocking Modbus RTU master til DV10.
+
+Samme callback-stil som ModbusRTU biblioteket i modbus_RTU.ino: en request
+startes med readIreg()/readHreg()/writeHreg() og et callback, og task()
+kaldes fra loop(). Der er altid kun én request på bussen ad gangen.
+
+ModbusRTU biblioteket bruges ikke direkte, fordi DV10 printet har separate
+DE og RE_NEG pins (ModbusRTU styrer kun én), og fordi vi selv vil have styr
+på timeout, CRC-fejl og pausen mellem requests.
+
+Result codes er de samme som ModbusMaster (0x00 OK, 0xE2 timeout, 0xE3 CRC),
+så fejlkoderne i Serial output betyder det samme som før.
+*/
+
+#ifndef MODBUS_RTU_MASTER_H
+#define MODBUS_RTU_MASTER_H
+
+#include <Arduino.h>
+#include "modbus_rtu_defs.h"
+
+// ================ MASTER ================
+class ModbusRtuMaster {
+public:
+  void begin(Stream* port, uint32_t baud, void (*preTx)() = nullptr, void (*postTx)() = nullptr) {
+    _port = port;
+    _preTx = preTx;
+    _postTx = postTx;
+    _state = IDLE;
+    setBaud(baud);
+  }
+
+  // Character timing follows the baud rate (11 bits per character, RTU spec)
+  void setBaud(uint32_t baud) {
+    _charUs = 11000000UL / baud;
+    _t35Us = (baud > 19200) ? 1750 : (_charUs * 7) / 2;
+  }
+
+  void setTimeout(uint16_t ms)    { _timeoutMs = ms; }
+  // Pause after each transaction; never shorter than the t3.5 silence
+  void setTurnaround(uint16_t ms) { _turnaroundMs = ms; }
+
+  // Cuts the pause after the current transaction to the t3.5 silence the RTU
+  // spec asks for, so an urgent request does not wait the full turnaround.
+  // Holds until the next request starts.
+  void expedite() { _expedite = true; }
+
+  bool busy() const { return _state != IDLE; }
+  uint16_t lastTransactionId() const { return _transactionId; }
+
+  // First request byte sent to response complete (or timeout), last transaction
+  uint32_t lastLatencyUs() const { return _latencyUs; }
+
+  // ---- Requests (return false if a request is already in flight) ----
+  bool readIreg(uint8_t slave, uint16_t addr, uint16_t* dst, uint16_t count, RtuCallback cb) {
+    return startRead(slave, RTU_FC_READ_INPUT, addr, dst, count, cb);
+  }
+
+  bool readHreg(uint8_t slave, uint16_t addr, uint16_t* dst, uint16_t count, RtuCallback cb) {
+    return startRead(slave, RTU_FC_READ_HOLDING, addr, dst, count, cb);
+  }
+
+  bool writeHreg(uint8_t slave, uint16_t addr, uint16_t value, RtuCallback cb) {
+    if (busy()) return false;
+    _dst = nullptr;
+    _count = 1;
+    _writeValue = value;
+    return startRequest(slave, RTU_FC_WRITE_SINGLE, addr, value, 8, cb);
+  }
+
+  // ---- Must be called from loop() ----
+  void task() {
+    switch (_state) {
+      case IDLE:
+        break;
+
+      case SENDING:
+        // Release the bus when the last character has left the UART
+        if (micros() - _txStartUs >= _txDurationUs) {
+          _port->flush();
+          if (_postTx) _postTx();
+          _rxLen = 0;
+          _rxStartMs = millis();
+          _state = RECEIVING;
+        }
+        break;
+
+      case RECEIVING:
+        receive();
+        break;
+
+      case TURNAROUND: {
+        uint32_t gapUs = _turnaroundMs * 1000UL;
+        if (_expedite || gapUs < _t35Us) gapUs = _t35Us;
+        if (micros() - _doneUs >= gapUs) _state = IDLE;
+        break;
+      }
+    }
+  }
+
+private:
+  enum State : uint8_t { IDLE, SENDING, RECEIVING, TURNAROUND };
+
+  bool startRead(uint8_t slave, uint8_t fc, uint16_t addr, uint16_t* dst, uint16_t count, RtuCallback cb) {
+    if (busy() || count == 0 || count > RTU_MAX_READ_REGS) return false;
+    _dst = dst;
+    _count = count;
+    return startRequest(slave, fc, addr, count, 5 + 2 * count, cb);
+  }
+
+  bool startRequest(uint8_t slave, uint8_t fc, uint16_t addr, uint16_t arg,
+                    uint16_t expectedLen, RtuCallback cb) {
+    _slave = slave;
+    _fc = fc;
+    _addr = addr;
+    _cb = cb;
+    _expectedLen = expectedLen;
+    _transactionId++;
+    _expedite = false;
+
+    _frame[0] = slave;
+    _frame[1] = fc;
+    _frame[2] = addr >> 8;
+    _frame[3] = addr & 0xFF;
+    _frame[4] = arg >> 8;
+    _frame[5] = arg & 0xFF;
+    uint16_t crc = rtuCrc16(_frame, 6);
+    _frame[6] = crc & 0xFF;
+    _frame[7] = crc >> 8;
+
+    // Drop any noise left over from the previous transaction
+    while (_port->available() > 0) _port->read();
+
+    if (_preTx) _preTx();
+    _port->write(_frame, 8);
+    _txStartUs = micros();
+    _txDurationUs = 8 * _charUs;
+    _state = SENDING;
+    return true;
+  }
+
+  void receive() {
+    while (_port->available() > 0) {
+      int c = _port->read();
+      if (c < 0) break;
+      if (_rxLen < RTU_MAX_FRAME) _frame[_rxLen++] = (uint8_t)c;
+      _lastByteUs = micros();
+
+      // Exception responses are always 5 bytes
+      if (_rxLen == 2 && (_frame[1] & 0x80)) _expectedLen = 5;
+      if (_rxLen >= _expectedLen) {
+        finish(parseResponse());
+        return;
+      }
+    }
+
+    // A silent line for t3.5 ends a short frame
+    if (_rxLen > 0 && micros() - _lastByteUs > _t35Us + _charUs) {
+      finish(parseResponse());
+      return;
+    }
+
+    if (millis() - _rxStartMs >= _timeoutMs) {
+      finish(_rxLen == 0 ? RTU_TIMEOUT : parseResponse());
+    }
+  }
+
+  uint8_t parseResponse() {
+    if (_rxLen < 5) return RTU_TIMEOUT;
+
+    uint16_t crc = rtuCrc16(_frame, _rxLen - 2);
+    if (_frame[_rxLen - 2] != (crc & 0xFF) || _frame[_rxLen - 1] != (crc >> 8)) {
+      return RTU_INVALID_CRC;
+    }
+    if (_frame[0] != _slave) return RTU_INVALID_SLAVE;
+    if (_frame[1] == (_fc | 0x80)) return _frame[2];      // Exception from slave
+    if (_frame[1] != _fc || _rxLen != _expectedLen) return RTU_INVALID_FUNCTION;
+
+    if (_fc == RTU_FC_WRITE_SINGLE) {
+      uint16_t addr = (_frame[2] << 8) | _frame[3];
+      uint16_t value = (_frame[4] << 8) | _frame[5];
+      return (addr == _addr && value == _writeValue) ? RTU_SUCCESS : RTU_INVALID_FUNCTION;
+    }
+
+    if (_frame[2] != 2 * _count) return RTU_INVALID_FUNCTION;
+    for (uint16_t i = 0; i < _count; i++) {
+      _dst[i] = (_frame[3 + 2 * i] << 8) | _frame[4 + 2 * i];
+    }
+    return RTU_SUCCESS;
+  }
+
+  void finish(uint8_t result) {
+    _doneUs = micros();
+    _latencyUs = micros() - _txStartUs;
+    _state = TURNAROUND;
+    if (_cb) _cb(result, _transactionId, _dst);
+  }
+
+  Stream* _port = nullptr;
+  void (*_preTx)() = nullptr;
+  void (*_postTx)() = nullptr;
+
+  State _state = IDLE;
+  uint32_t _charUs = 1146;          // 9600 baud
+  uint32_t _t35Us = 4010;
+  uint16_t _timeoutMs = 2000;       // Same default as ModbusMaster
+  uint16_t _turnaroundMs = 50;
+
+  uint8_t _slave = 0;
+  uint8_t _fc = 0;
+  uint16_t _addr = 0;
+  uint16_t _count = 0;
+  uint16_t _writeValue = 0;
+  uint16_t* _dst = nullptr;
+  RtuCallback _cb = nullptr;
+  uint16_t _transactionId = 0;
+
+  uint8_t _frame[RTU_MAX_FRAME];
+  uint16_t _rxLen = 0;
+  uint16_t _expectedLen = 0;
+  uint32_t _txStartUs = 0;
+  uint32_t _txDurationUs = 0;
+  uint32_t _lastByteUs = 0;
+  uint32_t _latencyUs = 0;
+  unsigned long _rxStartMs = 0;
+  uint32_t _doneUs = 0;
+  bool _expedite = false;
+};
+
+#endif
@@ -0,0 +1,284 @@
+/*
+Non-blocking Modbus TCP server (slave) til gateway-brug.
+
+Serveren kender ikke selv registrene: læsninger og skrivninger går til to
+callbacks, så applikationen kan svare fra sin egen register-cache i stedet
+for at gå på RS485 bussen. Mange klienter kan være forbundet på én gang
+(MODBUS_TCP_MAX_CLIENTS); hver har sin egen modtagebuffer, så en klient der
+sender en halv frame ikke holder de andre hen. task() kaldes fra loop() (eller
+netværks-tasken) og venter aldrig.
+
+En skrivning kan ikke altid besvares med det samme - den skal først ud på
+bussen. Write-callbacken kan derfor svare MODBUS_TCP_PENDING, og
+applikationen kalder complete() når svaret kendes. Imens læses der ikke
+flere requests fra den klient, så dens svar kommer i rækkefølge.
+
+Understøtter FC03, FC04, FC06 og FC16. Exception codes er Modbus spec'ens,
+inkl. 0x0A/0x0B for en gateway hvis slave ikke findes eller ikke svarer.
+*/
+
+#ifndef MODBUS_TCP_SERVER_H
+#define MODBUS_TCP_SERVER_H
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include "modbus_rtu_defs.h"
+
+#ifndef MODBUS_TCP_MAX_CLIENTS
+#define MODBUS_TCP_MAX_CLIENTS 8      // lwIP on the ESP32 has 16 sockets in total
+#endif
+#define MODBUS_TCP_IDLE_MS     60000  // A client silent this long is disconnected
+#define MODBUS_TCP_MAX_ADU     260    // MBAP header (7) + PDU (253)
+
+// ================ EXCEPTION CODES ================
+// RTU_ILLEGAL_FUNCTION .. RTU_SLAVE_FAILURE (modbus_rtu_defs.h), plus
+#define TCP_GATEWAY_PATH      0x0A    // Unit id unknown to the gateway
+#define TCP_GATEWAY_TARGET    0x0B    // Unit known but not answering (or no data yet)
+#define TCP_SLAVE_BUSY        0x06
+
+#define MODBUS_TCP_PENDING    0xFF    // Write callback: the answer comes later (complete())
+
+#define TCP_FC_WRITE_MULTIPLE 0x10
+
+// Reads 'count' registers from 'addr' of 'unit' into 'dst'. 'fc' is
+// RTU_FC_READ_HOLDING or RTU_FC_READ_INPUT. Returns 0 or an exception code.
+typedef uint8_t (*TcpReadHandler)(uint8_t unit, uint8_t fc, uint16_t addr, uint16_t count, uint16_t* dst);
+
+// Writes 'count' holding registers. Returns 0 (done), an exception code, or
+// MODBUS_TCP_PENDING, in which case complete('client', ...) must follow.
+typedef uint8_t (*TcpWriteHandler)(uint8_t client, uint8_t unit, uint16_t addr, uint16_t count,
+                                   const uint16_t* values);
+
+// ================ SERVER ================
+class ModbusTcpServer {
+public:
+  explicit ModbusTcpServer(uint16_t port) : _server(port) {}
+
+  void begin(TcpReadHandler onRead, TcpWriteHandler onWrite) {
+    _onRead = onRead;
+    _onWrite = onWrite;
+    _server.begin();
+    _server.setNoDelay(true);
+  }
+
+  // Answers the write that was left MODBUS_TCP_PENDING, with the normal
+  // response (exception 0) or an exception. The client may have gone since.
+  void complete(uint8_t client, uint8_t exception) {
+    Connection& c = _clients[client];
+    if (!c.pending) return;
+    c.pending = false;
+    if (exception) {
+      respondException(c, c.pendingFrame, exception);
+    } else {
+      send(c, c.pendingFrame, 12);
+    }
+    c.lastActivity = millis();
+  }
+
+  uint8_t connectedClients() const {
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++) {
+      if (_clients[i].active) n++;
+    }
+    return n;
+  }
+
+  uint32_t requests() const { return _requests; }
+  uint32_t exceptions() const { return _exceptions; }
+
+  // ---- Must be called from loop() ----
+  void task() {
+    accept();
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++) {
+      Connection& c = _clients[i];
+      if (!c.active) continue;
+      if (!c.socket.connected()) {
+        drop(c);
+        continue;
+      }
+      if (!c.pending && millis() - c.lastActivity >= MODBUS_TCP_IDLE_MS) {
+        drop(c);
+        continue;
+      }
+      receive(i);
+    }
+  }
+
+private:
+  struct Connection {
+    WiFiClient socket;
+    bool active;
+    bool pending;                       // A write is waiting for complete()
+    uint8_t rx[MODBUS_TCP_MAX_ADU];
+    uint16_t rxLen;
+    uint8_t pendingFrame[12];           // Response to send when it completes
+    unsigned long lastActivity;
+  };
+
+  // A new connection takes a free slot, or the one that has been quiet
+  // longest: a BMS that reconnects without closing must not lock others out
+  void accept() {
+    WiFiClient incoming = _server.accept();
+    if (!incoming) return;
+
+    int slot = -1;
+    unsigned long idlest = 0;
+    for (uint8_t i = 0; i < MODBUS_TCP_MAX_CLIENTS; i++) {
+      Connection& c = _clients[i];
+      if (!c.active) {
+        slot = i;
+        break;
+      }
+      unsigned long idle = millis() - c.lastActivity;
+      if (!c.pending && idle >= idlest) {
+        idlest = idle;
+        slot = i;
+      }
+    }
+    if (slot < 0) {
+      incoming.stop();
+      return;
+    }
+
+    Connection& c = _clients[slot];
+    if (c.active) drop(c);
+    c.socket = incoming;
+    c.socket.setNoDelay(true);
+    c.active = true;
+    c.pending = false;
+    c.rxLen = 0;
+    c.lastActivity = millis();
+  }
+
+  void drop(Connection& c) {
+    c.socket.stop();
+    c.active = false;
+    c.pending = false;
+    c.rxLen = 0;
+  }
+
+  // Takes what has arrived and answers every complete frame in it
+  void receive(uint8_t client) {
+    Connection& c = _clients[client];
+    while (!c.pending && c.active) {
+      int avail = c.socket.available();
+      if (avail > 0 && c.rxLen < MODBUS_TCP_MAX_ADU) {
+        uint16_t room = MODBUS_TCP_MAX_ADU - c.rxLen;
+        int n = c.socket.read(c.rx + c.rxLen, avail < room ? avail : room);
+        if (n > 0) {
+          c.rxLen += n;
+          c.lastActivity = millis();
+        }
+      }
+      if (c.rxLen < 7) return;
+
+      // MBAP: transaction id, protocol id (0), length (unit id + PDU)
+      uint16_t protocol = (c.rx[2] << 8) | c.rx[3];
+      uint16_t length = (c.rx[4] << 8) | c.rx[5];
+      if (protocol != 0 || length < 2 || length > MODBUS_TCP_MAX_ADU - 6) {
+        drop(c);      // Not Modbus, or out of step: no way to find the next frame
+        return;
+      }
+      uint16_t frameLen = 6 + length;
+      if (c.rxLen < frameLen) return;
+
+      _requests++;
+      handle(client, c.rx, frameLen);
+      memmove(c.rx, c.rx + frameLen, c.rxLen - frameLen);
+      c.rxLen -= frameLen;
+    }
+  }
+
+  void handle(uint8_t client, const uint8_t* req, uint16_t len) {
+    Connection& c = _clients[client];
+    uint8_t unit = req[6];
+    uint8_t fc = req[7];
+    uint16_t addr = len >= 10 ? (req[8] << 8) | req[9] : 0;
+    uint16_t arg = len >= 12 ? (req[10] << 8) | req[11] : 0;
+    uint8_t resp[MODBUS_TCP_MAX_ADU];
+
+    if (fc == RTU_FC_READ_HOLDING || fc == RTU_FC_READ_INPUT) {
+      if (len != 12 || arg == 0 || arg > RTU_MAX_READ_REGS) {
+        respondException(c, req, RTU_ILLEGAL_VALUE);
+        return;
+      }
+      uint16_t values[RTU_MAX_READ_REGS];
+      uint8_t ex = _onRead(unit, fc, addr, arg, values);
+      if (ex) {
+        respondException(c, req, ex);
+        return;
+      }
+      memcpy(resp, req, 8);
+      resp[8] = 2 * arg;
+      for (uint16_t i = 0; i < arg; i++) {
+        resp[9 + 2 * i] = values[i] >> 8;
+        resp[10 + 2 * i] = values[i] & 0xFF;
+      }
+      setLength(resp, 3 + 2 * arg);
+      send(c, resp, 9 + 2 * arg);
+      return;
+    }
+
+    uint16_t values[RTU_MAX_READ_REGS];
+    uint16_t count;
+    if (fc == RTU_FC_WRITE_SINGLE) {
+      if (len != 12) {
+        respondException(c, req, RTU_ILLEGAL_VALUE);
+        return;
+      }
+      count = 1;
+      values[0] = arg;
+    } else if (fc == TCP_FC_WRITE_MULTIPLE) {
+      count = arg;
+      if (len < 13 || count == 0 || count > 123 || req[12] != 2 * count || len != 13 + 2 * count) {
+        respondException(c, req, RTU_ILLEGAL_VALUE);
+        return;
+      }
+      for (uint16_t i = 0; i < count; i++) values[i] = (req[13 + 2 * i] << 8) | req[14 + 2 * i];
+    } else {
+      respondException(c, req, RTU_ILLEGAL_FUNCTION);
+      return;
+    }
+
+    // FC06 echoes the request, FC16 answers address and count: both 12 bytes
+    memcpy(resp, req, 12);
+    setLength(resp, 6);
+    uint8_t ex = _onWrite(client, unit, addr, count, values);
+    if (ex == MODBUS_TCP_PENDING) {
+      memcpy(c.pendingFrame, resp, 12);
+      c.pending = true;
+    } else if (ex) {
+      respondException(c, req, ex);
+    } else {
+      send(c, resp, 12);
+    }
+  }
+
+  void respondException(Connection& c, const uint8_t* req, uint8_t ex) {
+    uint8_t resp[9];
+    memcpy(resp, req, 7);
+    setLength(resp, 3);
+    resp[7] = req[7] | 0x80;
+    resp[8] = ex;
+    _exceptions++;
+    send(c, resp, 9);
+  }
+
+  static void setLength(uint8_t* frame, uint16_t length) {
+    frame[4] = length >> 8;
+    frame[5] = length & 0xFF;
+  }
+
+  void send(Connection& c, const uint8_t* frame, uint16_t len) {
+    if (c.active && c.socket.write(frame, len) != len) drop(c);
+  }
+
+  WiFiServer _server;
+  TcpReadHandler _onRead = nullptr;
+  TcpWriteHandler _onWrite = nullptr;
+  Connection _clients[MODBUS_TCP_MAX_CLIENTS] = {};
+  uint32_t _requests = 0;
+  uint32_t _exceptions = 0;
+};
+
+#endif
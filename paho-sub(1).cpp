@@ -5,28 +5,144 @@
 
 // https://cppscripts.com/paho-mqtt-cpp-cmake
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <spdlog/common.h>
 #include <string>
 #include <spdlog/spdlog.h>
 #include <spdlog/sinks/basic_file_sink.h>
 #include <mqtt/async_client.h>
+#include "sparkplug_b.h"
+#include "sparkplug_alias_resolver.h"
 
 const std::string SERVER_ADDRESS("tcp://localhost:1883");
 const std::string CLIENT_ID("ExampleSubscriber");
+const size_t MAX_METRICS = 64;
+const auto REBIRTH_HOLDOFF = std::chrono::seconds(10);   // Min time between rebirth requests per node
 
 /**
  * @class MessageCallback
- * @brief ::
+ * @brief Prints incoming messages, decoding Sparkplug B protobuf payloads
  *
+ * Keeps an alias table per edge node from NBIRTH/DBIRTH, so DDATA metrics
+ * that only carry an alias are printed with their name and unit.
  */
 class MessageCallback : public virtual mqtt::callback {
 
 public:
+    explicit MessageCallback(mqtt::async_client& client) : client_(client) {}
+
     void message_arrived(mqtt::const_message_ptr msg) override {
+        const std::string& topic = msg->get_topic();
+        if (topic.rfind("spBv1.0/", 0) == 0 && printSparkplug(topic, msg->get_payload())) {
+            return;
+        }
         std::cout << "Message arrived: '" << msg->get_payload()
-                  << "' on topic: " << msg->get_topic() << std::endl;
+                  << "' on topic: " << topic << std::endl;
     }
+
+private:
+    /**
+     * @brief Decodes a Sparkplug B protobuf payload and prints its metrics
+     *
+     * @return false if the payload is not protobuf (e.g. the JSON format)
+     */
+    bool printSparkplug(const std::string& topicName, const std::string& payload) {
+        SparkplugTopic topic = parseSparkplugTopic(topicName);
+        SpbPayloadView header;
+        SpbMetricView metrics[MAX_METRICS];
+        if (!topic.valid ||
+            !spbDecodePayload(reinterpret_cast<const uint8_t*>(payload.data()), payload.size(),
+                              header, metrics, MAX_METRICS)) {
+            return false;
+        }
+
+        AliasResolver::NodeTable& table = aliases_.node(topic.nodeKey());
+        size_t n = std::min(header.numMetrics, MAX_METRICS);
+
+        if (topic.type == "NBIRTH") {
+            aliases_.nodeBirth(table);
+        } else if (topic.type == "NDEATH") {
+            aliases_.nodeDeath(table);
+        }
+        if (topic.type == "NBIRTH" || topic.type == "DBIRTH") {
+            for (size_t i = 0; i < n; i++) {
+                aliases_.learn(table, topic.device, metrics[i]);
+            }
+        }
+
+        std::cout << topicName << " seq=" << header.seq << " timestamp=" << header.timestamp
+                  << " (" << payload.size() << " bytes, " << header.numMetrics << " metrics)" << std::endl;
+
+        bool unknownAlias = false;
+        for (size_t i = 0; i < n; i++) {
+            SpbMetricView& m = metrics[i];
+            std::string name(m.name ? m.name : "", m.nameLen);
+            std::string unit(m.engUnit ? m.engUnit : "", m.engUnitLen);
+
+            if (m.nameLen == 0 && m.hasAlias) {
+                const MetricInfo* info = aliases_.resolve(table, m.alias);
+                if (!info) {
+                    std::cout << "  <unknown alias " << m.alias << ">" << std::endl;
+                    unknownAlias = true;
+                    continue;
+                }
+                name = info->name;
+                unit = info->unit;
+                m.datatype = info->datatype;
+            }
+
+            std::cout << "  " << name << " = ";
+            if (m.valueKind == SPB_VALUE_STRING) {
+                std::cout << std::string(m.stringValue, m.stringLen);
+            } else {
+                std::cout << m.asDouble();
+            }
+            if (!unit.empty()) {
+                std::cout << " " << unit;
+            }
+            std::cout << std::endl;
+        }
+
+        if (unknownAlias) {
+            requestRebirth(topic);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Asks an edge node to re-send its births (NCMD Node Control/Rebirth)
+     *
+     * Rate limited per node, so a burst of DDATA with stale aliases only
+     * triggers one request.
+     */
+    void requestRebirth(const SparkplugTopic& topic) {
+        auto now = std::chrono::steady_clock::now();
+        auto& last = lastRebirth_[topic.nodeKey()];
+        if (last.time_since_epoch().count() != 0 && now - last < REBIRTH_HOLDOFF) {
+            return;
+        }
+        last = now;
+
+        uint8_t buf[64];
+        SpbWriter w;
+        spbInit(w, buf, sizeof(buf));
+        uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        spbVarintField(w, 1, ms);
+        size_t m = spbBeginMetric(w, "Node Control/Rebirth", SPB_BOOLEAN, ms);
+        spbMetricBool(w, true);
+        spbEndMetric(w, m);
+
+        const std::string ncmd = "spBv1.0/" + topic.group + "/NCMD/" + topic.node;
+        client_.publish(ncmd, buf, w.len, 0, false);
+        spdlog::info("Unknown alias from {}, requested rebirth", topic.nodeKey());
+    }
+
+    mqtt::async_client& client_;
+    AliasResolver aliases_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> lastRebirth_;
 };
 
 
@@ -40,7 +156,7 @@ int main()
     spdlog::info("Starting MQTT subscriber..."); // Console log 
     
     mqtt::async_client client(SERVER_ADDRESS, CLIENT_ID);
-    MessageCallback cb;
+    MessageCallback cb(client);
     client.set_callback(cb);
 
     mqtt::connect_options connOpts;
@@ -54,6 +170,7 @@ int main()
         
         const std::string topic("esp32/ds/temperature");
         client.subscribe(topic, 0);
+        client.subscribe("spBv1.0/#", 0);
 
         // Wait for messages
         std::this_thread::sleep_for(std::chrono::seconds(30));
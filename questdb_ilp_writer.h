@@ -0,0 +1,340 @@
+/**
+ * @file
+ * @brief Batched InfluxDB Line Protocol (ILP) writer for QuestDB over TCP
+ *
+ * Rows are appended to one reusable text buffer and sent with a single
+ * write() when the batch is full (bytes or rows) or its oldest row is too
+ * old. The TCP connection to QuestDB's ILP port (9009) stays open and is
+ * only re-established after an error.
+ */
+
+#ifndef QUESTDB_ILP_WRITER_H
+#define QUESTDB_ILP_WRITER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <spdlog/spdlog.h>
+
+/**
+ * @class IlpTcpSink
+ * @brief One persistent TCP connection to a QuestDB ILP endpoint
+ */
+class IlpTcpSink {
+public:
+    /// Min time between two connect attempts, so a dead server does not cost a core
+    static constexpr std::chrono::milliseconds RECONNECT_HOLDOFF{1000};
+
+    IlpTcpSink(std::string host, uint16_t port) : host_(std::move(host)), port_(port) {}
+    ~IlpTcpSink() { close(); }
+
+    IlpTcpSink(const IlpTcpSink&) = delete;
+    IlpTcpSink& operator=(const IlpTcpSink&) = delete;
+
+    bool connected() const { return fd_ >= 0; }
+    uint64_t connects() const { return connects_; }
+
+    /// force skips RECONNECT_HOLDOFF (for one immediate retry after a broken connection)
+    bool connect(bool force = false) {
+        if (connected()) return true;
+
+        auto now = std::chrono::steady_clock::now();
+        if (!force && lastAttempt_.time_since_epoch().count() != 0 && now - lastAttempt_ < RECONNECT_HOLDOFF) {
+            return false;
+        }
+        lastAttempt_ = now;
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        std::string port = std::to_string(port_);
+        if (getaddrinfo(host_.c_str(), port.c_str(), &hints, &res) != 0) {
+            spdlog::error("ILP: cannot resolve {}", host_);
+            return false;
+        }
+
+        for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+            int fd = ::socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) continue;
+            if (::connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+                int sndbuf = 1 << 20;
+                setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+                fd_ = fd;
+                break;
+            }
+            ::close(fd);
+        }
+        freeaddrinfo(res);
+
+        if (!connected()) {
+            spdlog::error("ILP: cannot connect to {}:{}", host_, port_);
+            return false;
+        }
+        connects_++;
+        spdlog::info("ILP: connected to {}:{}", host_, port_);
+        return true;
+    }
+
+    /// Writes all bytes. Closes the connection and returns false on error;
+    /// sent (if given) gets the number of bytes handed to the kernel.
+    bool send(const char* data, size_t len, size_t* sent = nullptr) {
+        if (sent) *sent = 0;
+        if (!connect()) return false;
+        while (len > 0) {
+            ssize_t n = ::send(fd_, data, len, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                spdlog::error("ILP: send failed: {}", std::strerror(errno));
+                close();
+                return false;
+            }
+            data += n;
+            len -= static_cast<size_t>(n);
+            if (sent) *sent += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    void close() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+private:
+    std::string host_;
+    uint16_t port_;
+    int fd_ = -1;
+    uint64_t connects_ = 0;
+    std::chrono::steady_clock::time_point lastAttempt_{};
+};
+
+/**
+ * @class IlpLineBuffer
+ * @brief Builds ILP rows as text
+ *
+ * A row is written as beginRow(), tag()..., field()..., endRow(). The buffer
+ * is reused: clear() keeps its capacity.
+ */
+class IlpLineBuffer {
+public:
+    void beginRow(std::string_view table) {
+        rowStart_ = buf_.size();
+        hasField_ = false;
+        appendEscaped(table, false);
+    }
+
+    void tag(std::string_view key, std::string_view value) {
+        if (value.empty()) return;              // Empty tag values are not allowed
+        buf_ += ',';
+        appendEscaped(key, true);
+        buf_ += '=';
+        appendEscaped(value, true);
+    }
+
+    /// Non-finite values are skipped; a row without fields is dropped in endRow()
+    void field(std::string_view key, double value) {
+        if (!std::isfinite(value)) return;
+        beginField(key);
+        char tmp[32];
+        auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+        buf_.append(tmp, res.ptr);
+    }
+
+    void fieldInt(std::string_view key, int64_t value) {
+        beginField(key);
+        char tmp[24];
+        auto res = std::to_chars(tmp, tmp + sizeof(tmp), value);
+        buf_.append(tmp, res.ptr);
+        buf_ += 'i';
+    }
+
+    void fieldBool(std::string_view key, bool value) {
+        beginField(key);
+        buf_ += value ? 't' : 'f';
+    }
+
+    /// Ends the row with a timestamp in nanoseconds (0 = let the server stamp it).
+    /// Returns false if the row had no fields and was dropped.
+    bool endRow(int64_t timestampNs) {
+        if (!hasField_) {
+            buf_.resize(rowStart_);
+            return false;
+        }
+        if (timestampNs > 0) {
+            char tmp[24];
+            auto res = std::to_chars(tmp, tmp + sizeof(tmp), timestampNs);
+            buf_ += ' ';
+            buf_.append(tmp, res.ptr);
+        }
+        buf_ += '\n';
+        rows_++;
+        return true;
+    }
+
+    /// Appends rows built elsewhere (complete lines)
+    void append(std::string_view lines, size_t rows) {
+        buf_.append(lines.data(), lines.size());
+        rows_ += rows;
+    }
+
+    void reserve(size_t bytes) { buf_.reserve(bytes); }
+    void clear() { buf_.clear(); rows_ = 0; }
+
+    const std::string& text() const { return buf_; }
+    size_t size() const { return buf_.size(); }
+    size_t rows() const { return rows_; }
+
+private:
+    void beginField(std::string_view key) {
+        buf_ += hasField_ ? ',' : ' ';
+        hasField_ = true;
+        appendEscaped(key, true);
+        buf_ += '=';
+    }
+
+    // Table names escape ',' and ' '; tag and field keys/values also '='.
+    // Newlines would end the row, so they become spaces.
+    void appendEscaped(std::string_view s, bool escapeEquals) {
+        for (char c : s) {
+            if (c == ',' || c == ' ' || c == '\\' || (escapeEquals && c == '=')) {
+                buf_ += '\\';
+            } else if (c == '\n' || c == '\r') {
+                c = ' ';
+                buf_ += '\\';
+            }
+            buf_ += c;
+        }
+    }
+
+    std::string buf_;
+    size_t rowStart_ = 0;
+    bool hasField_ = false;
+    size_t rows_ = 0;
+};
+
+/// End of the last complete row within the first sent bytes of ILP text
+inline size_t ilpRowsEnd(std::string_view text, size_t sent) {
+    size_t nl = text.substr(0, sent).rfind('\n');
+    return nl == std::string_view::npos ? 0 : nl + 1;
+}
+
+/**
+ * @class IlpBatchWriter
+ * @brief Collects ILP rows into a batch and sends it through an IlpTcpSink
+ *
+ * Rows are built in place (beginRow() ... endRow()) or appended as finished
+ * lines (appendRows()). Not thread safe; the caller serializes access.
+ */
+class IlpBatchWriter {
+public:
+    struct Stats {
+        uint64_t rows = 0;          ///< Rows sent
+        uint64_t batches = 0;       ///< Successful writes
+        uint64_t bytes = 0;
+        uint64_t droppedRows = 0;   ///< Rows lost because the sink was down
+        uint64_t sendErrors = 0;
+    };
+
+    IlpBatchWriter(IlpTcpSink& sink, size_t maxBytes = 64 * 1024, size_t maxRows = 5000,
+                   std::chrono::milliseconds maxDelay = std::chrono::milliseconds(100))
+        : sink_(sink), maxBytes_(maxBytes), maxRows_(maxRows), maxDelay_(maxDelay) {
+        batch_.reserve(maxBytes_ + 4096);
+    }
+
+    void beginRow(std::string_view table) { batch_.beginRow(table); }
+    void tag(std::string_view key, std::string_view value) { batch_.tag(key, value); }
+    void field(std::string_view key, double value) { batch_.field(key, value); }
+    void fieldInt(std::string_view key, int64_t value) { batch_.fieldInt(key, value); }
+    void fieldBool(std::string_view key, bool value) { batch_.fieldBool(key, value); }
+
+    void endRow(int64_t timestampNs) {
+        size_t before = batch_.rows();
+        if (batch_.endRow(timestampNs)) rowsAdded(before);
+    }
+
+    /// Appends complete lines built by an IlpLineBuffer elsewhere
+    void appendRows(std::string_view lines, size_t rows) {
+        if (rows == 0) return;
+        size_t before = batch_.rows();
+        batch_.append(lines, rows);
+        rowsAdded(before);
+    }
+
+    /// Sends the batch if its oldest row has waited maxDelay
+    void flushIfDue() {
+        if (batch_.rows() > 0 && std::chrono::steady_clock::now() - firstRow_ >= maxDelay_) flush();
+    }
+
+    /**
+     * Sends the batch. If an open connection breaks, the rest of the batch is
+     * retried once on a new connection (past RECONNECT_HOLDOFF), then dropped.
+     *
+     * The retry starts at the first row that was not completely written; the
+     * server discards a row cut off by a closed connection. Rows written before
+     * the break are not sent again, but they may still have been lost in the
+     * kernel or in the server. ILP over TCP has no acks, so they count as sent.
+     */
+    bool flush() {
+        if (batch_.rows() == 0) return true;
+
+        const std::string& text = batch_.text();
+        bool wasConnected = sink_.connected();
+        size_t sent = 0;
+        bool ok = sink_.send(text.data(), text.size(), &sent);
+        size_t done = 0;
+        if (!ok) {
+            stats_.sendErrors++;
+            done = ilpRowsEnd(text, sent);
+            // A connect failure is not retried; the holdoff applies
+            if (wasConnected && sink_.connect(true)) {
+                ok = sink_.send(text.data() + done, text.size() - done);
+                if (!ok) stats_.sendErrors++;
+            }
+        }
+        if (ok) {
+            stats_.rows += batch_.rows();
+            stats_.batches++;
+            stats_.bytes += text.size();
+        } else {
+            size_t doneRows = static_cast<size_t>(std::count(text.begin(), text.begin() + done, '\n'));
+            stats_.rows += doneRows;
+            stats_.bytes += done;
+            stats_.droppedRows += batch_.rows() - doneRows;
+        }
+        batch_.clear();
+        return ok;
+    }
+
+    size_t pendingRows() const { return batch_.rows(); }
+    const Stats& stats() const { return stats_; }
+
+private:
+    void rowsAdded(size_t rowsBefore) {
+        if (rowsBefore == 0) firstRow_ = std::chrono::steady_clock::now();
+        if (batch_.rows() >= maxRows_ || batch_.size() >= maxBytes_) flush();
+    }
+
+    IlpTcpSink& sink_;
+    size_t maxBytes_;
+    size_t maxRows_;
+    std::chrono::milliseconds maxDelay_;
+
+    IlpLineBuffer batch_;
+    std::chrono::steady_clock::time_point firstRow_{};
+    Stats stats_;
+};
+
+#endif
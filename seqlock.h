@@ -0,0 +1,67 @@
+/*
+Seqlock: ét snapshot fra én task til en anden, uden lås.
+
+Skriveren (der må kun være én) tæller sekvensnummeret op før og efter den
+ændrer værdien, så nummeret er ulige mens der skrives. Læseren kopierer
+værdien og tjekker bagefter at nummeret var lige og ikke har flyttet sig -
+ellers kopierer den igen. Læseren ser derfor aldrig en halvt skrevet værdi,
+og skriveren venter aldrig på læseren, uanset hvor langsom den er. Læseren
+skal køre med lavere prioritet end skriveren (eller på en anden kerne), så
+skriveren altid bliver færdig.
+
+T skal kunne kopieres med memcpy (ingen pointere til sig selv, ingen
+virtuelle funktioner).
+*/
+
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <type_traits>
+
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable<T>::value, "SeqLock copies T with memcpy");
+
+public:
+  // ---- Writer (one task only) ----
+  // Everything changed between beginWrite() and endWrite() becomes visible
+  // to the reader at once. The value keeps its contents, so the writer can
+  // update it in place.
+  T& beginWrite() {
+    _seq.store(_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    return _value;
+  }
+
+  void endWrite() {
+    _seq.store(_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // The writer may look at its own value at any time
+  const T& value() const { return _value; }
+
+  // ---- Reader ----
+  // Copies a consistent value into 'out' and returns its sequence number.
+  // Copies again if the writer got in the way; the writer is never held up.
+  uint32_t read(T& out) const {
+    for (;;) {
+      uint32_t before = _seq.load(std::memory_order_acquire);
+      if (before & 1) continue;
+      memcpy(&out, &_value, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (_seq.load(std::memory_order_relaxed) == before) return before;
+    }
+  }
+
+  // Changes with every write, so a reader can skip the copy when nothing is new
+  uint32_t sequence() const { return _seq.load(std::memory_order_acquire); }
+
+private:
+  T _value{};
+  std::atomic<uint32_t> _seq{0};
+};
+
+#endif
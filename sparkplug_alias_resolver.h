@@ -0,0 +1,128 @@
+/**
+ * @file
+ * @brief Sparkplug B alias resolver for host-side subscribers
+ *
+ * Edge nodes assign a numeric alias to every metric in NBIRTH/DBIRTH and then
+ * send DDATA with aliases only (see SpbAliasRegistry in sparkplug_b.h). This
+ * keeps one table per edge node, indexed directly by alias, so resolving a
+ * metric is one hash lookup per message plus one array index per metric.
+ */
+
+#ifndef SPARKPLUG_ALIAS_RESOLVER_H
+#define SPARKPLUG_ALIAS_RESOLVER_H
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "sparkplug_b.h"
+
+/**
+ * @brief Parts of a Sparkplug topic: spBv1.0/<group>/<type>/<node>[/<device>]
+ */
+struct SparkplugTopic {
+    std::string group;
+    std::string type;       ///< NBIRTH, DBIRTH, DDATA, NDEATH, ...
+    std::string node;
+    std::string device;     ///< Empty for node-level messages
+    bool valid = false;
+
+    std::string nodeKey() const { return group + "/" + node; }
+};
+
+inline SparkplugTopic parseSparkplugTopic(const std::string& topic) {
+    SparkplugTopic t;
+    std::string parts[5];
+    size_t count = 0;
+    size_t start = 0;
+
+    while (count < 5) {
+        size_t slash = topic.find('/', start);
+        parts[count++] = topic.substr(start, slash - start);
+        if (slash == std::string::npos) break;
+        start = slash + 1;
+    }
+
+    if (count < 4 || parts[0] != "spBv1.0") return t;
+    t.group = parts[1];
+    t.type = parts[2];
+    t.node = parts[3];
+    if (count == 5) t.device = parts[4];
+    t.valid = true;
+    return t;
+}
+
+/**
+ * @brief What a birth certificate told us about one alias
+ */
+struct MetricInfo {
+    std::string name;
+    std::string device;     ///< Device that declared the metric, empty for node metrics
+    std::string unit;
+    uint32_t datatype = 0;
+};
+
+/**
+ * @class AliasResolver
+ * @brief Maps (edge node, alias) to the metric declared in the births
+ */
+class AliasResolver {
+public:
+    /// Aliases below this are kept in a flat vector, larger ones in a hash map
+    static const uint64_t MAX_DENSE_ALIAS = 4096;
+
+    struct NodeTable {
+        std::vector<MetricInfo> dense;
+        std::unordered_map<uint64_t, MetricInfo> sparse;
+        bool born = false;
+    };
+
+    /// Finds (or creates) the table of an edge node. Call once per message.
+    NodeTable& node(const std::string& nodeKey) { return nodes_[nodeKey]; }
+
+    /// NBIRTH: all old aliases of the node are invalid
+    void nodeBirth(NodeTable& table) {
+        table.dense.clear();
+        table.sparse.clear();
+        table.born = true;
+    }
+
+    /// NDEATH: forget the node until it is born again
+    void nodeDeath(NodeTable& table) {
+        nodeBirth(table);
+        table.born = false;
+    }
+
+    /// Learns one metric from an NBIRTH/DBIRTH
+    void learn(NodeTable& table, const std::string& device, const SpbMetricView& m) {
+        if (!m.hasAlias || m.nameLen == 0) return;
+
+        MetricInfo info;
+        info.name.assign(m.name, m.nameLen);
+        info.device = device;
+        if (m.engUnitLen > 0) info.unit.assign(m.engUnit, m.engUnitLen);
+        info.datatype = m.datatype;
+
+        if (m.alias < MAX_DENSE_ALIAS) {
+            if (table.dense.size() <= m.alias) table.dense.resize(m.alias + 1);
+            table.dense[m.alias] = std::move(info);
+        } else {
+            table.sparse[m.alias] = std::move(info);
+        }
+    }
+
+    /// Returns nullptr for an alias the births did not declare
+    const MetricInfo* resolve(const NodeTable& table, uint64_t alias) const {
+        if (alias < table.dense.size()) {
+            const MetricInfo& info = table.dense[alias];
+            return info.name.empty() ? nullptr : &info;
+        }
+        auto it = table.sparse.find(alias);
+        return it == table.sparse.end() ? nullptr : &it->second;
+    }
+
+private:
+    std::unordered_map<std::string, NodeTable> nodes_;
+};
+
+#endif
@@ -0,0 +1,515 @@
+/*
+Sparkplug B protobuf payload encoder/decoder.
+
+Encoder og decoder for Sparkplug B 'Payload' beskeden (sparkplug_b.proto),
+skrevet direkte mod protobuf wire formatet, så der ikke skal bruges nanopb
+eller heap. Bruges både af ESP32 programmet (encoder) og af host-side C++
+værktøjerne som paho-sub(1).cpp (decoder).
+
+Kun de felter vi bruger er med:
+  Payload:     timestamp(1), metrics(2), seq(3)
+  Metric:      name(1), alias(2), timestamp(3), datatype(4), is_historical(5),
+               is_null(7), properties(9), int/long/float/double/bool/string value(10-15)
+  PropertySet: keys(1), values(2)  - kun "engUnit" (string) og "Quality" (int32)
+
+Quality følger Ignitions koder (192 = good, 0 = bad, 500 = stale). Uden
+property regnes en værdi som good.
+
+Aliases: hver metric får et nummer i NBIRTH/DBIRTH (SpbAliasRegistry), og
+DDATA sender derefter kun alias + værdi, uden navn, timestamp og datatype.
+
+Encoderen skriver streaming i en fast buffer. Længden af en under-besked
+kendes først når den er skrevet, så der reserveres 2 bytes til længden, som
+bagefter skrives som en 2-byte varint (0x80|lo, hi). Det er gyldig protobuf,
+alle decodere accepterer varints med ekstra bytes. Max 16383 bytes per metric.
+*/
+
+#ifndef SPARKPLUG_B_H
+#define SPARKPLUG_B_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// ================ SPARKPLUG B DATATYPES (spec values) ================
+#define SPB_INT8      1
+#define SPB_INT16     2
+#define SPB_INT32     3
+#define SPB_INT64     4
+#define SPB_UINT8     5
+#define SPB_UINT16    6
+#define SPB_UINT32    7
+#define SPB_UINT64    8
+#define SPB_FLOAT     9
+#define SPB_DOUBLE    10
+#define SPB_BOOLEAN   11
+#define SPB_STRING    12
+#define SPB_DATETIME  13
+#define SPB_TEXT      14
+
+// "Quality" property values
+#define SPB_QUALITY_BAD   0
+#define SPB_QUALITY_GOOD  192
+#define SPB_QUALITY_STALE 500
+
+// Protobuf wire types
+#define SPB_WIRE_VARINT   0
+#define SPB_WIRE_FIXED64  1
+#define SPB_WIRE_LENGTH   2
+#define SPB_WIRE_FIXED32  5
+
+// ================ ENCODER ================
+struct SpbWriter {
+  uint8_t* buf;
+  size_t cap;
+  size_t len;
+  bool overflow;      // Set when the buffer was too small; payload is invalid
+};
+
+inline void spbInit(SpbWriter& w, uint8_t* buf, size_t cap) {
+  w.buf = buf;
+  w.cap = cap;
+  w.len = 0;
+  w.overflow = false;
+}
+
+inline void spbByte(SpbWriter& w, uint8_t b) {
+  if (w.len < w.cap) {
+    w.buf[w.len++] = b;
+  } else {
+    w.overflow = true;
+  }
+}
+
+inline void spbVarint(SpbWriter& w, uint64_t v) {
+  while (v >= 0x80) {
+    spbByte(w, (uint8_t)(v | 0x80));
+    v >>= 7;
+  }
+  spbByte(w, (uint8_t)v);
+}
+
+inline void spbTag(SpbWriter& w, uint8_t field, uint8_t wireType) {
+  spbVarint(w, ((uint32_t)field << 3) | wireType);
+}
+
+inline void spbVarintField(SpbWriter& w, uint8_t field, uint64_t v) {
+  spbTag(w, field, SPB_WIRE_VARINT);
+  spbVarint(w, v);
+}
+
+inline void spbFixed32Field(SpbWriter& w, uint8_t field, uint32_t bits) {
+  spbTag(w, field, SPB_WIRE_FIXED32);
+  for (uint8_t i = 0; i < 4; i++) spbByte(w, (uint8_t)(bits >> (8 * i)));
+}
+
+inline void spbFixed64Field(SpbWriter& w, uint8_t field, uint64_t bits) {
+  spbTag(w, field, SPB_WIRE_FIXED64);
+  for (uint8_t i = 0; i < 8; i++) spbByte(w, (uint8_t)(bits >> (8 * i)));
+}
+
+inline void spbStringField(SpbWriter& w, uint8_t field, const char* s) {
+  size_t n = strlen(s);
+  spbTag(w, field, SPB_WIRE_LENGTH);
+  spbVarint(w, n);
+  if (n > w.cap - w.len) {
+    w.overflow = true;
+    return;
+  }
+  memcpy(w.buf + w.len, s, n);
+  w.len += n;
+}
+
+// Appends bytes that are already encoded, e.g. metrics collected for a batch
+inline void spbRaw(SpbWriter& w, const uint8_t* data, size_t n) {
+  if (n > w.cap - w.len) {
+    w.overflow = true;
+    return;
+  }
+  memcpy(w.buf + w.len, data, n);
+  w.len += n;
+}
+
+// Opens a length-delimited sub-message. Returns the mark for spbEndMessage().
+inline size_t spbBeginMessage(SpbWriter& w, uint8_t field) {
+  spbTag(w, field, SPB_WIRE_LENGTH);
+  size_t mark = w.len;
+  spbByte(w, 0);
+  spbByte(w, 0);
+  return mark;
+}
+
+inline void spbEndMessage(SpbWriter& w, size_t mark) {
+  if (w.overflow) return;
+  size_t n = w.len - mark - 2;
+  if (n > 0x3FFF) {
+    w.overflow = true;
+    return;
+  }
+  w.buf[mark] = (uint8_t)(0x80 | (n & 0x7F));
+  w.buf[mark + 1] = (uint8_t)(n >> 7);
+}
+
+// Drops everything written after 'mark' (w.len before the part that did not fit)
+inline void spbRollback(SpbWriter& w, size_t mark) {
+  w.len = mark;
+  w.overflow = false;
+}
+
+// ---- Payload level ----
+inline void spbPayloadHeader(SpbWriter& w, uint64_t timestamp, uint64_t seq) {
+  spbVarintField(w, 1, timestamp);
+  spbVarintField(w, 3, seq);
+}
+
+// ---- Metric level ----
+// Metric with name, timestamp and datatype, as used in births.
+// Call spbMetricAlias() next to give it an alias.
+inline size_t spbBeginMetric(SpbWriter& w, const char* name, uint32_t datatype, uint64_t timestamp) {
+  size_t mark = spbBeginMessage(w, 2);
+  if (name) spbStringField(w, 1, name);
+  spbVarintField(w, 3, timestamp);
+  spbVarintField(w, 4, datatype);
+  return mark;
+}
+
+// DATA metric sent by alias only: no name, timestamp or datatype
+// (the payload timestamp applies, the datatype is known from the birth)
+inline size_t spbBeginAliasMetric(SpbWriter& w, uint64_t alias) {
+  size_t mark = spbBeginMessage(w, 2);
+  spbVarintField(w, 2, alias);
+  return mark;
+}
+
+inline void spbMetricAlias(SpbWriter& w, uint64_t alias) {
+  spbVarintField(w, 2, alias);
+}
+
+// Own timestamp for a DATA metric, e.g. a buffered sample sent later
+inline void spbMetricTimestamp(SpbWriter& w, uint64_t timestamp) {
+  spbVarintField(w, 3, timestamp);
+}
+
+// Host applications store historical metrics but do not take them as the current value
+inline void spbMetricHistorical(SpbWriter& w) {
+  spbVarintField(w, 5, 1);
+}
+
+inline void spbEndMetric(SpbWriter& w, size_t mark) {
+  spbEndMessage(w, mark);
+}
+
+// Adds properties { engUnit: <unit>, Quality: <quality> } to the open metric.
+// unit nullptr or quality < 0 leaves that property out. A metric has one
+// property set, so both must go in the same call.
+inline void spbMetricProperties(SpbWriter& w, const char* unit, int32_t quality) {
+  size_t props = spbBeginMessage(w, 9);
+  if (unit) spbStringField(w, 1, "engUnit");
+  if (quality >= 0) spbStringField(w, 1, "Quality");
+  if (unit) {
+    size_t value = spbBeginMessage(w, 2);
+    spbVarintField(w, 1, SPB_STRING);
+    spbStringField(w, 8, unit);
+    spbEndMessage(w, value);
+  }
+  if (quality >= 0) {
+    size_t value = spbBeginMessage(w, 2);
+    spbVarintField(w, 1, SPB_INT32);
+    spbVarintField(w, 3, (uint32_t)quality);
+    spbEndMessage(w, value);
+  }
+  spbEndMessage(w, props);
+}
+
+inline void spbMetricEngUnit(SpbWriter& w, const char* unit) {
+  spbMetricProperties(w, unit, -1);
+}
+
+inline void spbMetricQuality(SpbWriter& w, int32_t quality) {
+  spbMetricProperties(w, nullptr, quality);
+}
+
+inline void spbMetricNull(SpbWriter& w)              { spbVarintField(w, 7, 1); }
+inline void spbMetricUInt(SpbWriter& w, uint32_t v)  { spbVarintField(w, 10, v); }
+inline void spbMetricLong(SpbWriter& w, uint64_t v)  { spbVarintField(w, 11, v); }
+inline void spbMetricBool(SpbWriter& w, bool v)      { spbVarintField(w, 14, v ? 1 : 0); }
+inline void spbMetricString(SpbWriter& w, const char* v) { spbStringField(w, 15, v); }
+
+inline void spbMetricFloat(SpbWriter& w, float v) {
+  uint32_t bits;
+  memcpy(&bits, &v, 4);
+  spbFixed32Field(w, 12, bits);
+}
+
+inline void spbMetricDouble(SpbWriter& w, double v) {
+  uint64_t bits;
+  memcpy(&bits, &v, 8);
+  spbFixed64Field(w, 13, bits);
+}
+
+// ================ ALIAS REGISTRY ================
+// Aliases are unique across an edge node and all its devices. NBIRTH resets
+// the registry and every birth metric takes the next number, so the aliases
+// are rebuilt on each rebirth and stay valid until the next NBIRTH.
+struct SpbAliasRegistry {
+  uint32_t next;
+  uint32_t generation;      // Bumped on every reset (= every NBIRTH)
+
+  void reset() {
+    next = 1;
+    generation++;
+  }
+
+  uint32_t assign() { return next++; }
+};
+
+// ================ DECODER ================
+#define SPB_VALUE_NONE    0
+#define SPB_VALUE_INT     1     // int_value / long_value / boolean_value
+#define SPB_VALUE_FLOAT   2
+#define SPB_VALUE_DOUBLE  3
+#define SPB_VALUE_STRING  4
+
+// A decoded metric. Strings point into the payload buffer (not 0-terminated).
+struct SpbMetricView {
+  const char* name;
+  uint16_t nameLen;         // 0 = no name (alias only)
+  uint64_t alias;
+  bool hasAlias;
+  uint64_t timestamp;
+  uint32_t datatype;
+  bool isHistorical;
+  bool isNull;
+  const char* engUnit;
+  uint16_t engUnitLen;
+  int32_t quality;          // SPB_QUALITY_GOOD when the metric has no Quality property
+
+  uint8_t valueKind;
+  uint64_t intValue;
+  float floatValue;
+  double doubleValue;
+  const char* stringValue;
+  uint16_t stringLen;
+
+  double asDouble() const {
+    switch (valueKind) {
+      case SPB_VALUE_FLOAT:  return floatValue;
+      case SPB_VALUE_DOUBLE: return doubleValue;
+      case SPB_VALUE_INT:
+        // Signed types are sent as two's complement in the unsigned field
+        if (datatype == SPB_INT8)  return (int8_t)intValue;
+        if (datatype == SPB_INT16) return (int16_t)intValue;
+        if (datatype == SPB_INT32) return (int32_t)intValue;
+        if (datatype == SPB_INT64) return (double)(int64_t)intValue;
+        return (double)intValue;
+      default: return 0.0;
+    }
+  }
+};
+
+struct SpbPayloadView {
+  uint64_t timestamp;
+  uint64_t seq;
+  bool hasSeq;
+  size_t numMetrics;        // Metrics in the payload (may exceed the array given)
+};
+
+struct SpbReader {
+  const uint8_t* p;
+  const uint8_t* end;
+};
+
+inline bool spbReadVarint(SpbReader& r, uint64_t& v) {
+  v = 0;
+  for (uint8_t shift = 0; shift < 64; shift += 7) {
+    if (r.p >= r.end) return false;
+    uint8_t b = *r.p++;
+    v |= (uint64_t)(b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+inline bool spbReadLength(SpbReader& r, SpbReader& sub) {
+  uint64_t n;
+  if (!spbReadVarint(r, n) || n > (uint64_t)(r.end - r.p)) return false;
+  sub.p = r.p;
+  sub.end = r.p + n;
+  r.p += n;
+  return true;
+}
+
+inline bool spbReadFixed(SpbReader& r, uint8_t bytes, uint64_t& v) {
+  if (r.end - r.p < bytes) return false;
+  v = 0;
+  for (uint8_t i = 0; i < bytes; i++) v |= (uint64_t)r.p[i] << (8 * i);
+  r.p += bytes;
+  return true;
+}
+
+inline bool spbSkipField(SpbReader& r, uint8_t wireType) {
+  uint64_t v;
+  SpbReader sub;
+  switch (wireType) {
+    case SPB_WIRE_VARINT:  return spbReadVarint(r, v);
+    case SPB_WIRE_FIXED64: return spbReadFixed(r, 8, v);
+    case SPB_WIRE_LENGTH:  return spbReadLength(r, sub);
+    case SPB_WIRE_FIXED32: return spbReadFixed(r, 4, v);
+    default:               return false;
+  }
+}
+
+// Finds the "engUnit" string and the "Quality" int in a PropertySet
+inline bool spbDecodeProperties(SpbReader r, SpbMetricView& m) {
+  int unitIndex = -1;
+  int qualityIndex = -1;
+  int keyIndex = 0;
+  int valueIndex = 0;
+
+  while (r.p < r.end) {
+    uint64_t tag;
+    if (!spbReadVarint(r, tag)) return false;
+    uint8_t field = tag >> 3;
+    uint8_t wire = tag & 7;
+
+    if (field == 1 && wire == SPB_WIRE_LENGTH) {
+      SpbReader key;
+      if (!spbReadLength(r, key)) return false;
+      if (key.end - key.p == 7 && memcmp(key.p, "engUnit", 7) == 0) unitIndex = keyIndex;
+      if (key.end - key.p == 7 && memcmp(key.p, "Quality", 7) == 0) qualityIndex = keyIndex;
+      keyIndex++;
+    } else if (field == 2 && wire == SPB_WIRE_LENGTH) {
+      SpbReader value;
+      if (!spbReadLength(r, value)) return false;
+      int index = valueIndex++;
+      if (index != unitIndex && index != qualityIndex) continue;
+      while (value.p < value.end) {
+        uint64_t vtag;
+        if (!spbReadVarint(value, vtag)) return false;
+        if (index == unitIndex && (vtag >> 3) == 8 && (vtag & 7) == SPB_WIRE_LENGTH) {
+          SpbReader s;
+          if (!spbReadLength(value, s)) return false;
+          m.engUnit = (const char*)s.p;
+          m.engUnitLen = s.end - s.p;
+        } else if (index == qualityIndex && (vtag >> 3) == 3 && (vtag & 7) == SPB_WIRE_VARINT) {
+          uint64_t q;
+          if (!spbReadVarint(value, q)) return false;
+          m.quality = (int32_t)q;
+        } else if (!spbSkipField(value, vtag & 7)) {
+          return false;
+        }
+      }
+    } else if (!spbSkipField(r, wire)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Wire type each Metric field is read as, -1 for fields we do not read
+inline int spbMetricWire(uint8_t field) {
+  switch (field) {
+    case 1: case 9: case 15:
+      return SPB_WIRE_LENGTH;
+    case 2: case 3: case 4: case 5: case 7: case 10: case 11: case 14:
+      return SPB_WIRE_VARINT;
+    case 12: return SPB_WIRE_FIXED32;
+    case 13: return SPB_WIRE_FIXED64;
+    default: return -1;
+  }
+}
+
+inline bool spbDecodeMetric(SpbReader r, SpbMetricView& m) {
+  memset(&m, 0, sizeof(m));
+  m.quality = SPB_QUALITY_GOOD;
+
+  while (r.p < r.end) {
+    uint64_t tag, v;
+    if (!spbReadVarint(r, tag)) return false;
+    uint8_t field = tag >> 3;
+    uint8_t wire = tag & 7;
+    SpbReader sub;
+
+    // A known field number with another wire type (untrusted payloads) is
+    // skipped whole; reading it our way would desync the rest of the message
+    if (spbMetricWire(field) != wire) {
+      if (!spbSkipField(r, wire)) return false;
+      continue;
+    }
+
+    switch (field) {
+      case 1:
+        if (!spbReadLength(r, sub)) return false;
+        m.name = (const char*)sub.p;
+        m.nameLen = sub.end - sub.p;
+        break;
+      case 2:  if (!spbReadVarint(r, m.alias)) return false; m.hasAlias = true; break;
+      case 3:  if (!spbReadVarint(r, m.timestamp)) return false; break;
+      case 4:  if (!spbReadVarint(r, v)) return false; m.datatype = (uint32_t)v; break;
+      case 5:  if (!spbReadVarint(r, v)) return false; m.isHistorical = v != 0; break;
+      case 7:  if (!spbReadVarint(r, v)) return false; m.isNull = v != 0; break;
+      case 9:
+        if (!spbReadLength(r, sub)) return false;
+        if (!spbDecodeProperties(sub, m)) return false;
+        break;
+      case 10:
+      case 11:
+      case 14:
+        if (!spbReadVarint(r, m.intValue)) return false;
+        m.valueKind = SPB_VALUE_INT;
+        break;
+      case 12: {
+        if (!spbReadFixed(r, 4, v)) return false;
+        uint32_t bits = (uint32_t)v;
+        memcpy(&m.floatValue, &bits, 4);
+        m.valueKind = SPB_VALUE_FLOAT;
+        break;
+      }
+      case 13:
+        if (!spbReadFixed(r, 8, v)) return false;
+        memcpy(&m.doubleValue, &v, 8);
+        m.valueKind = SPB_VALUE_DOUBLE;
+        break;
+      case 15:
+        if (!spbReadLength(r, sub)) return false;
+        m.stringValue = (const char*)sub.p;
+        m.stringLen = sub.end - sub.p;
+        m.valueKind = SPB_VALUE_STRING;
+        break;
+    }
+  }
+  return true;
+}
+
+// Decodes a payload into 'metrics' (up to maxMetrics). Returns false on a
+// malformed payload. No allocation; views point into 'buf'.
+inline bool spbDecodePayload(const uint8_t* buf, size_t len, SpbPayloadView& payload,
+                             SpbMetricView* metrics, size_t maxMetrics) {
+  SpbReader r = { buf, buf + len };
+  memset(&payload, 0, sizeof(payload));
+
+  while (r.p < r.end) {
+    uint64_t tag;
+    if (!spbReadVarint(r, tag)) return false;
+    uint8_t field = tag >> 3;
+    uint8_t wire = tag & 7;
+
+    if (field == 1 && wire == SPB_WIRE_VARINT) {
+      if (!spbReadVarint(r, payload.timestamp)) return false;
+    } else if (field == 3 && wire == SPB_WIRE_VARINT) {
+      if (!spbReadVarint(r, payload.seq)) return false;
+      payload.hasSeq = true;
+    } else if (field == 2 && wire == SPB_WIRE_LENGTH) {
+      SpbReader sub;
+      if (!spbReadLength(r, sub)) return false;
+      if (payload.numMetrics < maxMetrics &&
+          !spbDecodeMetric(sub, metrics[payload.numMetrics])) return false;
+      payload.numMetrics++;
+    } else if (!spbSkipField(r, wire)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
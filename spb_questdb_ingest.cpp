@@ -0,0 +1,450 @@
+/**
+ * @file
+ * @brief Sparkplug B to QuestDB ingest daemon
+ *
+ * Built from the paho-sub(1).cpp subscriber. Subscribes to the Sparkplug
+ * DDATA, birth and death topics, decodes the protobuf payloads (aliases are
+ * resolved from the births) and writes one ILP row per metric to QuestDB:
+ *
+ *   spb_metrics,group=..,node=..,device=..,metric=.. value=21.4 <ns>
+ *
+ * The work is split in three stages connected by lock-free SPSC queues:
+ *
+ *   Paho callback --(shard by edge node)--> N decode workers --> 1 writer --> QuestDB
+ *
+ * The callback only moves the message into a queue, so a slow database or
+ * console never holds up the MQTT client. A node always lands on the same
+ * worker, which keeps its messages in order and its alias table private.
+ * A DDATA alias the worker cannot resolve makes it ask the node for a
+ * rebirth (NCMD Node Control/Rebirth), at most once per REBIRTH_HOLDOFF.
+ *
+ * Usage: spb_questdb_ingest [broker-uri] [questdb-host] [questdb-ilp-port] [workers]
+ * A stub sink is enough for testing, e.g. `nc -lk 9009`.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <spdlog/spdlog.h>
+#include <mqtt/async_client.h>
+#include "sparkplug_b.h"
+#include "sparkplug_alias_resolver.h"
+#include "questdb_ilp_writer.h"
+#include "spsc_queue.h"
+
+const std::string DEFAULT_SERVER_ADDRESS("tcp://localhost:1883");
+const std::string CLIENT_ID("SparkplugQuestDBIngest");
+const std::string DEFAULT_QUESTDB_HOST("localhost");
+const uint16_t DEFAULT_QUESTDB_PORT = 9009;
+const size_t DEFAULT_WORKERS = 2;
+const size_t MAX_WORKERS = 64;
+const char* const TABLE = "spb_metrics";
+
+const size_t MAX_METRICS = 256;
+const size_t MESSAGE_QUEUE_SIZE = 8192;      ///< Per worker: callback -> worker
+const size_t CHUNK_QUEUE_SIZE = 4096;        ///< Per worker: worker -> writer
+const size_t BATCH_MAX_BYTES = 256 * 1024;
+const size_t BATCH_MAX_ROWS = 10000;
+const auto BATCH_MAX_DELAY = std::chrono::milliseconds(200);
+const auto IDLE_SLEEP = std::chrono::microseconds(200);
+const auto STATS_INTERVAL = std::chrono::seconds(10);
+const auto REBIRTH_HOLDOFF = std::chrono::seconds(10);   ///< Min time between rebirth requests per node
+
+/// Timestamps below this (year 2001) are uptime milliseconds, not epoch time
+const uint64_t MIN_EPOCH_MS = 1000000000000ULL;
+
+const char* const TOPICS[] = {
+    "spBv1.0/+/NBIRTH/+",
+    "spBv1.0/+/NDEATH/+",
+    "spBv1.0/+/DBIRTH/+/+",
+    "spBv1.0/+/DDEATH/+/+",
+    "spBv1.0/+/DDATA/+/+",
+};
+
+std::atomic<bool> running(true);
+
+/**
+ * @brief Converts a Sparkplug timestamp to epoch nanoseconds
+ *
+ * Edge nodes without a wall clock send millis() since boot. Those are
+ * moved to wall-clock time by the age relative to the payload timestamp,
+ * which is the node's "now" when it sent the message.
+ */
+int64_t toEpochNs(uint64_t ts, uint64_t payloadTs, uint64_t nowMs) {
+    if (ts == 0) return 0;
+    if (ts < MIN_EPOCH_MS) {
+        uint64_t age = payloadTs > ts ? payloadTs - ts : 0;
+        ts = nowMs - age;
+    }
+    return static_cast<int64_t>(ts) * 1000000;
+}
+
+/**
+ * @brief Picks the worker for a topic from its group and edge node
+ *
+ * spBv1.0/<group>/<type>/<node>[/<device>] - the type is skipped so births,
+ * data and deaths of one node go to the same worker.
+ */
+size_t shardOf(std::string_view topic, size_t shards) {
+    size_t p1 = topic.find('/');
+    size_t p2 = topic.find('/', p1 + 1);
+    size_t p3 = topic.find('/', p2 + 1);
+    if (p1 == std::string_view::npos || p2 == std::string_view::npos || p3 == std::string_view::npos) {
+        return 0;
+    }
+    size_t p4 = topic.find('/', p3 + 1);
+    std::string_view group = topic.substr(p1 + 1, p2 - p1 - 1);
+    std::string_view node = topic.substr(p3 + 1, p4 == std::string_view::npos ? p4 : p4 - p3 - 1);
+    size_t h = std::hash<std::string_view>()(group) * 31 + std::hash<std::string_view>()(node);
+    return h % shards;
+}
+
+/// ILP lines built from one message (stage 2 -> 3)
+struct RowChunk {
+    std::string lines;
+    size_t rows = 0;
+};
+
+/**
+ * @class IngestWorker
+ * @brief Stage 2: decodes the messages of its edge nodes into ILP lines
+ */
+class IngestWorker {
+public:
+    explicit IngestWorker(mqtt::async_client& client)
+        : in(MESSAGE_QUEUE_SIZE), out(CHUNK_QUEUE_SIZE), client_(client) {}
+
+    SpscQueue<mqtt::const_message_ptr> in;
+    SpscQueue<RowChunk> out;
+
+    std::atomic<uint64_t> processed{0};
+    std::atomic<uint64_t> decodeErrors{0};
+    std::atomic<uint64_t> unknownAliases{0};
+    std::atomic<uint64_t> rebirths{0};      ///< Rebirth requests sent for unknown aliases
+    std::atomic<uint64_t> stalls{0};        ///< Times the writer queue was full
+
+    /// Runs until 'stop' is set and the input queue is empty
+    void run(const std::atomic<bool>& stop) {
+        mqtt::const_message_ptr msg;
+        while (true) {
+            if (!in.pop(msg)) {
+                if (stop) break;
+                std::this_thread::sleep_for(IDLE_SLEEP);
+                continue;
+            }
+
+            RowChunk chunk;
+            process(*msg, chunk);
+            msg.reset();
+            processed++;
+            if (chunk.rows == 0) continue;
+
+            // Back-pressure stays here; the MQTT callback never waits
+            while (!out.push(std::move(chunk))) {
+                stalls++;
+                std::this_thread::sleep_for(IDLE_SLEEP);
+            }
+        }
+    }
+
+private:
+    void process(const mqtt::message& msg, RowChunk& chunk) {
+        const std::string& payload = msg.get_payload();
+        SparkplugTopic topic = parseSparkplugTopic(msg.get_topic());
+        SpbPayloadView header;
+        if (!topic.valid ||
+            !spbDecodePayload(reinterpret_cast<const uint8_t*>(payload.data()), payload.size(),
+                              header, metrics_, MAX_METRICS)) {
+            decodeErrors++;
+            return;
+        }
+        size_t n = std::min(header.numMetrics, MAX_METRICS);
+        AliasResolver::NodeTable& table = aliases_.node(topic.nodeKey());
+
+        if (topic.type == "NBIRTH") {
+            aliases_.nodeBirth(table);
+        } else if (topic.type == "NDEATH") {
+            aliases_.nodeDeath(table);
+            return;
+        } else if (topic.type == "DDEATH") {
+            return;
+        }
+        bool birth = (topic.type == "NBIRTH" || topic.type == "DBIRTH");
+
+        uint64_t nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+
+        lines_.clear();
+        bool unknownAlias = false;
+        for (size_t i = 0; i < n; i++) {
+            const SpbMetricView& m = metrics_[i];
+            if (birth) aliases_.learn(table, topic.device, m);
+            if (m.isNull || m.valueKind == SPB_VALUE_NONE || m.valueKind == SPB_VALUE_STRING) continue;
+
+            std::string_view name(m.name ? m.name : "", m.nameLen);
+            if (name.empty() && m.hasAlias) {
+                const MetricInfo* info = aliases_.resolve(table, m.alias);
+                if (!info) {
+                    unknownAliases++;
+                    unknownAlias = true;
+                    continue;
+                }
+                name = info->name;
+            }
+
+            lines_.beginRow(TABLE);
+            lines_.tag("group", topic.group);
+            lines_.tag("node", topic.node);
+            lines_.tag("device", topic.device);
+            lines_.tag("metric", name);
+            lines_.field("value", m.asDouble());
+            if (m.isHistorical) lines_.fieldBool("historical", true);
+            lines_.endRow(toEpochNs(m.timestamp ? m.timestamp : header.timestamp,
+                                    header.timestamp, nowMs));
+        }
+        chunk.lines.assign(lines_.text());
+        chunk.rows = lines_.rows();
+
+        if (unknownAlias) {
+            requestRebirth(topic);
+        }
+    }
+
+    /**
+     * @brief Asks an edge node to re-send its births (NCMD Node Control/Rebirth)
+     *
+     * Same request as paho-sub. Rate limited per node, so a burst of DDATA
+     * with stale aliases only triggers one request. The node always lands on
+     * this worker, so the holdoff table needs no lock.
+     */
+    void requestRebirth(const SparkplugTopic& topic) {
+        auto now = std::chrono::steady_clock::now();
+        auto& last = lastRebirth_[topic.nodeKey()];
+        if (last.time_since_epoch().count() != 0 && now - last < REBIRTH_HOLDOFF) {
+            return;
+        }
+        last = now;
+
+        uint8_t buf[64];
+        SpbWriter w;
+        spbInit(w, buf, sizeof(buf));
+        uint64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        spbVarintField(w, 1, ms);
+        size_t m = spbBeginMetric(w, "Node Control/Rebirth", SPB_BOOLEAN, ms);
+        spbMetricBool(w, true);
+        spbEndMetric(w, m);
+
+        const std::string ncmd = "spBv1.0/" + topic.group + "/NCMD/" + topic.node;
+        try {
+            client_.publish(ncmd, buf, w.len, 0, false);
+            rebirths++;
+            spdlog::info("Unknown alias from {}, requested rebirth", topic.nodeKey());
+        } catch (const mqtt::exception& exc) {
+            spdlog::warn("Rebirth request to {} failed: {}", topic.nodeKey(), exc.what());
+        }
+    }
+
+    AliasResolver aliases_;
+    SpbMetricView metrics_[MAX_METRICS];
+    IlpLineBuffer lines_;
+    mqtt::async_client& client_;
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> lastRebirth_;
+};
+
+/**
+ * @class IngestPipeline
+ * @brief Stage 1 (Paho callback) plus the worker and writer threads
+ */
+class IngestPipeline : public virtual mqtt::callback {
+
+public:
+    IngestPipeline(mqtt::async_client& client, IlpBatchWriter& writer, size_t numWorkers)
+        : client_(client), writer_(writer) {
+        for (size_t i = 0; i < numWorkers; i++) {
+            workers_.push_back(std::make_unique<IngestWorker>(client_));
+        }
+    }
+
+    void start() {
+        for (auto& w : workers_) {
+            IngestWorker* worker = w.get();
+            threads_.emplace_back([this, worker] { worker->run(stopWorkers_); });
+        }
+        writerThread_ = std::thread([this] { runWriter(); });
+    }
+
+    /// Lets workers and writer drain their queues, then flushes the last batch
+    void stop() {
+        stopWorkers_ = true;
+        for (auto& t : threads_) t.join();
+        stopWriter_ = true;
+        writerThread_.join();
+    }
+
+    /// Clean session: the subscriptions are gone after every reconnect
+    void connected(const std::string&) override {
+        spdlog::info("Connected to the MQTT broker, subscribing");
+        for (const char* topic : TOPICS) {
+            client_.subscribe(topic, 0);
+        }
+    }
+
+    void connection_lost(const std::string& cause) override {
+        spdlog::warn("MQTT connection lost: {}", cause);
+    }
+
+    /// Stage 1: only hands the message to its worker
+    void message_arrived(mqtt::const_message_ptr msg) override {
+        received_.fetch_add(1, std::memory_order_relaxed);
+        IngestWorker& worker = *workers_[shardOf(msg->get_topic(), workers_.size())];
+        if (!worker.in.push(std::move(msg))) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    void logStats(double seconds) {
+        size_t inDepth = 0, outDepth = 0;
+        uint64_t decodeErrors = 0, unknownAliases = 0, rebirths = 0, stalls = 0;
+        for (auto& w : workers_) {
+            inDepth += w->in.size();
+            outDepth += w->out.size();
+            decodeErrors += w->decodeErrors;
+            unknownAliases += w->unknownAliases;
+            rebirths += w->rebirths;
+            stalls += w->stalls;
+        }
+        uint64_t rows = rowsSent_;
+        spdlog::info("{} msgs, {} dropped | queue depth {} msgs / {} chunks, {} stalls | "
+                     "{:.0f} rows/s, {} rows dropped | {} decode errors, {} unknown aliases, {} rebirths",
+                     received_.load(), dropped_.load(), inDepth, outDepth, stalls,
+                     (rows - lastRows_) / seconds, rowsDropped_.load(), decodeErrors, unknownAliases,
+                     rebirths);
+        lastRows_ = rows;
+    }
+
+private:
+    /// Stage 3: the only thread that touches the writer and the TCP sink
+    void runWriter() {
+        RowChunk chunk;
+        while (true) {
+            bool any = false;
+            for (auto& w : workers_) {
+                for (int i = 0; i < 64 && w->out.pop(chunk); i++) {
+                    writer_.appendRows(chunk.lines, chunk.rows);
+                    any = true;
+                }
+            }
+            writer_.flushIfDue();
+            rowsSent_ = writer_.stats().rows;
+            rowsDropped_ = writer_.stats().droppedRows;
+
+            if (!any) {
+                if (stopWriter_) break;
+                std::this_thread::sleep_for(IDLE_SLEEP);
+            }
+        }
+        writer_.flush();
+        rowsSent_ = writer_.stats().rows;
+        rowsDropped_ = writer_.stats().droppedRows;
+    }
+
+    mqtt::async_client& client_;
+    IlpBatchWriter& writer_;
+    std::vector<std::unique_ptr<IngestWorker>> workers_;
+    std::vector<std::thread> threads_;
+    std::thread writerThread_;
+    std::atomic<bool> stopWorkers_{false};
+    std::atomic<bool> stopWriter_{false};
+
+    std::atomic<uint64_t> received_{0};
+    std::atomic<uint64_t> dropped_{0};       ///< Messages lost because a worker queue was full
+    std::atomic<uint64_t> rowsSent_{0};
+    std::atomic<uint64_t> rowsDropped_{0};
+    uint64_t lastRows_ = 0;
+};
+
+void onSignal(int) {
+    running = false;
+}
+
+/// Parses a whole decimal argument in [min, max]; false on anything else
+template <typename T>
+bool parseNumber(const char* s, T min, T max, T& value) {
+    const char* end = s + std::strlen(s);
+    T v{};
+    auto [p, ec] = std::from_chars(s, end, v);
+    if (ec != std::errc() || p != end || v < min || v > max) return false;
+    value = v;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    const std::string server = argc > 1 ? argv[1] : DEFAULT_SERVER_ADDRESS;
+    const std::string questHost = argc > 2 ? argv[2] : DEFAULT_QUESTDB_HOST;
+    uint16_t questPort = DEFAULT_QUESTDB_PORT;
+    size_t numWorkers = DEFAULT_WORKERS;
+    if (argc > 5 ||
+        (argc > 3 && !parseNumber<uint16_t>(argv[3], 1, 65535, questPort)) ||
+        (argc > 4 && !parseNumber<size_t>(argv[4], 1, MAX_WORKERS, numWorkers))) {
+        std::fprintf(stderr, "Usage: %s [broker-uri] [questdb-host] [questdb-ilp-port 1-65535] "
+                             "[workers 1-%zu]\n", argv[0], MAX_WORKERS);
+        return 1;
+    }
+
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    IlpTcpSink sink(questHost, questPort);
+    IlpBatchWriter writer(sink, BATCH_MAX_BYTES, BATCH_MAX_ROWS, BATCH_MAX_DELAY);
+
+    mqtt::async_client client(server, CLIENT_ID);
+    IngestPipeline pipeline(client, writer, numWorkers);
+    client.set_callback(pipeline);
+    pipeline.start();
+
+    mqtt::connect_options connOpts;
+    connOpts.set_clean_session(true);
+    connOpts.set_keep_alive_interval(20);
+    connOpts.set_automatic_reconnect(1, 30);
+
+    try {
+        spdlog::info("Starting Sparkplug ingest: {} -> {}:{} ({} workers)",
+                     server, questHost, questPort, numWorkers);
+        client.connect(connOpts)->wait();
+
+        auto lastStats = std::chrono::steady_clock::now();
+        while (running) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+            auto now = std::chrono::steady_clock::now();
+            if (now - lastStats >= STATS_INTERVAL) {
+                pipeline.logStats(std::chrono::duration<double>(now - lastStats).count());
+                lastStats = now;
+            }
+        }
+
+        spdlog::info("Stopping, draining the pipeline");
+        client.disconnect()->wait();
+    } catch (const mqtt::exception& exc) {
+        spdlog::error("Error: {}", exc.what());
+        pipeline.stop();
+        return 1;
+    }
+
+    pipeline.stop();
+
+    return 0;
+}
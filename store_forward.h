@@ -0,0 +1,80 @@
+/*
+Store-and-forward buffer til samples der ikke kunne sendes.
+
+Når WiFi eller MQTT brokeren er væk, gemmes hver sweep som en kompakt
+record: timestamp + slave + metric-værdierne som rå 16-bit register-værdier
+(4 + 4 + 2*16 = 40 bytes, mod ~72 bytes for hele SensorData). En bitmaske
+markerer de metrics hvis register havde åben circuit breaker - deres værdi
+er gammel og sendes som null med Quality bad. Recordsne ligger i
+en fast ring buffer i RAM. Er bufferen fuld, skubbes den ældste record ud
+(til flash hvis det er slået til i programmet, ellers tælles den som tabt).
+
+Efter reconnect sendes recordsne igen som historiske DDATA i små portioner,
+så en lang backlog ikke fylder brokeren eller blokerer for live data.
+*/
+
+#ifndef STORE_FORWARD_H
+#define STORE_FORWARD_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SF_MAX_VALUES   16    // Metrics per record (one bit each in SfRecord::bad)
+#define SF_RAM_RECORDS  256   // Records kept in RAM (256 * 40 bytes = 10 KB)
+
+struct SfRecord {
+  uint32_t timestamp;                 // Sample time (ms)
+  uint8_t slave;                      // Index of the slave the sample came from
+  uint8_t reserved;
+  uint16_t bad;                       // Bit i set: metric i was not read (breaker open), value is stale
+  uint16_t values[SF_MAX_VALUES];     // Raw register value per metric
+};
+
+// ================ RAM RING BUFFER ================
+class StoreForwardBuffer {
+public:
+  uint16_t size() const  { return _count; }
+  bool empty() const     { return _count == 0; }
+  bool full() const      { return _count == SF_RAM_RECORDS; }
+  uint32_t dropped() const { return _dropped; }
+
+  // Adds a record. When the buffer is full the oldest record is removed
+  // first and copied to 'evicted' (if given). Returns true if one was removed.
+  bool push(const SfRecord& r, SfRecord* evicted = nullptr) {
+    bool removed = false;
+    if (full()) {
+      if (evicted) {
+        *evicted = _records[_head];
+      } else {
+        _dropped++;
+      }
+      _head = (_head + 1) % SF_RAM_RECORDS;
+      _count--;
+      removed = true;
+    }
+    _records[(_head + _count) % SF_RAM_RECORDS] = r;
+    _count++;
+    return removed;
+  }
+
+  // 0 = oldest record
+  const SfRecord& peek(uint16_t i) const {
+    return _records[(_head + i) % SF_RAM_RECORDS];
+  }
+
+  void pop(uint16_t n) {
+    if (n > _count) n = _count;
+    _head = (_head + n) % SF_RAM_RECORDS;
+    _count -= n;
+  }
+
+  void countDropped() { _dropped++; }
+
+private:
+  SfRecord _records[SF_RAM_RECORDS];
+  uint16_t _head = 0;
+  uint16_t _count = 0;
+  uint32_t _dropped = 0;
+};
+
+#endif
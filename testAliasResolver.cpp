@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include "../sparkplug_alias_resolver.h"
+
+namespace {
+
+SpbMetricView birthMetric(const char* name, uint64_t alias, const char* unit = nullptr) {
+    SpbMetricView m;
+    memset(&m, 0, sizeof(m));
+    m.name = name;
+    m.nameLen = static_cast<uint16_t>(strlen(name));
+    m.alias = alias;
+    m.hasAlias = true;
+    m.datatype = SPB_FLOAT;
+    if (unit) {
+        m.engUnit = unit;
+        m.engUnitLen = static_cast<uint16_t>(strlen(unit));
+    }
+    return m;
+}
+
+}  // namespace
+
+//  Topic parsing
+TEST(AliasResolverTest, ParsesDeviceAndNodeTopics) {
+    SparkplugTopic t = parseSparkplugTopic("spBv1.0/Plant/DDATA/Edge1/AHU_1");
+    ASSERT_TRUE(t.valid);
+    EXPECT_EQ(t.group, "Plant");
+    EXPECT_EQ(t.type, "DDATA");
+    EXPECT_EQ(t.node, "Edge1");
+    EXPECT_EQ(t.device, "AHU_1");
+    EXPECT_EQ(t.nodeKey(), "Plant/Edge1");
+
+    t = parseSparkplugTopic("spBv1.0/Plant/NBIRTH/Edge1");
+    ASSERT_TRUE(t.valid);
+    EXPECT_TRUE(t.device.empty());
+
+    EXPECT_FALSE(parseSparkplugTopic("spAv1.0/Plant/NBIRTH/Edge1").valid);
+    EXPECT_FALSE(parseSparkplugTopic("spBv1.0/Plant/NBIRTH").valid);
+}
+
+//  Resolving
+TEST(AliasResolverTest, ResolvesDenseAliases) {
+    AliasResolver resolver;
+    AliasResolver::NodeTable& table = resolver.node("Plant/Edge1");
+    resolver.nodeBirth(table);
+    resolver.learn(table, "AHU_1", birthMetric("Supply Temp", 3, "°C"));
+
+    const MetricInfo* info = resolver.resolve(table, 3);
+    ASSERT_NE(info, nullptr);
+    EXPECT_EQ(info->name, "Supply Temp");
+    EXPECT_EQ(info->device, "AHU_1");
+    EXPECT_EQ(info->unit, "°C");
+    EXPECT_EQ(info->datatype, static_cast<uint32_t>(SPB_FLOAT));
+
+    EXPECT_EQ(resolver.resolve(table, 2), nullptr);     // Gap below a known alias
+    EXPECT_EQ(resolver.resolve(table, 4), nullptr);
+}
+
+TEST(AliasResolverTest, ResolvesAliasesAboveDenseRange) {
+    AliasResolver resolver;
+    AliasResolver::NodeTable& table = resolver.node("Plant/Edge1");
+    resolver.nodeBirth(table);
+
+    const uint64_t edge = AliasResolver::MAX_DENSE_ALIAS;
+    resolver.learn(table, "AHU_1", birthMetric("Below", edge - 1));
+    resolver.learn(table, "AHU_1", birthMetric("At", edge));
+    resolver.learn(table, "AHU_2", birthMetric("Far", 1ULL << 40));
+
+    ASSERT_NE(resolver.resolve(table, edge - 1), nullptr);
+    EXPECT_EQ(resolver.resolve(table, edge - 1)->name, "Below");
+    ASSERT_NE(resolver.resolve(table, edge), nullptr);
+    EXPECT_EQ(resolver.resolve(table, edge)->name, "At");
+    ASSERT_NE(resolver.resolve(table, 1ULL << 40), nullptr);
+    EXPECT_EQ(resolver.resolve(table, 1ULL << 40)->device, "AHU_2");
+
+    // Large aliases stay out of the flat table
+    EXPECT_EQ(table.dense.size(), edge);
+    EXPECT_EQ(resolver.resolve(table, edge + 1), nullptr);
+}
+
+TEST(AliasResolverTest, MetricsWithoutNameOrAliasAreIgnored) {
+    AliasResolver resolver;
+    AliasResolver::NodeTable& table = resolver.node("Plant/Edge1");
+    resolver.nodeBirth(table);
+
+    SpbMetricView noAlias = birthMetric("Name", 5);
+    noAlias.hasAlias = false;
+    resolver.learn(table, "", noAlias);
+    SpbMetricView noName = birthMetric("", 6);
+    resolver.learn(table, "", noName);
+
+    EXPECT_EQ(resolver.resolve(table, 5), nullptr);
+    EXPECT_EQ(resolver.resolve(table, 6), nullptr);
+}
+
+//  Birth and death
+TEST(AliasResolverTest, BirthAndDeathForgetAliases) {
+    AliasResolver resolver;
+    AliasResolver::NodeTable& table = resolver.node("Plant/Edge1");
+    resolver.nodeBirth(table);
+    resolver.learn(table, "AHU_1", birthMetric("Old", 7));
+    resolver.learn(table, "AHU_1", birthMetric("OldFar", 5000));
+
+    resolver.nodeBirth(table);
+    EXPECT_TRUE(table.born);
+    EXPECT_EQ(resolver.resolve(table, 7), nullptr);
+    EXPECT_EQ(resolver.resolve(table, 5000), nullptr);
+
+    resolver.learn(table, "AHU_1", birthMetric("New", 7));
+    resolver.nodeDeath(table);
+    EXPECT_FALSE(table.born);
+    EXPECT_EQ(resolver.resolve(table, 7), nullptr);
+}
+
+TEST(AliasResolverTest, NodesHaveOwnTables) {
+    AliasResolver resolver;
+    AliasResolver::NodeTable& a = resolver.node("Plant/Edge1");
+    resolver.learn(a, "AHU_1", birthMetric("A", 1));
+    AliasResolver::NodeTable& b = resolver.node("Plant/Edge2");
+    resolver.learn(b, "AHU_1", birthMetric("B", 1));
+
+    EXPECT_EQ(resolver.resolve(resolver.node("Plant/Edge1"), 1)->name, "A");
+    EXPECT_EQ(resolver.resolve(resolver.node("Plant/Edge2"), 1)->name, "B");
+}
@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include "../questdb_ilp_writer.h"
+
+//  Row layout
+TEST(IlpLineBufferTest, RowWithTagsFieldsAndTimestamp) {
+    IlpLineBuffer lines;
+    lines.beginRow("spb_metrics");
+    lines.tag("group", "Plant");
+    lines.tag("metric", "Supply Temp");
+    lines.field("value", 21.5);
+    lines.fieldInt("count", -3);
+    lines.fieldBool("historical", true);
+    EXPECT_TRUE(lines.endRow(1700000000000000000LL));
+
+    EXPECT_EQ(lines.text(),
+              "spb_metrics,group=Plant,metric=Supply\\ Temp value=21.5,count=-3i,historical=t "
+              "1700000000000000000\n");
+    EXPECT_EQ(lines.rows(), 1u);
+}
+
+TEST(IlpLineBufferTest, ZeroTimestampLetsServerStamp) {
+    IlpLineBuffer lines;
+    lines.beginRow("t");
+    lines.fieldBool("ok", false);
+    lines.endRow(0);
+    EXPECT_EQ(lines.text(), "t ok=f\n");
+}
+
+//  Escaping
+TEST(IlpLineBufferTest, EscapesTableNames) {
+    IlpLineBuffer lines;
+    lines.beginRow("my table,1=a");
+    lines.field("v", 1);
+    lines.endRow(0);
+    // '=' is legal in a table name
+    EXPECT_EQ(lines.text(), "my\\ table\\,1=a v=1\n");
+}
+
+TEST(IlpLineBufferTest, EscapesTagKeysAndValues) {
+    IlpLineBuffer lines;
+    lines.beginRow("t");
+    lines.tag("k=1,x y", "a,b=c d\\e");
+    lines.field("v", 1);
+    lines.endRow(0);
+    EXPECT_EQ(lines.text(), "t,k\\=1\\,x\\ y=a\\,b\\=c\\ d\\\\e v=1\n");
+}
+
+TEST(IlpLineBufferTest, EscapesFieldKeys) {
+    IlpLineBuffer lines;
+    lines.beginRow("t");
+    lines.field("Temp = out, C", 2);
+    lines.endRow(0);
+    EXPECT_EQ(lines.text(), "t Temp\\ \\=\\ out\\,\\ C=2\n");
+}
+
+TEST(IlpLineBufferTest, NewlinesCannotEndTheRow) {
+    IlpLineBuffer lines;
+    lines.beginRow("t");
+    lines.tag("metric", "line1\nline2\r");
+    lines.field("v", 1);
+    lines.endRow(0);
+    EXPECT_EQ(lines.text(), "t,metric=line1\\ line2\\  v=1\n");
+}
+
+//  Dropped values and rows
+TEST(IlpLineBufferTest, EmptyTagIsLeftOut) {
+    IlpLineBuffer lines;
+    lines.beginRow("t");
+    lines.tag("device", "");
+    lines.field("v", 1);
+    lines.endRow(0);
+    EXPECT_EQ(lines.text(), "t v=1\n");
+}
+
+TEST(IlpLineBufferTest, RowWithoutFiniteFieldsIsDropped) {
+    IlpLineBuffer lines;
+    lines.beginRow("t");
+    lines.field("v", 1);
+    lines.endRow(0);
+
+    lines.beginRow("t");
+    lines.tag("metric", "broken");
+    lines.field("v", std::nan(""));
+    lines.field("w", INFINITY);
+    EXPECT_FALSE(lines.endRow(5));
+
+    EXPECT_EQ(lines.text(), "t v=1\n");
+    EXPECT_EQ(lines.rows(), 1u);
+}
+
+TEST(IlpLineBufferTest, ClearKeepsCapacity) {
+    IlpLineBuffer lines;
+    lines.reserve(4096);
+    lines.append("t v=1\nt v=2\n", 2);
+    EXPECT_EQ(lines.rows(), 2u);
+    lines.clear();
+    EXPECT_EQ(lines.size(), 0u);
+    EXPECT_EQ(lines.rows(), 0u);
+    EXPECT_GE(lines.text().capacity(), 4096u);
+}
+
+//  Retry after a partial write
+TEST(IlpRowsEndTest, ResumesAtFirstIncompleteRow) {
+    std::string_view text = "t v=1\nt v=2\nt v=3\n";
+    EXPECT_EQ(ilpRowsEnd(text, 0), 0u);
+    EXPECT_EQ(ilpRowsEnd(text, 5), 0u);     // First row cut before its newline
+    EXPECT_EQ(ilpRowsEnd(text, 6), 6u);
+    EXPECT_EQ(ilpRowsEnd(text, 9), 6u);
+    EXPECT_EQ(ilpRowsEnd(text, text.size()), text.size());
+}
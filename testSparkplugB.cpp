@@ -0,0 +1,212 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "../sparkplug_b.h"
+
+//  Encode -> decode round trip
+TEST(SparkplugBTest, BirthAndDataRoundTrip) {
+    uint8_t buf[512];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    spbPayloadHeader(w, 1700000000123ULL, 7);
+
+    size_t m = spbBeginMetric(w, "Supply Temp", SPB_FLOAT, 1700000000000ULL);
+    spbMetricAlias(w, 12);
+    spbMetricProperties(w, "°C", SPB_QUALITY_GOOD);
+    spbMetricFloat(w, 21.5f);
+    spbEndMetric(w, m);
+
+    m = spbBeginAliasMetric(w, 300);
+    spbMetricLong(w, 1234567890123ULL);
+    spbEndMetric(w, m);
+
+    m = spbBeginAliasMetric(w, 13);
+    spbMetricDouble(w, -0.25);
+    spbEndMetric(w, m);
+    ASSERT_FALSE(w.overflow);
+
+    SpbPayloadView header;
+    SpbMetricView metrics[4];
+    ASSERT_TRUE(spbDecodePayload(buf, w.len, header, metrics, 4));
+    EXPECT_EQ(header.timestamp, 1700000000123ULL);
+    EXPECT_TRUE(header.hasSeq);
+    EXPECT_EQ(header.seq, 7u);
+    ASSERT_EQ(header.numMetrics, 3u);
+
+    const SpbMetricView& birth = metrics[0];
+    EXPECT_EQ(std::string(birth.name, birth.nameLen), "Supply Temp");
+    EXPECT_TRUE(birth.hasAlias);
+    EXPECT_EQ(birth.alias, 12u);
+    EXPECT_EQ(birth.timestamp, 1700000000000ULL);
+    EXPECT_EQ(birth.datatype, static_cast<uint32_t>(SPB_FLOAT));
+    EXPECT_EQ(std::string(birth.engUnit, birth.engUnitLen), "°C");
+    EXPECT_EQ(birth.quality, SPB_QUALITY_GOOD);
+    EXPECT_EQ(birth.valueKind, SPB_VALUE_FLOAT);
+    EXPECT_FLOAT_EQ(birth.floatValue, 21.5f);
+
+    EXPECT_EQ(metrics[1].nameLen, 0u);
+    EXPECT_EQ(metrics[1].alias, 300u);
+    EXPECT_EQ(metrics[1].valueKind, SPB_VALUE_INT);
+    EXPECT_EQ(metrics[1].intValue, 1234567890123ULL);
+
+    EXPECT_EQ(metrics[2].valueKind, SPB_VALUE_DOUBLE);
+    EXPECT_DOUBLE_EQ(metrics[2].asDouble(), -0.25);
+}
+
+//  2-byte length back-patching
+TEST(SparkplugBTest, ShortMetricLengthIsPaddedVarint) {
+    uint8_t buf[64];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    size_t m = spbBeginAliasMetric(w, 1);
+    spbMetricUInt(w, 5);
+    spbEndMetric(w, m);
+
+    // Tag, then the length as 0x80|n, 0x00 for n < 128
+    size_t n = w.len - m - 2;
+    EXPECT_EQ(buf[m], 0x80 | n);
+    EXPECT_EQ(buf[m + 1], 0x00);
+
+    SpbPayloadView header;
+    SpbMetricView metric;
+    ASSERT_TRUE(spbDecodePayload(buf, w.len, header, &metric, 1));
+    EXPECT_EQ(metric.alias, 1u);
+    EXPECT_EQ(metric.intValue, 5u);
+}
+
+TEST(SparkplugBTest, LongMetricLengthUsesBothBytes) {
+    const std::string text(300, 'x');
+    uint8_t buf[512];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    size_t m = spbBeginMetric(w, "Text", SPB_STRING, 1);
+    spbMetricString(w, text.c_str());
+    spbEndMetric(w, m);
+    ASSERT_FALSE(w.overflow);
+
+    size_t n = w.len - m - 2;
+    ASSERT_GT(n, 127u);
+    EXPECT_EQ(buf[m], 0x80 | (n & 0x7F));
+    EXPECT_EQ(buf[m + 1], n >> 7);
+
+    SpbPayloadView header;
+    SpbMetricView metric;
+    ASSERT_TRUE(spbDecodePayload(buf, w.len, header, &metric, 1));
+    EXPECT_EQ(metric.valueKind, SPB_VALUE_STRING);
+    EXPECT_EQ(std::string(metric.stringValue, metric.stringLen), text);
+}
+
+TEST(SparkplugBTest, MetricOverMaxLengthOverflows) {
+    static uint8_t buf[20000];
+    static char text[16400];
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    size_t m = spbBeginAliasMetric(w, 1);
+    spbMetricString(w, text);
+    spbEndMetric(w, m);
+    EXPECT_TRUE(w.overflow);
+}
+
+//  Null, historical and quality
+TEST(SparkplugBTest, NullHistoricalBadQuality) {
+    uint8_t buf[128];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    size_t m = spbBeginAliasMetric(w, 42);
+    spbMetricTimestamp(w, 999);
+    spbMetricHistorical(w);
+    spbMetricQuality(w, SPB_QUALITY_BAD);
+    spbMetricNull(w);
+    spbEndMetric(w, m);
+
+    m = spbBeginAliasMetric(w, 43);
+    spbMetricUInt(w, 1);
+    spbEndMetric(w, m);
+
+    SpbPayloadView header;
+    SpbMetricView metrics[2];
+    ASSERT_TRUE(spbDecodePayload(buf, w.len, header, metrics, 2));
+    EXPECT_FALSE(header.hasSeq);
+
+    EXPECT_TRUE(metrics[0].isNull);
+    EXPECT_TRUE(metrics[0].isHistorical);
+    EXPECT_EQ(metrics[0].quality, SPB_QUALITY_BAD);
+    EXPECT_EQ(metrics[0].timestamp, 999u);
+    EXPECT_EQ(metrics[0].valueKind, SPB_VALUE_NONE);
+    EXPECT_EQ(metrics[0].engUnitLen, 0u);
+
+    // Flags do not leak into the next metric
+    EXPECT_FALSE(metrics[1].isNull);
+    EXPECT_FALSE(metrics[1].isHistorical);
+    EXPECT_EQ(metrics[1].quality, SPB_QUALITY_GOOD);
+}
+
+//  Writer limits and malformed input
+TEST(SparkplugBTest, RollbackAfterOverflow) {
+    uint8_t buf[16];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    spbPayloadHeader(w, 1, 0);
+    size_t mark = w.len;
+    spbStringField(w, 15, "much too long for this buffer");
+    EXPECT_TRUE(w.overflow);
+
+    spbRollback(w, mark);
+    EXPECT_FALSE(w.overflow);
+    EXPECT_EQ(w.len, mark);
+}
+
+TEST(SparkplugBTest, TruncatedPayloadIsRejected) {
+    uint8_t buf[64];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    spbPayloadHeader(w, 1, 0);
+    size_t m = spbBeginMetric(w, "Name", SPB_UINT16, 1);
+    spbMetricUInt(w, 10);
+    spbEndMetric(w, m);
+
+    SpbPayloadView header;
+    SpbMetricView metric;
+    EXPECT_FALSE(spbDecodePayload(buf, w.len - 1, header, &metric, 1));
+}
+
+TEST(SparkplugBTest, KnownFieldWithOtherWireTypeIsSkipped) {
+    uint8_t buf[128];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    size_t m = spbBeginMessage(w, 2);
+    spbStringField(w, 2, "\x08\x05");        // alias as bytes
+    spbFixed64Field(w, 3, 0x0102030405060708ULL);   // timestamp as fixed64
+    spbFixed32Field(w, 7, 1);                 // is_null as fixed32
+    spbStringField(w, 12, "abcd");            // float value as bytes
+    spbMetricUInt(w, 77);
+    spbEndMessage(w, m);
+
+    SpbPayloadView header;
+    SpbMetricView metric;
+    ASSERT_TRUE(spbDecodePayload(buf, w.len, header, &metric, 1));
+    EXPECT_FALSE(metric.hasAlias);
+    EXPECT_EQ(metric.timestamp, 0u);
+    EXPECT_FALSE(metric.isNull);
+    EXPECT_EQ(metric.valueKind, SPB_VALUE_INT);
+    EXPECT_EQ(metric.intValue, 77u);
+}
+
+TEST(SparkplugBTest, MoreMetricsThanViewsAreCounted) {
+    uint8_t buf[128];
+    SpbWriter w;
+    spbInit(w, buf, sizeof(buf));
+    for (uint32_t i = 1; i <= 5; i++) {
+        size_t m = spbBeginAliasMetric(w, i);
+        spbMetricUInt(w, i);
+        spbEndMetric(w, m);
+    }
+
+    SpbPayloadView header;
+    SpbMetricView metrics[2];
+    ASSERT_TRUE(spbDecodePayload(buf, w.len, header, metrics, 2));
+    EXPECT_EQ(header.numMetrics, 5u);
+    EXPECT_EQ(metrics[1].alias, 2u);
+}
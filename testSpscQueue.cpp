@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <thread>
+#include "../spsc_queue.h"
+
+//  Capacity
+TEST(SpscQueueTest, CapacityRoundsUpToPowerOfTwo) {
+    EXPECT_EQ(SpscQueue<int>(1).capacity(), 2u);
+    EXPECT_EQ(SpscQueue<int>(5).capacity(), 8u);
+    EXPECT_EQ(SpscQueue<int>(8).capacity(), 8u);
+}
+
+TEST(SpscQueueTest, FullAndEmpty) {
+    SpscQueue<int> q(4);
+    int out = 0;
+    EXPECT_FALSE(q.pop(out));
+    for (int i = 0; i < 4; i++) EXPECT_TRUE(q.push(int(i)));
+
+    int extra = 99;
+    EXPECT_FALSE(q.push(std::move(extra)));
+    EXPECT_EQ(extra, 99);                   // Left alone when full
+    EXPECT_EQ(q.size(), 4u);
+
+    ASSERT_TRUE(q.pop(out));
+    EXPECT_EQ(out, 0);
+    EXPECT_TRUE(q.push(4));
+}
+
+//  Wraparound
+TEST(SpscQueueTest, KeepsOrderAcrossWraparound) {
+    SpscQueue<int> q(4);
+    int next = 0, expected = 0, out = 0;
+    // Fill levels 1-3 shift the indices past the end of the slots many times
+    for (int round = 0; round < 1000; round++) {
+        int batch = 1 + round % 3;
+        for (int i = 0; i < batch; i++) ASSERT_TRUE(q.push(int(next++)));
+        EXPECT_EQ(q.size(), static_cast<size_t>(batch));
+        for (int i = 0; i < batch; i++) {
+            ASSERT_TRUE(q.pop(out));
+            EXPECT_EQ(out, expected++);
+        }
+    }
+    EXPECT_FALSE(q.pop(out));
+}
+
+TEST(SpscQueueTest, MovesMoveOnlyValues) {
+    SpscQueue<std::unique_ptr<int>> q(2);
+    for (int i = 0; i < 10; i++) {
+        ASSERT_TRUE(q.push(std::make_unique<int>(i)));
+        std::unique_ptr<int> out;
+        ASSERT_TRUE(q.pop(out));
+        ASSERT_NE(out, nullptr);
+        EXPECT_EQ(*out, i);
+    }
+}
+
+//  Two threads
+TEST(SpscQueueTest, ProducerAndConsumerThreads) {
+    const uint64_t count = 200000;
+    SpscQueue<uint64_t> q(64);
+
+    std::thread producer([&] {
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t v = i;
+            while (!q.push(std::move(v))) std::this_thread::yield();
+        }
+    });
+
+    uint64_t expected = 0, out = 0;
+    bool inOrder = true;
+    while (expected < count) {
+        if (!q.pop(out)) {
+            std::this_thread::yield();
+            continue;
+        }
+        inOrder = inOrder && out == expected;
+        expected++;
+    }
+    producer.join();
+
+    EXPECT_TRUE(inOrder);
+    EXPECT_EQ(q.size(), 0u);
+}
@@ -0,0 +1,68 @@
+/*
+Binær trace-log til poll-motoren.
+
+Hver hændelse (register læst, blok-fejl, sweep start/slut, DDATA sendt ...)
+gemmes som en record på 12 bytes i en fast ring buffer i RAM: timestamp,
+event id, slave, register, rå værdi, Modbus result code og niveau. At skrive
+en record er et par stores - ingen formattering og ingen UART.
+
+Recordsne laves først om til tekst når nogen beder om det (dump kommando)
+eller når verbose er slået til, og så kun så hurtigt som UART'en kan tage
+dem uden at blokere. Er ringen fuld, overskrives de ældste records.
+*/
+
+#ifndef TRACE_LOG_H
+#define TRACE_LOG_H
+
+#include <stdint.h>
+
+#define TRACE_RECORDS 512     // 512 * 12 bytes = 6 KB
+
+#define TRACE_DEBUG 0
+#define TRACE_INFO  1
+#define TRACE_WARN  2
+#define TRACE_ERROR 3
+
+struct TraceRecord {
+  uint32_t timestamp;         // millis()
+  uint8_t event;              // Event id, defined by the program
+  uint8_t slave;              // Modbus address, 0 = none
+  uint16_t reg;               // Register, or another argument of the event
+  uint16_t value;             // Raw value, or another argument of the event
+  uint8_t result;             // Modbus result code
+  uint8_t level;              // TRACE_DEBUG .. TRACE_ERROR
+};
+
+// ================ RAM RING BUFFER ================
+class TraceLog {
+public:
+  // Hot path. Records below the minimum level are not even stored.
+  void add(uint32_t now, uint8_t level, uint8_t event, uint8_t slave,
+           uint16_t reg = 0, uint16_t value = 0, uint8_t result = 0) {
+    if (level < _minLevel) return;
+    TraceRecord& r = _records[_total % TRACE_RECORDS];
+    r.timestamp = now;
+    r.event = event;
+    r.slave = slave;
+    r.reg = reg;
+    r.value = value;
+    r.result = result;
+    r.level = level;
+    _total++;
+  }
+
+  // Records are numbered from 0 since start; only the last TRACE_RECORDS exist
+  uint32_t total() const  { return _total; }
+  uint32_t oldest() const { return _total > TRACE_RECORDS ? _total - TRACE_RECORDS : 0; }
+  const TraceRecord& get(uint32_t n) const { return _records[n % TRACE_RECORDS]; }
+
+  uint8_t minLevel() const       { return _minLevel; }
+  void setMinLevel(uint8_t level) { _minLevel = level; }
+
+private:
+  TraceRecord _records[TRACE_RECORDS];
+  uint32_t _total = 0;
+  uint8_t _minLevel = TRACE_DEBUG;
+};
+
+#endif